@@ -0,0 +1,412 @@
+#include <benchmark/benchmark.h>
+
+#include "nioev/lib/FrameScanner.hpp"
+#include "nioev/lib/StaticCodec.hpp"
+#include "nioev/lib/TopicAlias.hpp"
+#include "nioev/lib/Util.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+// Encoders for the variable header and payload of the packets a broker handles most, as the broker lays them out.
+
+void encodeConnect(BinaryEncoder& encoder, MQTTVersion version, const std::string& clientId) {
+    encoder.encodeString("MQTT");
+    encoder.encodeByte(static_cast<uint8_t>(version));
+    encoder.encodeByte(0x02);
+    encoder.encode2Bytes(60);
+    if(version == MQTTVersion::V5) {
+        PropertyList properties;
+        properties.emplace(MQTTProperty::SESSION_EXPIRY_INTERVAL, uint32_t(3600));
+        properties.emplace(MQTTProperty::RECEIVE_MAXIMUM, uint16_t(100));
+        encoder.encodePropertyList(properties);
+    }
+    encoder.encodeString(clientId);
+}
+
+void encodePublish(BinaryEncoder& encoder, MQTTVersion version, const MQTTPacket& packet, uint16_t packetId) {
+    encoder.encodeString(packet.topic);
+    if(packet.qos != QoS::QoS0) {
+        encoder.encode2Bytes(packetId);
+    }
+    if(version == MQTTVersion::V5) {
+        encoder.encodePropertyList(packet.properties);
+    }
+    encoder.encodeBytes(packet.payload);
+}
+
+void encodeSubscribe(BinaryEncoder& encoder, MQTTVersion version, const std::string& filter, uint16_t packetId) {
+    encoder.encode2Bytes(packetId);
+    if(version == MQTTVersion::V5) {
+        encoder.encodePropertyList({});
+    }
+    encoder.encodeString(filter);
+    encoder.encodeByte(static_cast<uint8_t>(QoS::QoS1));
+}
+
+void encodePubAck(BinaryEncoder& encoder, uint16_t packetId) {
+    encoder.encode2Bytes(packetId);
+}
+
+MQTTPacket makePublish(QoS qos, size_t payloadSize) {
+    TopicGenerator generator;
+    MQTTPacket packet{generator.topic(), generator.payload(payloadSize), qos, Retain::No, {}};
+    packet.properties.emplace(MQTTProperty::MESSAGE_EXPIRY_INTERVAL, uint32_t(300));
+    packet.properties.emplace(MQTTProperty::CONTENT_TYPE, std::string{"application/json"});
+    return packet;
+}
+
+std::vector<uint8_t> toVector(SharedBuffer&& buffer) {
+    return std::vector<uint8_t>(buffer.data(), buffer.data() + buffer.size());
+}
+
+MQTTVersion versionOf(const benchmark::State& state) {
+    return state.range(0) == 5 ? MQTTVersion::V5 : MQTTVersion::V4;
+}
+
+void BM_EncodeConnect(benchmark::State& state) {
+    auto version = versionOf(state);
+    for(auto _: state) {
+        BinaryEncoder encoder;
+        encodeConnect(encoder, version, "sensor-0042-a7f3");
+        benchmark::DoNotOptimize(encoder.moveData());
+    }
+}
+BENCHMARK(BM_EncodeConnect)->Arg(4)->Arg(5);
+
+void BM_EncodePublish(benchmark::State& state) {
+    auto version = versionOf(state);
+    auto packet = makePublish(QoS::QoS1, state.range(1));
+    for(auto _: state) {
+        BinaryEncoder encoder;
+        encodePublish(encoder, version, packet, 42);
+        benchmark::DoNotOptimize(encoder.moveData());
+    }
+    state.SetBytesProcessed(state.iterations() * packet.payload.size());
+}
+BENCHMARK(BM_EncodePublish)->ArgsProduct({{4, 5}, {16, 256, 4096}});
+
+void BM_EncodeSubscribe(benchmark::State& state) {
+    auto version = versionOf(state);
+    auto filter = TopicGenerator{}.filter();
+    for(auto _: state) {
+        BinaryEncoder encoder;
+        encodeSubscribe(encoder, version, filter, 42);
+        benchmark::DoNotOptimize(encoder.moveData());
+    }
+}
+BENCHMARK(BM_EncodeSubscribe)->Arg(4)->Arg(5);
+
+void BM_EncodePubAck(benchmark::State& state) {
+    for(auto _: state) {
+        BinaryEncoder encoder;
+        encodePubAck(encoder, 42);
+        benchmark::DoNotOptimize(encoder.moveData());
+    }
+}
+BENCHMARK(BM_EncodePubAck);
+
+void BM_DecodeConnect(benchmark::State& state) {
+    auto version = versionOf(state);
+    BinaryEncoder encoder;
+    encodeConnect(encoder, version, "sensor-0042-a7f3");
+    auto data = toVector(encoder.moveData());
+    for(auto _: state) {
+        BinaryDecoder decoder{data, static_cast<uint>(data.size())};
+        benchmark::DoNotOptimize(decoder.decodeString());
+        benchmark::DoNotOptimize(decoder.decodeByte());
+        benchmark::DoNotOptimize(decoder.decodeByte());
+        benchmark::DoNotOptimize(decoder.decode2Bytes());
+        if(version == MQTTVersion::V5) {
+            benchmark::DoNotOptimize(decoder.decodeProperties());
+        }
+        benchmark::DoNotOptimize(decoder.decodeString());
+    }
+}
+BENCHMARK(BM_DecodeConnect)->Arg(4)->Arg(5);
+
+void BM_DecodePublish(benchmark::State& state) {
+    auto version = versionOf(state);
+    auto packet = makePublish(QoS::QoS1, state.range(1));
+    BinaryEncoder encoder;
+    encodePublish(encoder, version, packet, 42);
+    auto data = toVector(encoder.moveData());
+    for(auto _: state) {
+        BinaryDecoder decoder{data, static_cast<uint>(data.size())};
+        MQTTPacket decoded;
+        decoded.topic = decoder.decodeString();
+        benchmark::DoNotOptimize(decoder.decode2Bytes());
+        if(version == MQTTVersion::V5) {
+            decoded.properties = decoder.decodeProperties();
+        }
+        decoded.payload = payloadToVec(decoder.getRemainingBytes());
+        benchmark::DoNotOptimize(decoded);
+    }
+    state.SetBytesProcessed(state.iterations() * packet.payload.size());
+}
+BENCHMARK(BM_DecodePublish)->ArgsProduct({{4, 5}, {16, 256, 4096}});
+
+void BM_DecodeSubscribe(benchmark::State& state) {
+    auto version = versionOf(state);
+    BinaryEncoder encoder;
+    encodeSubscribe(encoder, version, TopicGenerator{}.filter(), 42);
+    auto data = toVector(encoder.moveData());
+    for(auto _: state) {
+        BinaryDecoder decoder{data, static_cast<uint>(data.size())};
+        benchmark::DoNotOptimize(decoder.decode2Bytes());
+        if(version == MQTTVersion::V5) {
+            benchmark::DoNotOptimize(decoder.decodeProperties());
+        }
+        benchmark::DoNotOptimize(decoder.decodeString());
+        benchmark::DoNotOptimize(decoder.decodeByte());
+    }
+}
+BENCHMARK(BM_DecodeSubscribe)->Arg(4)->Arg(5);
+
+void BM_DecodePubAck(benchmark::State& state) {
+    std::vector<uint8_t> data{0x00, 0x2A};
+    for(auto _: state) {
+        BinaryDecoder decoder{data, static_cast<uint>(data.size())};
+        benchmark::DoNotOptimize(decoder.decode2Bytes());
+    }
+}
+BENCHMARK(BM_DecodePubAck);
+
+// The same packets through PacketCodec, complete with fixed header, so these do slightly more work than the above.
+
+void BM_StaticEncodePublish(benchmark::State& state) {
+    auto packet = makePublish(QoS::QoS1, state.range(1));
+    withMQTTVersion(versionOf(state), [&](auto version) {
+        using Codec = PacketCodec<decltype(version)::value, MQTTMessageType::PUBLISH>;
+        std::vector<uint8_t> out(Codec::headerSize(packet.topic, packet.qos, packet.payload.size(), &packet.properties) + packet.payload.size());
+        for(auto _: state) {
+            auto headerSize = Codec::encodeHeader(out.data(), packet.topic, packet.qos, packet.retain, 42, packet.payload.size(), &packet.properties);
+            memcpy(out.data() + headerSize, packet.payload.data(), packet.payload.size());
+            benchmark::DoNotOptimize(out.data());
+            benchmark::ClobberMemory();
+        }
+    });
+    state.SetBytesProcessed(state.iterations() * packet.payload.size());
+}
+BENCHMARK(BM_StaticEncodePublish)->ArgsProduct({{4, 5}, {16, 256, 4096}});
+
+void BM_StaticDecodePublish(benchmark::State& state) {
+    auto packet = makePublish(QoS::QoS1, state.range(1));
+    withMQTTVersion(versionOf(state), [&](auto version) {
+        using Codec = PacketCodec<decltype(version)::value, MQTTMessageType::PUBLISH>;
+        std::vector<uint8_t> data(Codec::headerSize(packet.topic, packet.qos, packet.payload.size(), &packet.properties) + packet.payload.size());
+        auto headerSize = Codec::encodeHeader(data.data(), packet.topic, packet.qos, packet.retain, 42, packet.payload.size(), &packet.properties);
+        memcpy(data.data() + headerSize, packet.payload.data(), packet.payload.size());
+        // skip the fixed header, like the decoders above get the body only
+        auto bodyOffset = 1 + codec::varByteIntSize(data.size() - 2);
+        for(auto _: state) {
+            benchmark::DoNotOptimize(Codec::decode(data.data() + bodyOffset, data.size() - bodyOffset, data[0] & 0x0F));
+        }
+    });
+    state.SetBytesProcessed(state.iterations() * packet.payload.size());
+}
+BENCHMARK(BM_StaticDecodePublish)->ArgsProduct({{4, 5}, {16, 256, 4096}});
+
+void BM_StaticEncodePubAck(benchmark::State& state) {
+    uint8_t out[PacketCodec<MQTTVersion::V4, MQTTMessageType::PUBACK>::MAX_SIZE];
+    for(auto _: state) {
+        benchmark::DoNotOptimize(PacketCodec<MQTTVersion::V4, MQTTMessageType::PUBACK>::encode(out, 42));
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_StaticEncodePubAck);
+
+void BM_StaticDecodePubAck(benchmark::State& state) {
+    std::vector<uint8_t> data{0x00, 0x2A};
+    for(auto _: state) {
+        benchmark::DoNotOptimize(PacketCodec<MQTTVersion::V4, MQTTMessageType::PUBACK>::decode(data.data(), data.size()));
+    }
+}
+BENCHMARK(BM_StaticDecodePubAck);
+
+/* PUBLISHes to one subscriber with 16 topic aliases: 3 out of 4 go to one of 8 busy topics, the rest to one of 1000
+ * others. The bytes_per_packet counter shows what aliasing saves, the time what it costs.
+ */
+template<typename EvictionPolicy>
+void BM_EncodePublishTopicAlias(benchmark::State& state) {
+    TopicGenerator generator;
+    auto topics = generator.topics(1008);
+    auto payload = generator.payload(32);
+    std::vector<MQTTPacket> packets;
+    for(auto& topic: topics) {
+        packets.emplace_back(MQTTPacket{topic, payload, QoS::QoS0, Retain::No, {}});
+    }
+    std::mt19937_64 random{SEED};
+    std::vector<uint16_t> sequence(4096);
+    for(auto& index: sequence) {
+        index = random() % 4 ? random() % 8 : 8 + random() % 1000;
+    }
+    OutboundTopicAliases<EvictionPolicy> aliases{static_cast<uint16_t>(state.range(0))};
+    size_t index = 0, bytes = 0;
+    for(auto _: state) {
+        BinaryEncoder encoder;
+        aliases.encodePublish(encoder, packets[sequence[index++ % sequence.size()]], 0);
+        auto data = encoder.moveData();
+        bytes += data.size();
+        benchmark::DoNotOptimize(data);
+    }
+    state.counters["bytes_per_packet"] = double(bytes) / state.iterations();
+}
+BENCHMARK_TEMPLATE(BM_EncodePublishTopicAlias, LruAliasEviction)->Arg(0)->Arg(16);
+BENCHMARK_TEMPLATE(BM_EncodePublishTopicAlias, LfuAliasEviction)->Arg(16);
+
+// values that need exactly 1, 2, 3 or 4 bytes, like the remaining lengths of small, medium, large and huge packets
+std::vector<uint32_t> varIntValues(int64_t encodedLength) {
+    static constexpr uint32_t LIMITS[] = {0, 128, 16384, 2097152, 268435456};
+    std::mt19937_64 random{SEED};
+    std::uniform_int_distribution<uint32_t> distribution{LIMITS[encodedLength - 1], LIMITS[encodedLength] - 1};
+    std::vector<uint32_t> ret(4096);
+    for(auto& v: ret) {
+        v = distribution(random);
+    }
+    return ret;
+}
+
+void BM_EncodeVarByteInt(benchmark::State& state) {
+    auto values = varIntValues(state.range(0));
+    size_t index = 0;
+    for(auto _: state) {
+        benchmark::DoNotOptimize(encodeVarByteInt(values[index++ % values.size()]));
+    }
+}
+BENCHMARK(BM_EncodeVarByteInt)->DenseRange(1, 4);
+
+void BM_DecodeVarLengthInteger(benchmark::State& state) {
+    auto values = varIntValues(state.range(0));
+    std::vector<uint8_t> data;
+    for(auto v: values) {
+        auto encoded = encodeVarByteInt(v);
+        data.insert(data.end(), encoded.value, encoded.value + encoded.valueLength);
+    }
+    for(auto _: state) {
+        BinaryDecoder decoder{data, static_cast<uint>(data.size())};
+        while(!decoder.empty()) {
+            benchmark::DoNotOptimize(decoder.decodeVarLengthInteger());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * values.size());
+}
+BENCHMARK(BM_DecodeVarLengthInteger)->DenseRange(1, 4);
+
+/* Reads of 64KiB of pipelined traffic: small QoS0/QoS1 PUBLISHes interleaved with PUBACKs. The payload sizes put the
+ * remaining lengths on both sides of 128, and there are enough different reads that the branch predictor can't learn
+ * the sequence of frame sizes, which it otherwise happily does for a single buffer.
+ */
+std::vector<std::vector<uint8_t>> pipelinedReads() {
+    TopicGenerator generator;
+    std::mt19937_64 random{SEED};
+    std::vector<std::vector<uint8_t>> ret(16);
+    uint8_t packet[512];
+    for(auto& read: ret) {
+        while(read.size() < 64 * 1024) {
+            size_t size;
+            if(random() % 3 == 0) {
+                size = PacketCodec<MQTTVersion::V4, MQTTMessageType::PUBACK>::encode(packet, random());
+            } else {
+                auto payload = generator.payload(16 + random() % 240);
+                auto qos = random() % 2 ? QoS::QoS1 : QoS::QoS0;
+                size = PacketCodec<MQTTVersion::V4, MQTTMessageType::PUBLISH>::encodeHeader(packet, generator.topic(), qos, Retain::No, random(), payload.size());
+                memcpy(packet + size, payload.data(), payload.size());
+                size += payload.size();
+            }
+            read.insert(read.end(), packet, packet + size);
+        }
+    }
+    return ret;
+}
+
+// the framing loop as it was done before FrameScanner: byte by byte, every byte bounds checked
+void BM_FramePerByte(benchmark::State& state) {
+    auto reads = pipelinedReads();
+    size_t frames = 0, bytes = 0, readIndex = 0;
+    for(auto _: state) {
+        auto& data = reads[readIndex++ % reads.size()];
+        size_t offset = 0;
+        while(offset < data.size()) {
+            auto type = data.at(offset++) >> 4;
+            uint32_t multiplier = 1;
+            uint32_t remainingLength = 0;
+            uint8_t encodedByte;
+            do {
+                encodedByte = data.at(offset++);
+                remainingLength += uint32_t(encodedByte & 127) * multiplier;
+                multiplier *= 128;
+            } while((encodedByte & 128) != 0);
+            benchmark::DoNotOptimize(type);
+            offset += remainingLength;
+            frames += 1;
+        }
+        bytes += data.size();
+    }
+    state.SetBytesProcessed(bytes);
+    state.counters["frames"] = benchmark::Counter(frames, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_FramePerByte);
+
+void BM_FrameScanner(benchmark::State& state) {
+    auto reads = pipelinedReads();
+    FrameScanner scanner;
+    std::array<FrameDescriptor, 256> descriptors;
+    size_t frames = 0, bytes = 0, readIndex = 0;
+    for(auto _: state) {
+        auto& data = reads[readIndex++ % reads.size()];
+        size_t offset = 0;
+        while(offset < data.size()) {
+            auto result = scanner.scan(data.data() + offset, data.size() - offset, descriptors);
+            benchmark::DoNotOptimize(descriptors.data());
+            offset += result.consumed;
+            frames += result.frameCount;
+        }
+        bytes += data.size();
+    }
+    state.SetBytesProcessed(bytes);
+    state.counters["frames"] = benchmark::Counter(frames, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_FrameScanner);
+
+void BM_SharedBufferCopyHandle(benchmark::State& state) {
+    SharedBuffer buffer;
+    auto payload = TopicGenerator{}.payload(state.range(0));
+    buffer.append(payload.data(), payload.size());
+    for(auto _: state) {
+        SharedBuffer copy = buffer;
+        benchmark::DoNotOptimize(copy.data());
+    }
+}
+BENCHMARK(BM_SharedBufferCopyHandle)->Arg(64)->Arg(4096)->Arg(65536);
+
+void BM_SharedBufferDeepCopy(benchmark::State& state) {
+    SharedBuffer buffer;
+    auto payload = TopicGenerator{}.payload(state.range(0));
+    buffer.append(payload.data(), payload.size());
+    for(auto _: state) {
+        auto copy = buffer.copy();
+        benchmark::DoNotOptimize(copy.data());
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_SharedBufferDeepCopy)->Arg(64)->Arg(4096)->Arg(65536);
+
+void BM_SharedBufferAppend(benchmark::State& state) {
+    // grows a buffer to the given size in 64 byte pieces, like the encoder does field by field
+    auto chunk = TopicGenerator{}.payload(64);
+    for(auto _: state) {
+        SharedBuffer buffer;
+        for(int64_t i = 0; i < state.range(0); i += chunk.size()) {
+            buffer.append(chunk.data(), chunk.size());
+        }
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SharedBufferAppend)->Arg(64)->Arg(4096)->Arg(65536);
+
+}
\ No newline at end of file
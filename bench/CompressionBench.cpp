@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+
+#include "nioev/lib/Compression.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+std::vector<SharedBuffer> telemetryPayloads(size_t count) {
+    TopicGenerator generator;
+    std::vector<SharedBuffer> ret(count);
+    for(auto& payload: ret) {
+        auto json = generator.telemetry();
+        payload.append(json.data(), json.size());
+    }
+    return ret;
+}
+
+// Arg 0 compresses without a dictionary, Arg 1 with one trained on earlier payloads of the same topic prefix.
+void BM_CompressTelemetry(benchmark::State& state) {
+    if(!PayloadCompressor::isAvailable()) {
+        state.SkipWithError("built without zstd");
+        return;
+    }
+    PayloadCompressor::Config config;
+    config.sampleEvery = 1;
+    // never retrain during the measurement
+    config.samplesForTraining = state.range(0) ? 2000 : SIZE_MAX;
+    PayloadCompressor compressor{config};
+    auto training = telemetryPayloads(2000);
+    for(auto& payload: training) {
+        compressor.compress("telemetry/device", payload);
+    }
+    compressor.trainDictionaries();
+    auto payloads = telemetryPayloads(4096);
+    size_t index = 0, inputBytes = 0, outputBytes = 0;
+    for(auto _: state) {
+        auto& payload = payloads[index++ % payloads.size()];
+        auto compressed = compressor.compress("telemetry/device", payload);
+        inputBytes += payload.size();
+        outputBytes += compressed ? compressed->size() : payload.size();
+        benchmark::DoNotOptimize(compressed);
+    }
+    state.SetBytesProcessed(inputBytes);
+    state.counters["ratio"] = double(inputBytes) / outputBytes;
+}
+BENCHMARK(BM_CompressTelemetry)->Arg(0)->Arg(1);
+
+void BM_DecompressTelemetry(benchmark::State& state) {
+    if(!PayloadCompressor::isAvailable()) {
+        state.SkipWithError("built without zstd");
+        return;
+    }
+    PayloadCompressor::Config config;
+    config.sampleEvery = 1;
+    config.samplesForTraining = state.range(0) ? 2000 : SIZE_MAX;
+    PayloadCompressor compressor{config};
+    for(auto& payload: telemetryPayloads(2000)) {
+        compressor.compress("telemetry/device", payload);
+    }
+    compressor.trainDictionaries();
+    std::vector<SharedBuffer> compressed;
+    for(auto& payload: telemetryPayloads(4096)) {
+        if(auto result = compressor.compress("telemetry/device", payload)) {
+            compressed.emplace_back(std::move(*result));
+        }
+    }
+    size_t index = 0;
+    for(auto _: state) {
+        benchmark::DoNotOptimize(compressor.decompress(compressed[index++ % compressed.size()]));
+    }
+}
+BENCHMARK(BM_DecompressTelemetry)->Arg(0)->Arg(1);
+
+}
\ No newline at end of file
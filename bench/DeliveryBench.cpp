@@ -0,0 +1,161 @@
+#include <benchmark/benchmark.h>
+
+#include "nioev/lib/Delivery.hpp"
+#include "nioev/lib/OutboundQueue.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+// messages routed between two flushes, i.e. what one worker loop iteration typically picks up
+constexpr size_t MESSAGES_PER_ROUND = 16;
+constexpr size_t PAYLOAD_SIZE = 256;
+
+// what subscribers on the old interface have to do to keep a message: copy it
+class CopyingSubscriber final : public Subscriber {
+public:
+    void operator()(const std::string&, const uint8_t* payload, size_t payloadLen, QoS, Retained) override {
+        mQueue.emplace_back(payload, payload + payloadLen);
+    }
+    std::vector<std::vector<uint8_t>> mQueue;
+};
+
+class RetainingSubscriber final : public BatchSubscriber {
+public:
+    void deliver(const DeliveryBatch& batch) override {
+        for(auto& message: batch) {
+            mQueue.push_back(message);
+        }
+    }
+    std::vector<DeliveryMessage> mQueue;
+};
+
+std::vector<DeliveryMessage> roundMessages() {
+    TopicGenerator generator;
+    std::vector<DeliveryMessage> ret;
+    for(size_t i = 0; i < MESSAGES_PER_ROUND; ++i) {
+        auto payload = generator.payload(PAYLOAD_SIZE);
+        ret.emplace_back(generator.topic(), payload.data(), payload.size(), QoS::QoS0, Retained::No);
+    }
+    return ret;
+}
+
+void fanOuts(benchmark::internal::Benchmark* b) {
+    for(int64_t fanOut = 1; fanOut <= 10'000; fanOut *= 10) {
+        b->Arg(fanOut);
+    }
+}
+
+// Every subscriber is subscribed to # and receives every message; the subscribers' queues are emptied after each round.
+void BM_DeliveryPerMessage(benchmark::State& state) {
+    std::vector<CopyingSubscriber> subscribers(state.range(0));
+    SubscriptionTree<Subscriber*> tree;
+    for(auto& subscriber: subscribers) {
+        tree.addSubscription("#", &subscriber);
+    }
+    auto messages = roundMessages();
+    for(auto _: state) {
+        for(auto& message: messages) {
+            tree.forEveryMatch(*message.topic, [&](Subscriber*& subscriber) {
+                (*subscriber)(*message.topic, message.payload.data(), message.payload.size(), message.qos, message.retained);
+            });
+        }
+        state.PauseTiming();
+        for(auto& subscriber: subscribers) {
+            subscriber.mQueue.clear();
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * messages.size() * subscribers.size());
+}
+BENCHMARK(BM_DeliveryPerMessage)->Apply(fanOuts);
+
+void BM_DeliveryBatched(benchmark::State& state) {
+    std::vector<RetainingSubscriber> subscribers(state.range(0));
+    SubscriptionTree<BatchSubscriber*> tree;
+    for(auto& subscriber: subscribers) {
+        tree.addSubscription("#", &subscriber);
+    }
+    auto messages = roundMessages();
+    BatchDispatcher dispatcher;
+    for(auto _: state) {
+        for(auto& message: messages) {
+            dispatcher.route(tree, message);
+        }
+        dispatcher.flush();
+        state.PauseTiming();
+        for(auto& subscriber: subscribers) {
+            subscriber.mQueue.clear();
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * messages.size() * subscribers.size());
+    state.counters["deliverCallsPerRound"] = double(dispatcher.getStats().deliverCalls) / dispatcher.getStats().flushes;
+}
+BENCHMARK(BM_DeliveryBatched)->Apply(fanOuts);
+
+// old style subscribers behind SubscriberAdapter, shows what the batching costs them
+void BM_DeliveryBatchedAdapter(benchmark::State& state) {
+    std::vector<CopyingSubscriber> subscribers(state.range(0));
+    std::vector<std::unique_ptr<SubscriberAdapter>> adapters;
+    SubscriptionTree<BatchSubscriber*> tree;
+    for(auto& subscriber: subscribers) {
+        adapters.emplace_back(std::make_unique<SubscriberAdapter>(subscriber));
+        tree.addSubscription("#", adapters.back().get());
+    }
+    auto messages = roundMessages();
+    BatchDispatcher dispatcher;
+    for(auto _: state) {
+        for(auto& message: messages) {
+            dispatcher.route(tree, message);
+        }
+        dispatcher.flush();
+        state.PauseTiming();
+        for(auto& subscriber: subscribers) {
+            subscriber.mQueue.clear();
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * messages.size() * subscribers.size());
+}
+BENCHMARK(BM_DeliveryBatchedAdapter)->Apply(fanOuts);
+
+/* A client that can only take one in ten messages of a stream of QoS 0 telemetry across 1000 topics. Arg 0 queues
+ * everything up to the limits (dropping the oldest), Arg 1 conflates by topic.
+ */
+void BM_OutboundQueueSlowConsumer(benchmark::State& state) {
+    TopicGenerator generator;
+    std::vector<DeliveryMessage> messages;
+    std::vector<std::shared_ptr<const std::string>> topics;
+    for(size_t i = 0; i < 1000; ++i) {
+        topics.emplace_back(std::make_shared<const std::string>(generator.topic()));
+    }
+    for(size_t i = 0; i < 16384; ++i) {
+        auto json = generator.telemetry();
+        SharedBuffer payload;
+        payload.append(json.data(), json.size());
+        messages.emplace_back(topics[i % topics.size()], std::move(payload), QoS::QoS0, Retained::No);
+    }
+    OutboundQueue::Config config;
+    config.maxMessages = 10000;
+    config.conflateQoS0 = state.range(0);
+    config.dropPolicy = OutboundDropPolicy::DROP_OLDEST;
+    OutboundQueue queue{config};
+    size_t index = 0, queuedBytes = 0;
+    for(auto _: state) {
+        queue.push(messages[index++ % messages.size()]);
+        if(index % 10 == 0) {
+            benchmark::DoNotOptimize(queue.pop());
+        }
+        queuedBytes += queue.bytes();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["avgQueuedBytes"] = double(queuedBytes) / state.iterations();
+    state.counters["dropped"] = queue.getStats().droppedOld;
+    state.counters["conflated"] = queue.getStats().conflated;
+}
+BENCHMARK(BM_OutboundQueueSlowConsumer)->Arg(0)->Arg(1);
+
+}
\ No newline at end of file
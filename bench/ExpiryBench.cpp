@@ -0,0 +1,130 @@
+#include <benchmark/benchmark.h>
+#include <unordered_map>
+
+#include "nioev/lib/ExpiryIndex.hpp"
+#include "nioev/lib/StaticCodec.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+using Clock = ExpiryIndex::Clock;
+
+// MESSAGE_EXPIRY_INTERVALs spread over a day; every benchmark iteration is one second of simulated time and one sweep
+std::vector<uint32_t> expiryIntervals(size_t count) {
+    std::mt19937_64 random{SEED};
+    std::vector<uint32_t> ret(count);
+    for(auto& interval: ret) {
+        interval = std::uniform_int_distribution<uint32_t>{60, 86400}(random);
+    }
+    return ret;
+}
+
+void retainedCounts(benchmark::internal::Benchmark* b) {
+    b->Arg(100'000)->Arg(1'000'000);
+}
+
+// What a broker keeps per retained message, by id; the payload is only there to give the entries a realistic size.
+struct RetainedMessage {
+    Clock::time_point deadline;
+    uint32_t interval;
+    SharedBuffer payload;
+};
+
+std::unordered_map<uint64_t, RetainedMessage> retainedStore(const std::vector<uint32_t>& intervals, Clock::time_point now) {
+    std::unordered_map<uint64_t, RetainedMessage> ret;
+    ret.reserve(intervals.size());
+    for(size_t i = 0; i < intervals.size(); ++i) {
+        ret.emplace(i, RetainedMessage{now + std::chrono::seconds{intervals[i]}, intervals[i], {}});
+    }
+    return ret;
+}
+
+/* How retained messages are swept today: every sweep looks at every message. Expired messages are replaced by new ones
+ * with the same interval, so the number of messages stays the same.
+ */
+void BM_ExpiryFullScan(benchmark::State& state) {
+    auto intervals = expiryIntervals(state.range(0));
+    auto now = Clock::time_point{} + std::chrono::hours{1};
+    auto store = retainedStore(intervals, now);
+    size_t expired = 0;
+    for(auto _: state) {
+        now += std::chrono::seconds{1};
+        for(auto& [id, message]: store) {
+            if(message.deadline <= now) {
+                message.deadline = now + std::chrono::seconds{message.interval};
+                expired += 1;
+            }
+        }
+    }
+    state.counters["expiredPerSweep"] = double(expired) / state.iterations();
+}
+BENCHMARK(BM_ExpiryFullScan)->Apply(retainedCounts)->Unit(benchmark::kMicrosecond);
+
+// The same with the index, sweeping in batches of at most 1024 entries.
+void BM_ExpiryIndexBatch(benchmark::State& state) {
+    auto intervals = expiryIntervals(state.range(0));
+    auto now = Clock::time_point{} + std::chrono::hours{1};
+    auto store = retainedStore(intervals, now);
+    ExpiryIndex index;
+    for(auto& [id, message]: store) {
+        index.schedule(ExpiryKind::RETAINED_MESSAGE, id, message.deadline);
+    }
+    size_t expired = 0;
+    for(auto _: state) {
+        now += std::chrono::seconds{1};
+        while(index.expireDue(now, 1024, [&](ExpiryKind kind, uint64_t id) {
+            auto& message = store.find(id)->second;
+            message.deadline = now + std::chrono::seconds{message.interval};
+            index.schedule(kind, id, message.deadline);
+            expired += 1;
+        }) == 1024) {
+        }
+    }
+    state.counters["expiredPerSweep"] = double(expired) / state.iterations();
+}
+BENCHMARK(BM_ExpiryIndexBatch)->Apply(retainedCounts)->Unit(benchmark::kMicrosecond);
+
+SharedBuffer encodedPublish() {
+    TopicGenerator generator;
+    MQTTPacket packet{generator.topic(), generator.payload(256), QoS::QoS1, Retain::No, {}};
+    packet.properties.emplace(MQTTProperty::CONTENT_TYPE, std::string{"application/json"});
+    packet.properties.emplace(MQTTProperty::MESSAGE_EXPIRY_INTERVAL, uint32_t(300));
+    packet.properties.emplace(MQTTProperty::USER_PROPERTY, std::make_pair(std::string{"tenant"}, std::string{"tenant42"}));
+    BinaryEncoder encoder;
+    PacketCodec<MQTTVersion::V5, MQTTMessageType::PUBLISH>::encode(encoder, packet, 1);
+    return encoder.moveData();
+}
+
+// Delivering a stored packet with its remaining expiry: patched in place ...
+void BM_MessageExpiryRewrite(benchmark::State& state) {
+    auto packet = encodedPublish();
+    uint32_t remaining = 300;
+    for(auto _: state) {
+        auto copy = packet;
+        PacketCodec<MQTTVersion::V5, MQTTMessageType::PUBLISH>::rewriteMessageExpiry(copy.data(), copy.size(), --remaining);
+        benchmark::DoNotOptimize(copy);
+    }
+}
+BENCHMARK(BM_MessageExpiryRewrite);
+
+// ... or decoded, updated and encoded again.
+void BM_MessageExpiryReencode(benchmark::State& state) {
+    using Codec = PacketCodec<MQTTVersion::V5, MQTTMessageType::PUBLISH>;
+    auto packet = encodedPublish();
+    uint32_t remaining = 300;
+    for(auto _: state) {
+        uint32_t length;
+        auto lengthBytes = decodeVarByteInt(packet.data() + 1, packet.size() - 1, length);
+        auto decoded = Codec::toMQTTPacket(Codec::decode(packet.data() + 1 + lengthBytes, length, packet.data()[0] & 0x0F));
+        decoded.properties.find(MQTTProperty::MESSAGE_EXPIRY_INTERVAL)->second = --remaining;
+        BinaryEncoder encoder;
+        Codec::encode(encoder, decoded, 1);
+        benchmark::DoNotOptimize(encoder.moveData());
+    }
+}
+BENCHMARK(BM_MessageExpiryReencode);
+
+}
\ No newline at end of file
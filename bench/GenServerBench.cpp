@@ -0,0 +1,96 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+
+#include "nioev/lib/GenServer.hpp"
+#include "nioev/lib/Timers.hpp"
+
+using namespace nioev::lib;
+
+namespace {
+
+class CountingServer final : public GenServer<uint64_t> {
+public:
+    explicit CountingServer(bool idleStrategy)
+    : GenServer<uint64_t>("bench-count") {
+        if(idleStrategy)
+            enableIdleStrategy();
+        startThread();
+    }
+    ~CountingServer() override {
+        stopThread();
+    }
+    std::atomic<uint64_t> handled{0};
+
+protected:
+    void handleTask(uint64_t&&) override {
+        handled.fetch_add(1, std::memory_order_release);
+    }
+};
+
+// answers every task by setting the flag it points to
+class PingServer final : public GenServer<std::atomic<bool>*> {
+public:
+    explicit PingServer(bool idleStrategy)
+    : GenServer<std::atomic<bool>*>("bench-ping") {
+        if(idleStrategy)
+            enableIdleStrategy();
+        startThread();
+    }
+    ~PingServer() override {
+        stopThread();
+    }
+
+protected:
+    void handleTask(std::atomic<bool>*&& flag) override {
+        flag->store(true, std::memory_order_release);
+    }
+};
+
+constexpr uint64_t BATCH = 10000;
+
+// Arg 0: blocking on the condition variable, Arg 1: adaptive IdleStrategy
+void BM_GenServerThroughput(benchmark::State& state) {
+    CountingServer server{state.range(0) != 0};
+    uint64_t expected = 0;
+    for(auto _: state) {
+        for(uint64_t i = 0; i < BATCH; ++i) {
+            if(server.enqueue(uint64_t{i}) != GenServerEnqueueResult::Success)
+                state.SkipWithError("enqueue failed");
+        }
+        expected += BATCH;
+        while(server.handled.load(std::memory_order_acquire) < expected) {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+BENCHMARK(BM_GenServerThroughput)->Arg(0)->Arg(1)->UseRealTime();
+
+void BM_GenServerRoundTripLatency(benchmark::State& state) {
+    PingServer server{state.range(0) != 0};
+    std::atomic<bool> answered{false};
+    for(auto _: state) {
+        answered.store(false, std::memory_order_relaxed);
+        if(server.enqueue(&answered) != GenServerEnqueueResult::Success)
+            state.SkipWithError("enqueue failed");
+        while(!answered.load(std::memory_order_acquire)) {
+        }
+    }
+}
+BENCHMARK(BM_GenServerRoundTripLatency)->Arg(0)->Arg(1)->UseRealTime();
+
+void BM_TimersOneShotLatency(benchmark::State& state) {
+    Timers timers;
+    std::atomic<bool> fired{false};
+    for(auto _: state) {
+        fired.store(false, std::memory_order_relaxed);
+        timers.addOneShotTask(std::chrono::steady_clock::duration::zero(), [&fired] {
+            fired.store(true, std::memory_order_release);
+        });
+        while(!fired.load(std::memory_order_acquire)) {
+        }
+    }
+}
+BENCHMARK(BM_TimersOneShotLatency)->UseRealTime();
+
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include <benchmark/benchmark.h>
+
+#include "nioev/lib/Memory.hpp"
+#include "nioev/lib/StaticCodec.hpp"
+#include "nioev/lib/SubscriptionTree.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+using Codec = PacketCodec<MQTTVersion::V5, MQTTMessageType::PUBLISH>;
+
+// Encoded PUBLISH packets with the properties request/response style clients send, so decoding has to allocate.
+struct Frames {
+    std::vector<std::vector<uint8_t>> frames;
+    SubscriptionTree<uint64_t> tree;
+
+    Frames() {
+        TopicGenerator generator;
+        for(size_t i = 0; i < 256; ++i) {
+            auto payload = generator.telemetry();
+            MQTTPacket packet{generator.topic(), std::vector<uint8_t>(payload.begin(), payload.end()), QoS::QoS1, Retain::No, {}};
+            packet.properties.emplace(MQTTProperty::MESSAGE_EXPIRY_INTERVAL, uint32_t(300));
+            packet.properties.emplace(MQTTProperty::CONTENT_TYPE, std::string{"application/json"});
+            packet.properties.emplace(MQTTProperty::RESPONSE_TOPIC, "responses/" + generator.topic());
+            packet.properties.emplace(MQTTProperty::CORRELATION_DATA, std::vector<uint8_t>(16, uint8_t(i)));
+            packet.properties.emplace(MQTTProperty::USER_PROPERTY, std::make_pair(std::string{"trace-id"}, std::to_string(i * 7919)));
+            BinaryEncoder encoder;
+            Codec::encode(encoder, packet, 1);
+            auto data = encoder.moveData();
+            frames.emplace_back(data.data(), data.data() + data.size());
+        }
+        auto filters = generator.filters(10000);
+        for(size_t i = 0; i < filters.size(); ++i) {
+            tree.addSubscription(filters[i], i);
+        }
+    }
+};
+
+// Arg 0 measures decode and encode only, Arg 1 includes routing through a tree of 10k filters.
+const Frames& frames() {
+    static Frames ret;
+    return ret;
+}
+
+// decode -> route -> encode, with everything that belongs to the packet allocated through alloc; no tree skips routing
+template<template<typename> class Alloc>
+size_t handlePacket(const std::vector<uint8_t>& frame, const SubscriptionTree<uint64_t>* tree, const Alloc<char>& alloc) {
+    uint32_t remainingLength;
+    auto lengthBytes = decodeVarByteInt(frame.data() + 1, frame.size() - 1, remainingLength);
+    auto decoded = Codec::decode(frame.data() + 1 + lengthBytes, remainingLength, frame[0] & 0x0F);
+    auto packet = Codec::toMQTTPacket<Alloc>(decoded, alloc);
+    std::vector<uint64_t, Alloc<uint64_t>> subscribers{alloc};
+    if(tree) {
+        tree->forEveryMatch(packet.topic, [&](uint64_t& subscriber) {
+            subscribers.push_back(subscriber);
+        });
+    }
+    BinaryEncoder encoder;
+    Codec::encode(encoder, packet, 2);
+    benchmark::DoNotOptimize(encoder);
+    return subscribers.size();
+}
+
+void BM_PacketLifetimeStdAllocator(benchmark::State& state) {
+    auto& prepared = frames();
+    auto tree = state.range(0) ? &prepared.tree : nullptr;
+    size_t i = 0;
+    for(auto _: state) {
+        benchmark::DoNotOptimize(handlePacket<std::allocator>(prepared.frames[i++ % prepared.frames.size()], tree, {}));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PacketLifetimeStdAllocator)->Arg(0)->Arg(1);
+
+// the same through the polymorphic allocator, straight on the heap, to count how often that is
+void BM_PacketLifetimeHeap(benchmark::State& state) {
+    auto& prepared = frames();
+    auto tree = state.range(0) ? &prepared.tree : nullptr;
+    CountingResource heap;
+    size_t i = 0;
+    for(auto _: state) {
+        benchmark::DoNotOptimize(handlePacket<std::pmr::polymorphic_allocator>(prepared.frames[i++ % prepared.frames.size()], tree, &heap));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["heapAllocsPerPacket"] = double(heap.getStats().allocations) / state.iterations();
+}
+BENCHMARK(BM_PacketLifetimeHeap)->Arg(0)->Arg(1);
+
+void BM_PacketLifetimeThreadPool(benchmark::State& state) {
+    auto& prepared = frames();
+    auto tree = state.range(0) ? &prepared.tree : nullptr;
+    auto poolBefore = threadPoolStats();
+    auto heapBefore = heapResource().getStats();
+    size_t i = 0;
+    for(auto _: state) {
+        benchmark::DoNotOptimize(handlePacket<std::pmr::polymorphic_allocator>(prepared.frames[i++ % prepared.frames.size()], tree, threadPoolResource()));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["poolAllocsPerPacket"] = double(threadPoolStats().allocations - poolBefore.allocations) / state.iterations();
+    state.counters["heapAllocsPerPacket"] = double(heapResource().getStats().allocations - heapBefore.allocations) / state.iterations();
+}
+BENCHMARK(BM_PacketLifetimeThreadPool)->Arg(0)->Arg(1);
+
+void BM_PacketLifetimeArena(benchmark::State& state) {
+    auto& prepared = frames();
+    auto tree = state.range(0) ? &prepared.tree : nullptr;
+    PacketArena<> arena;
+    auto heapBefore = heapResource().getStats();
+    size_t i = 0;
+    for(auto _: state) {
+        benchmark::DoNotOptimize(handlePacket<std::pmr::polymorphic_allocator>(prepared.frames[i++ % prepared.frames.size()], tree, arena.allocator()));
+        arena.reset();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["arenaAllocsPerPacket"] = double(arena.getStats().allocations) / state.iterations();
+    state.counters["heapAllocsPerPacket"] = double(heapResource().getStats().allocations - heapBefore.allocations) / state.iterations();
+}
+BENCHMARK(BM_PacketLifetimeArena)->Arg(0)->Arg(1);
+
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+
+#include "nioev/lib/PersistenceLog.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+// NIOEV_BENCH_DIR should point to a real disk, on tmpfs syncing is free and the durable numbers mean nothing.
+std::string benchDirectory(const char* name) {
+    std::string base = getenv("NIOEV_BENCH_DIR") ? getenv("NIOEV_BENCH_DIR") : std::filesystem::temp_directory_path().string();
+    auto dir = base + "/nioev-bench-" + name;
+    std::filesystem::remove_all(dir);
+    return dir;
+}
+
+// Every thread appends a subscription and waits until it is durable, so with more threads one sync covers more appends.
+void BM_PersistAppendDurable(benchmark::State& state) {
+    static std::unique_ptr<PersistenceLog> log;
+    static std::vector<std::string> filters;
+    if(state.thread_index() == 0) {
+        log = std::make_unique<PersistenceLog>(PersistenceLog::Config{benchDirectory("append")});
+        filters = TopicGenerator{}.filters(10000);
+    }
+    auto clientId = "client" + std::to_string(state.thread_index());
+    size_t i = 0;
+    for(auto _: state) {
+        log->waitDurable(log->appendSubscribe(clientId, filters[i++ % filters.size()], QoS::QoS1));
+    }
+    if(state.thread_index() == 0) {
+        auto stats = log->getStats();
+        state.counters["appends_per_sync"] = double(stats.appendedRecords) / std::max<uint64_t>(stats.syncs, 1);
+        log.reset();
+    }
+}
+BENCHMARK(BM_PersistAppendDurable)->ThreadRange(1, 16)->UseRealTime();
+
+void BM_PersistAppend(benchmark::State& state) {
+    PersistenceLog log{PersistenceLog::Config{benchDirectory("append-async")}};
+    auto filters = TopicGenerator{}.filters(10000);
+    size_t i = 0;
+    for(auto _: state) {
+        benchmark::DoNotOptimize(log.appendSubscribe("client", filters[i++ % filters.size()], QoS::QoS1));
+    }
+}
+BENCHMARK(BM_PersistAppend);
+
+// state.range(0) subscriptions of 10 per client, written once and then recovered into a fresh tree per iteration
+std::string writeSubscriptions(int64_t count) {
+    auto dir = benchDirectory(("recover-" + std::to_string(count)).c_str());
+    PersistenceLog log{PersistenceLog::Config{dir}};
+    TopicGenerator generator;
+    for(int64_t i = 0; i < count; ++i) {
+        log.appendSubscribe("client" + std::to_string(i / 10), generator.filter(), QoS::QoS1);
+    }
+    return dir;
+}
+
+// Opening the log and rebuilding the tree straight from the mapped records, with the client ids as views into them.
+void BM_PersistRecoverSubscriptions(benchmark::State& state) {
+    auto dir = writeSubscriptions(state.range(0));
+    for(auto _: state) {
+        PersistenceLog log{PersistenceLog::Config{dir, 64 * 1024 * 1024, std::chrono::microseconds{1000}, 0}};
+        SubscriptionTree<std::string_view> tree;
+        log.recoverSubscriptions(tree, [](const PersistRecord& record) { return record.clientId; });
+        benchmark::DoNotOptimize(tree);
+        state.PauseTiming();
+        {
+            // destroying the tree isn't part of the recovery
+            auto discard = std::move(tree);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PersistRecoverSubscriptions)->Arg(100000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+// The same, but parsing every record into owned strings first and storing those in the tree, like a regular loader.
+void BM_PersistRecoverCopying(benchmark::State& state) {
+    struct Subscription {
+        std::string clientId;
+        std::string filter;
+        QoS qos;
+    };
+    auto dir = writeSubscriptions(state.range(0));
+    for(auto _: state) {
+        PersistenceLog log{PersistenceLog::Config{dir, 64 * 1024 * 1024, std::chrono::microseconds{1000}, 0}};
+        std::vector<Subscription> subscriptions;
+        (void)log.replay([&](const PersistRecord& record) { subscriptions.push_back({std::string{record.clientId}, std::string{record.topic}, record.qos}); });
+        SubscriptionTree<std::string> tree;
+        for(auto& subscription: subscriptions) {
+            tree.addSubscription(subscription.filter, subscription.clientId);
+        }
+        benchmark::DoNotOptimize(tree);
+        state.PauseTiming();
+        {
+            auto discard = std::move(tree);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PersistRecoverCopying)->Arg(100000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+}
\ No newline at end of file
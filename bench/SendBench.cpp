@@ -0,0 +1,116 @@
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "nioev/lib/BatchedSender.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+// encoded packets per client and round, about what a worker has for a client after routing a busy topic
+constexpr size_t PACKETS_PER_CLIENT = 16;
+constexpr size_t PACKET_SIZE = 128;
+
+// Non-blocking socketpairs standing in for client connections; the benchmarks write to the first end of each and read
+// everything back from the second one every round, so the socket buffers never fill up.
+struct Clients {
+    explicit Clients(size_t count) {
+        for(size_t i = 0; i < count; ++i) {
+            int fds[2];
+            if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+                throwErrno("socketpair");
+            }
+            fcntl(fds[0], F_SETFL, O_NONBLOCK);
+            fcntl(fds[1], F_SETFL, O_NONBLOCK);
+            send.push_back(fds[0]);
+            receive.push_back(fds[1]);
+        }
+        TopicGenerator generator;
+        for(size_t i = 0; i < PACKETS_PER_CLIENT; ++i) {
+            auto bytes = generator.payload(PACKET_SIZE);
+            packets.emplace_back();
+            packets.back().append(bytes.data(), bytes.size());
+        }
+    }
+    ~Clients() {
+        for(auto fd: send)
+            close(fd);
+        for(auto fd: receive)
+            close(fd);
+    }
+    void drain() {
+        uint8_t buffer[64 * 1024];
+        for(auto fd: receive) {
+            while(read(fd, buffer, sizeof(buffer)) > 0) {
+            }
+        }
+    }
+    std::vector<int> send;
+    std::vector<int> receive;
+    std::vector<SharedBuffer> packets;
+};
+
+void clientCounts(benchmark::internal::Benchmark* b) {
+    b->Arg(1)->Arg(16)->Arg(256);
+}
+
+// one send() per packet per client, what most deployments do today
+void BM_SendPlain(benchmark::State& state) {
+    Clients clients(state.range(0));
+    for(auto _: state) {
+        for(auto fd: clients.send) {
+            for(auto& packet: clients.packets) {
+                ::send(fd, packet.data(), packet.size(), MSG_NOSIGNAL);
+            }
+        }
+        clients.drain();
+    }
+    state.SetItemsProcessed(state.iterations() * clients.send.size() * clients.packets.size());
+    state.counters["sendSyscallsPerRound"] = clients.send.size() * clients.packets.size();
+}
+BENCHMARK(BM_SendPlain)->Apply(clientCounts);
+
+void sendBatched(benchmark::State& state, SendBackend backend) {
+    Clients clients(state.range(0));
+    BatchedSender::Config config;
+    config.backend = backend;
+    BatchedSender sender{config};
+    if(sender.getBackend() != backend) {
+        state.SkipWithError("io_uring not available");
+        return;
+    }
+    for(auto fd: clients.send) {
+        sender.addSocket(fd);
+    }
+    for(auto _: state) {
+        for(auto fd: clients.send) {
+            for(auto& packet: clients.packets) {
+                sender.enqueue(fd, packet);
+            }
+        }
+        sender.flush();
+        // io_uring completes asynchronously, wait for it so every round measures the whole write
+        while(sender.poll(std::chrono::milliseconds{0}) > 0) {
+        }
+        clients.drain();
+    }
+    state.SetItemsProcessed(state.iterations() * clients.send.size() * clients.packets.size());
+    state.counters["sendSyscallsPerRound"] = double(sender.getStats().syscalls) / state.iterations();
+}
+
+void BM_SendBatchedEpoll(benchmark::State& state) {
+    sendBatched(state, SendBackend::EPOLL);
+}
+BENCHMARK(BM_SendBatchedEpoll)->Apply(clientCounts);
+
+void BM_SendBatchedIoUring(benchmark::State& state) {
+    sendBatched(state, SendBackend::IO_URING);
+}
+BENCHMARK(BM_SendBatchedIoUring)->Apply(clientCounts);
+
+}
\ No newline at end of file
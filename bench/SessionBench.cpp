@@ -0,0 +1,93 @@
+#include <benchmark/benchmark.h>
+
+#include <set>
+
+#include "nioev/lib/InflightWindow.hpp"
+#include "nioev/lib/PacketIdAllocator.hpp"
+#include "nioev/lib/Util.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+// Keeps state.range(0) ids allocated and releases the oldest for every new one, like a session with that many messages
+// in flight. The std::set variant is how free ids used to be found: scanning for a gap.
+void BM_PacketIdSetScan(benchmark::State& state) {
+    std::set<uint16_t> used;
+    std::vector<uint16_t> order;
+    uint16_t cursor = 1;
+    auto allocate = [&] {
+        while(used.count(cursor) || cursor == 0) {
+            cursor += 1;
+        }
+        used.insert(cursor);
+        return cursor++;
+    };
+    for(int64_t i = 0; i < state.range(0); ++i) {
+        order.push_back(allocate());
+    }
+    size_t oldest = 0;
+    for(auto _: state) {
+        used.erase(order[oldest]);
+        order[oldest] = allocate();
+        oldest = (oldest + 1) % order.size();
+    }
+}
+BENCHMARK(BM_PacketIdSetScan)->Arg(100)->Arg(10000)->Arg(60000);
+
+void BM_PacketIdAllocator(benchmark::State& state) {
+    PacketIdAllocator allocator;
+    std::vector<uint16_t> order;
+    for(int64_t i = 0; i < state.range(0); ++i) {
+        order.push_back(*allocator.allocate());
+    }
+    size_t oldest = 0;
+    for(auto _: state) {
+        allocator.release(order[oldest]);
+        order[oldest] = *allocator.allocate();
+        oldest = (oldest + 1) % order.size();
+    }
+}
+BENCHMARK(BM_PacketIdAllocator)->Arg(100)->Arg(10000)->Arg(60000);
+
+// Send and acknowledge QoS 1 messages with state.range(0) outstanding, acks arriving in random order.
+void BM_InflightWindowSendAck(benchmark::State& state) {
+    using Clock = InflightWindow<SharedBuffer>::Clock;
+    InflightWindow<SharedBuffer> window{UINT16_MAX, std::chrono::seconds(10)};
+    std::mt19937_64 random{SEED};
+    std::vector<uint16_t> outstanding;
+    auto now = Clock::now();
+    SharedBuffer packet;
+    packet.append("packet", 6);
+    for(int64_t i = 0; i < state.range(0); ++i) {
+        outstanding.push_back(*window.send(QoS::QoS1, packet, now));
+    }
+    for(auto _: state) {
+        auto& id = outstanding[random() % outstanding.size()];
+        benchmark::DoNotOptimize(window.onPubAck(id));
+        id = *window.send(QoS::QoS1, packet, now);
+    }
+}
+BENCHMARK(BM_InflightWindowSendAck)->Arg(100)->Arg(10000)->Arg(60000);
+
+// Finding the expired ones among state.range(0) outstanding messages when 1% of them expire per call.
+void BM_InflightWindowRetransmit(benchmark::State& state) {
+    using Clock = InflightWindow<SharedBuffer>::Clock;
+    InflightWindow<SharedBuffer> window{UINT16_MAX, std::chrono::milliseconds(state.range(0))};
+    auto now = Clock::now();
+    for(int64_t i = 0; i < state.range(0); ++i) {
+        window.send(QoS::QoS1, SharedBuffer{}, now + std::chrono::milliseconds(i));
+    }
+    now += std::chrono::milliseconds(state.range(0));
+    size_t resent = 0;
+    for(auto _: state) {
+        now += std::chrono::milliseconds(state.range(0) / 100);
+        resent += window.retransmitExpired(now, [](uint16_t, InflightState, const SharedBuffer&, uint) {});
+    }
+    state.counters["resent_per_call"] = double(resent) / state.iterations();
+}
+BENCHMARK(BM_InflightWindowRetransmit)->Arg(10000)->Arg(60000);
+
+}
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+
+#include "nioev/lib/SubscriptionTree.hpp"
+#include "Workload.hpp"
+
+using namespace nioev::lib;
+using namespace nioev::bench;
+
+namespace {
+
+struct PreparedTree {
+    std::vector<std::string> filters;
+    SubscriptionTree<uint64_t> tree;
+};
+
+// building the big trees takes longer than measuring them, so they are built once per size and shared
+PreparedTree& preparedTree(size_t filterCount) {
+    static std::map<size_t, std::unique_ptr<PreparedTree>> trees;
+    auto& prepared = trees[filterCount];
+    if(!prepared) {
+        prepared = std::make_unique<PreparedTree>();
+        prepared->filters = TopicGenerator{}.filters(filterCount);
+        for(size_t i = 0; i < prepared->filters.size(); ++i) {
+            prepared->tree.addSubscription(prepared->filters[i], i);
+        }
+    }
+    return *prepared;
+}
+
+void filterCounts(benchmark::internal::Benchmark* b) {
+    for(int64_t count = 10'000; count <= maxFilters(); count *= 10) {
+        b->Arg(count);
+    }
+}
+
+void BM_SubscriptionTreeAdd(benchmark::State& state) {
+    auto filters = TopicGenerator{}.filters(state.range(0));
+    for(auto _: state) {
+        SubscriptionTree<uint64_t> tree;
+        for(size_t i = 0; i < filters.size(); ++i) {
+            tree.addSubscription(filters[i], i);
+        }
+        benchmark::DoNotOptimize(tree);
+        state.PauseTiming();
+        // don't measure the destruction of the tree
+        { auto destroy = std::move(tree); }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * filters.size());
+}
+BENCHMARK(BM_SubscriptionTreeAdd)->Apply(filterCounts)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_SubscriptionTreeMatch(benchmark::State& state) {
+    auto& prepared = preparedTree(state.range(0));
+    auto topics = TopicGenerator{SEED + 1}.topics(4096);
+    size_t index = 0;
+    uint64_t matches = 0;
+    for(auto _: state) {
+        prepared.tree.forEveryMatch(topics[index++ % topics.size()], [&](uint64_t&) {
+            matches += 1;
+        });
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["matchesPerPublish"] = benchmark::Counter(matches, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_SubscriptionTreeMatch)->Apply(filterCounts);
+
+// same as BM_SubscriptionTreeMatch with the default sampling rate, the difference is the cost of the accounting
+void BM_SubscriptionTreeMatchSampled(benchmark::State& state) {
+    auto& prepared = preparedTree(state.range(0));
+    auto topics = TopicGenerator{SEED + 1}.topics(4096);
+    MatchCostSampler sampler;
+    prepared.tree.setMatchCostSampler(&sampler);
+    size_t index = 0;
+    uint64_t matches = 0;
+    for(auto _: state) {
+        prepared.tree.forEveryMatch(topics[index++ % topics.size()], [&](uint64_t&) {
+            matches += 1;
+        });
+    }
+    prepared.tree.setMatchCostSampler(nullptr);
+    uint64_t sampled = 0;
+    for(auto& cost: sampler.snapshot()) {
+        sampled += cost.sampledMatches;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["sampledMatches"] = sampled;
+}
+BENCHMARK(BM_SubscriptionTreeMatchSampled)->Apply(filterCounts);
+
+void BM_SubscriptionTreeRemove(benchmark::State& state) {
+    auto filters = TopicGenerator{}.filters(state.range(0));
+    for(auto _: state) {
+        state.PauseTiming();
+        SubscriptionTree<uint64_t> tree;
+        for(size_t i = 0; i < filters.size(); ++i) {
+            tree.addSubscription(filters[i], i);
+        }
+        state.ResumeTiming();
+        for(size_t i = 0; i < filters.size(); ++i) {
+            tree.removeSubscription(filters[i], i);
+        }
+        benchmark::DoNotOptimize(tree);
+    }
+    state.SetItemsProcessed(state.iterations() * filters.size());
+}
+BENCHMARK(BM_SubscriptionTreeRemove)->Apply(filterCounts)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+// Same filters as BM_SubscriptionTreeAdd, but sorted (outside of the measurement) and added as one batch.
+void BM_SubscriptionTreeBulkAdd(benchmark::State& state) {
+    std::vector<std::pair<std::string, uint64_t>> subscriptions;
+    auto filters = TopicGenerator{}.filters(state.range(0));
+    for(size_t i = 0; i < filters.size(); ++i) {
+        subscriptions.emplace_back(std::move(filters[i]), i);
+    }
+    std::sort(subscriptions.begin(), subscriptions.end());
+    for(auto _: state) {
+        SubscriptionTree<uint64_t> tree;
+        tree.bulkAdd(subscriptions);
+        benchmark::DoNotOptimize(tree);
+        state.PauseTiming();
+        { auto destroy = std::move(tree); }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * subscriptions.size());
+}
+BENCHMARK(BM_SubscriptionTreeBulkAdd)->Apply(filterCounts)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void encodeSubscriberId(BinaryEncoder& out, const uint64_t& id) {
+    auto encoded = encodeVarByteInt(id);
+    out.encodeBytes(encoded.value, encoded.valueLength);
+}
+
+uint64_t decodeSubscriberId(ByteReader& reader) {
+    return reader.varByteInt();
+}
+
+void BM_SubscriptionTreeSerialize(benchmark::State& state) {
+    auto& prepared = preparedTree(state.range(0));
+    size_t size = 0;
+    for(auto _: state) {
+        BinaryEncoder encoder;
+        prepared.tree.serialize(encoder, encodeSubscriberId);
+        size = encoder.size();
+        benchmark::DoNotOptimize(encoder);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["bytesPerFilter"] = double(size) / state.range(0);
+}
+BENCHMARK(BM_SubscriptionTreeSerialize)->Apply(filterCounts)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_SubscriptionTreeDeserialize(benchmark::State& state) {
+    auto& prepared = preparedTree(state.range(0));
+    BinaryEncoder encoder;
+    prepared.tree.serialize(encoder, encodeSubscriberId);
+    auto image = encoder.moveData();
+    for(auto _: state) {
+        SubscriptionTree<uint64_t> tree;
+        tree.deserialize(image.data(), image.size(), decodeSubscriberId);
+        benchmark::DoNotOptimize(tree);
+        state.PauseTiming();
+        { auto destroy = std::move(tree); }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SubscriptionTreeDeserialize)->Apply(filterCounts)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_SubscriptionTreeStats(benchmark::State& state) {
+    auto& prepared = preparedTree(state.range(0));
+    SubscriptionTreeStats stats;
+    for(auto _: state) {
+        stats = prepared.tree.collectStats();
+        benchmark::DoNotOptimize(stats);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["nodes"] = stats.nodes;
+    state.counters["bytesPerFilter"] = double(stats.estimatedBytes) / state.range(0);
+}
+BENCHMARK(BM_SubscriptionTreeStats)->Apply(filterCounts)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// the longest a single per prefix collection holds the tree, i.e. the largest pause for writers
+void BM_SubscriptionTreeStatsPerPrefix(benchmark::State& state) {
+    auto& prepared = preparedTree(state.range(0));
+    auto prefixes = prepared.tree.topLevelPrefixes();
+    size_t index = 0;
+    for(auto _: state) {
+        auto stats = prepared.tree.collectStats(prefixes[index++ % prefixes.size()]);
+        benchmark::DoNotOptimize(stats);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SubscriptionTreeStatsPerPrefix)->Apply(filterCounts)->Unit(benchmark::kMicrosecond);
+
+}
\ No newline at end of file
@@ -0,0 +1,224 @@
+/* Replays a workload trace through the same building blocks a broker uses: every event is encoded like it would
+ * arrive from the network, handed to a GenServer which decodes it, updates or matches a SubscriptionTree and encodes
+ * one outgoing PUBLISH per matching subscriber. Reports throughput and per event type latency percentiles as JSON.
+ * With --paced they're from enqueueing the event until the router is done with it, including queueing behind earlier
+ * events. At full speed the whole trace is enqueued up front, so that would mostly measure the backlog; there they're
+ * the time the router spends on the event ("latency":"service" instead of "enqueueToDone").
+ *
+ *     nioev_replay --generate 1000000 [--write trace.bin]     synthetic workload, optionally saved
+ *     nioev_replay --trace trace.bin [--paced [speed]]        recorded trace, as fast as possible or at recorded pacing
+ */
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "nioev/lib/GenServer.hpp"
+#include "nioev/lib/LatencyHistogram.hpp"
+#include "nioev/lib/SubscriptionTree.hpp"
+#include "nioev/lib/WorkloadTrace.hpp"
+
+using namespace nioev::lib;
+
+namespace {
+
+struct ReplayTask {
+    TraceEventType type;
+    uint32_t clientId;
+    QoS qos;
+    std::vector<uint8_t> body;
+    std::chrono::steady_clock::time_point enqueuedAt;
+};
+
+class Router final : public GenServer<ReplayTask> {
+public:
+    explicit Router(bool fromEnqueue)
+    : GenServer<ReplayTask>("replay-router"), mFromEnqueue(fromEnqueue) {
+        startThread();
+    }
+    ~Router() override {
+        stopThread();
+    }
+    std::atomic<uint64_t> handled{0};
+    // only touched by the worker thread until handled reached the event count
+    uint64_t deliveries{0};
+    uint64_t deliveredBytes{0};
+    std::array<LatencyHistogram, 5> latencies;
+
+protected:
+    void handleTask(ReplayTask&& task) override {
+        auto measuredFrom = mFromEnqueue ? task.enqueuedAt : std::chrono::steady_clock::now();
+        BinaryDecoder decoder{task.body, static_cast<uint>(task.body.size())};
+        switch(task.type) {
+        case TraceEventType::SUBSCRIBE: {
+            decoder.decode2Bytes();
+            auto filter = decoder.decodeString();
+            decoder.decodeByte();
+            mTree.addSubscription(filter, task.clientId);
+            break;
+        }
+        case TraceEventType::UNSUBSCRIBE: {
+            decoder.decode2Bytes();
+            mTree.removeSubscription(decoder.decodeString(), task.clientId);
+            break;
+        }
+        case TraceEventType::PUBLISH: {
+            auto topic = decoder.decodeString();
+            if(task.qos != QoS::QoS0) {
+                decoder.decode2Bytes();
+            }
+            auto payload = decoder.getRemainingBytes();
+            mTree.forEveryMatch(topic, [&](uint32_t&) {
+                BinaryEncoder encoder;
+                encoder.encodeString(topic);
+                if(task.qos != QoS::QoS0) {
+                    encoder.encode2Bytes(1);
+                }
+                encoder.encodeBytes(payload.data(), payload.size());
+                deliveries += 1;
+                deliveredBytes += encoder.size();
+            });
+            break;
+        }
+        case TraceEventType::DISCONNECT:
+            mTree.removeAllSubscriptions(task.clientId);
+            break;
+        }
+        auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - measuredFrom).count();
+        latencies[static_cast<int>(task.type)].record(latency);
+        handled.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    const bool mFromEnqueue;
+    SubscriptionTree<uint32_t> mTree;
+};
+
+std::vector<uint8_t> encodeEvent(const TraceEvent& event, const std::vector<uint8_t>& payload) {
+    BinaryEncoder encoder;
+    switch(event.type) {
+    case TraceEventType::SUBSCRIBE:
+        encoder.encode2Bytes(1);
+        encoder.encodeString(event.topic);
+        encoder.encodeByte(static_cast<uint8_t>(event.qos));
+        break;
+    case TraceEventType::UNSUBSCRIBE:
+        encoder.encode2Bytes(1);
+        encoder.encodeString(event.topic);
+        break;
+    case TraceEventType::PUBLISH:
+        encoder.encodeString(event.topic);
+        if(event.qos != QoS::QoS0) {
+            encoder.encode2Bytes(1);
+        }
+        encoder.encodeBytes(payload.data(), std::min<size_t>(event.payloadSize, payload.size()));
+        break;
+    case TraceEventType::DISCONNECT:
+        break;
+    }
+    auto data = encoder.moveData();
+    return std::vector<uint8_t>(data.data(), data.data() + data.size());
+}
+
+const char* eventTypeName(int type) {
+    switch(static_cast<TraceEventType>(type)) {
+    case TraceEventType::SUBSCRIBE:
+        return "subscribe";
+    case TraceEventType::UNSUBSCRIBE:
+        return "unsubscribe";
+    case TraceEventType::PUBLISH:
+        return "publish";
+    case TraceEventType::DISCONNECT:
+        return "disconnect";
+    }
+    return "unknown";
+}
+
+int usage() {
+    fprintf(stderr, "usage: nioev_replay (--trace FILE | --generate EVENTS [--write FILE]) [--paced [SPEED]]\n");
+    return 1;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string tracePath, writePath;
+    size_t generateEvents = 0;
+    bool paced = false;
+    double speed = 1.0;
+    for(int i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if(!strcmp(argv[i], "--generate") && i + 1 < argc) {
+            generateEvents = std::strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(argv[i], "--write") && i + 1 < argc) {
+            writePath = argv[++i];
+        } else if(!strcmp(argv[i], "--paced")) {
+            paced = true;
+            if(i + 1 < argc && argv[i + 1][0] != '-') {
+                speed = std::strtod(argv[++i], nullptr);
+            }
+        } else {
+            return usage();
+        }
+    }
+    if(tracePath.empty() == (generateEvents == 0) || speed <= 0) {
+        return usage();
+    }
+
+    std::vector<TraceEvent> events;
+    try {
+        if(!tracePath.empty()) {
+            events = TraceReader{tracePath}.readAll();
+        } else {
+            events = WorkloadGenerator{{}}.generate(generateEvents);
+            if(!writePath.empty()) {
+                TraceWriter writer{writePath};
+                for(auto& event: events) {
+                    writer.record(event);
+                }
+            }
+        }
+    } catch(std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    uint32_t maxPayload = 0;
+    for(auto& event: events) {
+        maxPayload = std::max(maxPayload, event.payloadSize);
+    }
+    std::vector<uint8_t> payload(maxPayload, 'x');
+
+    Router router{paced};
+    auto start = std::chrono::steady_clock::now();
+    for(auto& event: events) {
+        if(paced) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(static_cast<uint64_t>(event.timestamp / speed)));
+        }
+        ReplayTask task{event.type, event.clientId, event.qos, encodeEvent(event, payload), std::chrono::steady_clock::now()};
+        if(router.enqueue(std::move(task)) != GenServerEnqueueResult::Success) {
+            fprintf(stderr, "Failed to enqueue event\n");
+            return 1;
+        }
+    }
+    while(router.handled.load(std::memory_order_acquire) < events.size()) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("{\"events\":%zu,\"seconds\":%.3f,\"eventsPerSecond\":%.0f,\"deliveries\":%lu,\"deliveriesPerSecond\":%.0f,\"deliveredBytes\":%lu,\"latency\":\"%s\",\"latencyNs\":{",
+        events.size(), seconds, events.size() / seconds, router.deliveries, router.deliveries / seconds, router.deliveredBytes, paced ? "enqueueToDone" : "service");
+    bool first = true;
+    for(int type = 1; type < static_cast<int>(router.latencies.size()); ++type) {
+        auto h = router.latencies[type].snapshot();
+        if(h.count == 0)
+            continue;
+        printf("%s\"%s\":{\"count\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}", first ? "" : ",", eventTypeName(type), h.count,
+            h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.percentile(0.999), h.max);
+        first = false;
+    }
+    printf("}}\n");
+    return 0;
+}
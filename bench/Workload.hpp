@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace nioev::bench {
+
+// Every benchmark seeds its generators with this, so two runs (or two commits) measure exactly the same inputs.
+constexpr uint64_t SEED = 0x6E696F6576;
+
+// Upper bound for the filter count sweeps, NIOEV_BENCH_MAX_FILTERS=10000000 enables the 10M runs (needs several GiB).
+inline int64_t maxFilters() {
+    if(auto env = getenv("NIOEV_BENCH_MAX_FILTERS")) {
+        return std::strtoll(env, nullptr, 10);
+    }
+    return 1'000'000;
+}
+
+/* IoT style topic hierarchy: tenant/site/device/sensor. The level sizes are chosen so that any filter count up to
+ * 10M produces mostly distinct filters while the upper levels are still shared a lot, like in a real deployment.
+ */
+class TopicGenerator {
+public:
+    explicit TopicGenerator(uint64_t seed = SEED)
+    : mRandom(seed) {
+
+    }
+    std::string topic() {
+        return "tenant" + std::to_string(pick(TENANTS)) + "/site" + std::to_string(pick(SITES)) + "/device" + std::to_string(pick(DEVICES)) + "/" + SENSORS[pick(std::size(SENSORS))];
+    }
+    /* 80% exact filters, 10% with a single level wildcard, 5% ending in a multi level wildcard and 5% that use both,
+     * which is roughly what we see from dashboards (wildcards) and devices (exact) combined.
+     */
+    std::string filter() {
+        auto kind = pick(100);
+        auto tenant = "tenant" + std::to_string(pick(TENANTS));
+        auto site = "site" + std::to_string(pick(SITES));
+        auto device = "device" + std::to_string(pick(DEVICES));
+        std::string sensor = SENSORS[pick(std::size(SENSORS))];
+        if(kind < 80)
+            return tenant + "/" + site + "/" + device + "/" + sensor;
+        if(kind < 90)
+            return tenant + "/" + site + "/+/" + sensor;
+        if(kind < 95)
+            return tenant + "/" + site + "/#";
+        return tenant + "/+/" + device + "/#";
+    }
+    std::vector<std::string> filters(size_t count) {
+        std::vector<std::string> ret;
+        ret.reserve(count);
+        for(size_t i = 0; i < count; ++i) {
+            ret.emplace_back(filter());
+        }
+        return ret;
+    }
+    std::vector<std::string> topics(size_t count) {
+        std::vector<std::string> ret;
+        ret.reserve(count);
+        for(size_t i = 0; i < count; ++i) {
+            ret.emplace_back(topic());
+        }
+        return ret;
+    }
+    // small JSON telemetry message, the kind of payload that compresses badly on its own but well with a dictionary
+    std::string telemetry() {
+        return "{\"device\":\"device" + std::to_string(pick(DEVICES)) + "\",\"ts\":" + std::to_string(1700000000000 + pick(1000000000)) +
+            ",\"temperature\":" + std::to_string(pick(400) / 10.0) + ",\"humidity\":" + std::to_string(pick(1000) / 10.0) +
+            ",\"battery\":" + std::to_string(pick(100)) + ",\"status\":\"" + (pick(10) ? "ok" : "degraded") + "\",\"firmware\":\"2.4." +
+            std::to_string(pick(3)) + "\"}";
+    }
+    std::vector<uint8_t> payload(size_t size) {
+        std::vector<uint8_t> ret(size);
+        for(auto& b: ret) {
+            b = pick(256);
+        }
+        return ret;
+    }
+
+private:
+    static constexpr size_t TENANTS = 100;
+    static constexpr size_t SITES = 100;
+    static constexpr size_t DEVICES = 1000;
+    static constexpr const char* SENSORS[] = {"temperature", "humidity", "pressure", "battery", "status", "position", "co2", "voltage", "current", "rssi"};
+
+    size_t pick(size_t max) {
+        return std::uniform_int_distribution<size_t>{0, max - 1}(mRandom);
+    }
+    std::mt19937_64 mRandom;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+enum class LogLevel : uint8_t
+{
+    TRACE,
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR
+};
+
+static inline const char* logLevelToString(LogLevel level) {
+    switch(level) {
+    case LogLevel::TRACE:
+        return "trace";
+    case LogLevel::DEBUG:
+        return "debug";
+    case LogLevel::INFO:
+        return "info";
+    case LogLevel::WARN:
+        return "warning";
+    case LogLevel::ERROR:
+        return "error";
+    }
+    return "<unknown>";
+}
+
+/* A compact, not yet formatted log line: which format string to use plus the raw arguments. Records are fixed size so
+ * that a ring of them never has to deal with wrap-around; strings that don't fit into the argument area are truncated.
+ */
+struct alignas(64) LogRecord {
+    enum class ArgType : uint8_t
+    {
+        INT,
+        UINT,
+        DOUBLE,
+        BOOL,
+        STRING
+    };
+    static constexpr size_t ARGS_SIZE = 112;
+
+    uint64_t timestamp; // nanoseconds since the epoch
+    uint16_t formatId;
+    uint8_t argCount;
+    uint8_t argBytes;
+    uint8_t reserved[4];
+    uint8_t args[ARGS_SIZE];
+};
+static_assert(sizeof(LogRecord) == 128);
+
+/* Logger that keeps formatting and publishing off the hot path. Producer threads only copy a format id and the raw
+ * arguments into their own single-producer ring; a background thread drains all rings, formats the lines using the
+ * same layout as LOG_PATTERN, applies sampling and per-format rate limiting and hands the lines in batches to the
+ * publish callback, typically publishing them onto LOG_TOPIC. If a ring is full, the record is dropped and counted
+ * instead of blocking the producer.
+ *
+ * Use it through NIOEV_ASYNC_LOG, which registers the format string once per call site:
+ *
+ *     NIOEV_ASYNC_LOG(logger, LogLevel::DEBUG, "Routing {} to {} subscribers", topic, count);
+ */
+class AsyncLogger final {
+public:
+    static constexpr size_t MAX_FORMATS = 4096;
+
+    struct Config {
+        LogLevel minLevel = LogLevel::INFO;
+        // records per thread, rounded up to a power of two
+        size_t ringCapacity = 4096;
+        // only every n-th TRACE/DEBUG record is published, 1 publishes all of them
+        uint32_t debugSampleEvery = 1;
+        // per format string, 0 disables rate limiting
+        uint32_t maxRecordsPerSecondPerFormat = 1000;
+        size_t maxBatchLines = 256;
+        std::chrono::milliseconds maxBatchDelay{50};
+    };
+    struct Stats {
+        uint64_t droppedRingFull{0};
+        uint64_t droppedRateLimited{0};
+        uint64_t droppedSampling{0};
+        uint64_t publishedLines{0};
+        uint64_t publishedBatches{0};
+    };
+    using PublishCallback = std::function<void(const char* topic, SharedBuffer&& lines)>;
+
+    AsyncLogger(Config config, PublishCallback publish);
+    ~AsyncLogger();
+    AsyncLogger(const AsyncLogger&) = delete;
+    void operator=(const AsyncLogger&) = delete;
+
+    // Format strings use {} as placeholders and must outlive the process, i.e. be string literals.
+    static uint16_t registerFormat(const char* format, LogLevel level);
+
+    [[nodiscard]] bool isEnabled(LogLevel level) const {
+        return level >= mConfig.minLevel;
+    }
+    template<typename... Args>
+    void log(uint16_t formatId, const Args&... args) {
+        LogRecord record;
+        record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        record.formatId = formatId;
+        record.argCount = sizeof...(Args);
+        uint8_t* out = record.args;
+        [[maybe_unused]] uint8_t* end = record.args + LogRecord::ARGS_SIZE;
+        (encodeArg(out, end, args), ...);
+        record.argBytes = out - record.args;
+        push(record);
+    }
+    [[nodiscard]] Stats getStats() const;
+
+private:
+    struct Ring;
+    struct FormatInfo {
+        const char* format;
+        LogLevel level;
+    };
+    struct FormatState {
+        int64_t windowStart{0};
+        uint32_t inWindow{0};
+        uint64_t suppressed{0};
+        uint64_t sampleCounter{0};
+    };
+
+    template<typename T>
+    static void encodeArg(uint8_t*& out, uint8_t* end, const T& value) {
+        if constexpr(std::is_same_v<T, bool>) {
+            writeArg(out, end, LogRecord::ArgType::BOOL, &value, 1);
+        } else if constexpr(std::is_enum_v<T>) {
+            encodeArg(out, end, static_cast<std::underlying_type_t<T>>(value));
+        } else if constexpr(std::is_integral_v<T> && std::is_signed_v<T>) {
+            int64_t v = value;
+            writeArg(out, end, LogRecord::ArgType::INT, &v, 8);
+        } else if constexpr(std::is_integral_v<T>) {
+            uint64_t v = value;
+            writeArg(out, end, LogRecord::ArgType::UINT, &v, 8);
+        } else if constexpr(std::is_floating_point_v<T>) {
+            double v = value;
+            writeArg(out, end, LogRecord::ArgType::DOUBLE, &v, 8);
+        } else {
+            static_assert(std::is_convertible_v<const T&, std::string_view>, "Unsupported log argument type");
+            std::string_view str{value};
+            writeString(out, end, str);
+        }
+    }
+    static void writeArg(uint8_t*& out, uint8_t* end, LogRecord::ArgType type, const void* data, size_t len);
+    static void writeString(uint8_t*& out, uint8_t* end, std::string_view str);
+
+    void push(const LogRecord& record);
+    Ring& registerThread();
+    void consumerThreadFunc();
+    bool drain(std::string& batch, size_t& batchLines);
+    bool admit(const LogRecord& record, const FormatInfo& format, std::string& batch, size_t& batchLines);
+    static void formatRecord(const LogRecord& record, const FormatInfo& format, const std::string& threadName, std::string& out);
+    void publishBatch(std::string& batch, size_t& batchLines);
+
+    static std::array<std::atomic<const FormatInfo*>, MAX_FORMATS> gFormats;
+    static std::atomic<uint32_t> gFormatCount;
+    static std::atomic<uint64_t> gNextLoggerId;
+
+    Config mConfig;
+    PublishCallback mPublish;
+    const uint64_t mId;
+    mutable std::mutex mRingsMutex;
+    std::vector<std::unique_ptr<Ring>> mRings;
+    // consumer thread only, a snapshot of mRings; rings are never removed before the logger dies
+    std::vector<Ring*> mDrainRings;
+    std::vector<FormatState> mFormatStates;
+    std::atomic<bool> mShouldRun{true};
+    std::atomic<uint64_t> mDroppedRateLimited{0};
+    std::atomic<uint64_t> mDroppedSampling{0};
+    std::atomic<uint64_t> mPublishedLines{0};
+    std::atomic<uint64_t> mPublishedBatches{0};
+    std::thread mThread;
+};
+
+}
+
+#define NIOEV_ASYNC_LOG(logger, level, format, ...)                                                                          \
+    do {                                                                                                                      \
+        if((logger).isEnabled(level)) {                                                                                       \
+            static const uint16_t nioevLogFormatId = ::nioev::lib::AsyncLogger::registerFormat(format, level);                \
+            (logger).log(nioevLogFormatId, ##__VA_ARGS__);                                                                    \
+        }                                                                                                                     \
+    } while(0)
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+/* The encoded packets waiting to be written to one socket. Writes can stop anywhere, even in the middle of a packet,
+ * so besides the buffers it remembers how far into the first one the socket already got.
+ */
+class SendQueue final {
+public:
+    void push(SharedBuffer buffer) {
+        if(buffer.size() == 0)
+            return;
+        mBytes += buffer.size();
+        mBuffers.emplace_back(std::move(buffer));
+    }
+    // Fills up to `max` iovecs with the unsent data, starting where the last write stopped. Returns how many it filled.
+    size_t fillIovecs(iovec* iov, size_t max) const {
+        size_t count = 0;
+        for(size_t i = mFirst; i < mBuffers.size() && count < max; ++i, ++count) {
+            size_t offset = i == mFirst ? mOffset : 0;
+            iov[count].iov_base = const_cast<uint8_t*>(mBuffers[i].data()) + offset;
+            iov[count].iov_len = mBuffers[i].size() - offset;
+        }
+        return count;
+    }
+    // Marks `bytes` as written and drops the buffers that are done.
+    void consume(size_t bytes) {
+        mBytes -= bytes;
+        while(bytes > 0) {
+            size_t left = mBuffers[mFirst].size() - mOffset;
+            if(bytes < left) {
+                mOffset += bytes;
+                return;
+            }
+            bytes -= left;
+            mBuffers[mFirst] = SharedBuffer{};
+            mFirst += 1;
+            mOffset = 0;
+        }
+        // compact once the sent buffers make up half of the vector, so it doesn't grow forever
+        if(mFirst == mBuffers.size()) {
+            mBuffers.clear();
+            mFirst = 0;
+        } else if(mFirst * 2 >= mBuffers.size()) {
+            mBuffers.erase(mBuffers.begin(), mBuffers.begin() + mFirst);
+            mFirst = 0;
+        }
+    }
+    void clear() {
+        mBuffers.clear();
+        mFirst = 0;
+        mOffset = 0;
+        mBytes = 0;
+    }
+    [[nodiscard]] bool empty() const {
+        return mBytes == 0;
+    }
+    [[nodiscard]] size_t bytes() const {
+        return mBytes;
+    }
+
+private:
+    std::vector<SharedBuffer> mBuffers;
+    size_t mFirst{0};
+    size_t mOffset{0};
+    size_t mBytes{0};
+};
+
+enum class SendBackend : uint8_t
+{
+    EPOLL,
+    IO_URING
+};
+
+/* Writes encoded buffers to many non-blocking sockets with as few syscalls as possible. enqueue() only queues; flush()
+ * then writes everything queued per socket with a single vectored sendmsg (MSG_NOSIGNAL, so a closed peer doesn't
+ * raise SIGPIPE), and poll() continues with sockets that were full once they're writable again.
+ *
+ * With SendBackend::IO_URING, flush() submits the sendmsg of all sockets with one io_uring_enter and their results
+ * are picked up by the next flush() or poll(). A socket that returns EAGAIN gets a POLL_ADD and is retried once it
+ * completes; there's never more than one operation in flight per socket, which keeps the bytes in order. The ring is
+ * driven through the kernel ABI directly, so it doesn't need liburing; if the kernel or a seccomp filter doesn't allow
+ * it (or NIOEV_HAS_IO_URING wasn't defined at build time), the epoll backend is used instead, see getBackend().
+ *
+ * With SendBackend::EPOLL, flush() writes each socket until it's empty or full. Sockets are registered for
+ * edge-triggered EPOLLOUT once, so waiting for a full socket costs no extra epoll_ctl.
+ *
+ * Not thread safe. Buffers must not be modified after they were enqueued.
+ */
+class BatchedSender final {
+public:
+    struct Config {
+        SendBackend backend = SendBackend::IO_URING;
+        uint32_t ringEntries = 256;
+        // iovecs per sendmsg, at most IOV_MAX
+        size_t maxIovecs = 64;
+        // enqueue() refuses buffers once this many bytes are unsent on a socket, 0 means no limit
+        size_t maxQueuedBytes = 16 * 1024 * 1024;
+    };
+    struct Stats {
+        uint64_t syscalls{0};
+        uint64_t sends{0};
+        uint64_t bytesSent{0};
+        uint64_t partialSends{0};
+        uint64_t wouldBlock{0};
+        uint64_t errors{0};
+    };
+    // called with the errno of a failed send; the socket's queue is dropped and further enqueue() calls fail
+    using ErrorCallback = std::function<void(int fd, int error)>;
+
+    explicit BatchedSender(Config config, ErrorCallback onError = {});
+    ~BatchedSender();
+    BatchedSender(const BatchedSender&) = delete;
+    void operator=(const BatchedSender&) = delete;
+
+    // The socket has to be non-blocking; it is never closed by the sender.
+    void addSocket(int fd);
+    /* Drops whatever is still queued for the socket, after which it can be closed. An io_uring operation still in
+     * flight is cancelled; the queued buffers it may reference are only released once it completed.
+     */
+    void removeSocket(int fd);
+    // False if the socket is unknown, failed before or has maxQueuedBytes unsent.
+    bool enqueue(int fd, SharedBuffer buffer);
+    void flush();
+    // Waits up to `timeout` (negative waits forever) for full sockets to drain or sends to complete and continues
+    // writing. Returns the number of events handled.
+    size_t poll(std::chrono::milliseconds timeout);
+
+    [[nodiscard]] size_t pendingBytes(int fd) const;
+    // removed sockets still waiting for the completion of their cancelled io_uring operation
+    [[nodiscard]] size_t retiredSockets() const {
+        return mRetired.size();
+    }
+    [[nodiscard]] SendBackend getBackend() const {
+        return mBackend;
+    }
+    [[nodiscard]] const Stats& getStats() const {
+        return mStats;
+    }
+
+private:
+    struct Socket;
+    struct Ring;
+
+    void markDirty(Socket& socket);
+    void fail(Socket& socket, int error);
+    void reportErrors();
+    void sendNow(Socket& socket);
+    void submitSend(Socket& socket);
+    void submitPollOut(Socket& socket);
+    void submitCancel(Socket& socket);
+    size_t reapCompletions();
+    void handleCompletion(uint64_t userData, int32_t result);
+    void submitRing(uint32_t waitFor, std::chrono::milliseconds timeout);
+
+    Config mConfig;
+    ErrorCallback mOnError;
+    SendBackend mBackend{SendBackend::EPOLL};
+    int mEpollFd{-1};
+    std::unique_ptr<Ring> mRing;
+    std::unordered_map<int, std::unique_ptr<Socket>> mSockets;
+    // removed sockets with an io_uring operation still in flight, freed on its completion
+    std::vector<std::unique_ptr<Socket>> mRetired;
+    std::vector<Socket*> mDirty;
+    std::vector<std::pair<int, int>> mErrors;
+    size_t mInflight{0};
+    Stats mStats;
+};
+
+}
\ No newline at end of file
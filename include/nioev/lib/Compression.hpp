@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Timers.hpp"
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+/* Compression::ZSTD for payloads, with a dictionary per topic prefix. Telemetry payloads are small and repetitive,
+ * which generic compression can't exploit because every payload starts from zero; a dictionary trained on earlier
+ * payloads of the same kind of topic can.
+ *
+ * Every compress() call is attributed to the prefix of its topic (the first `prefixLevels` levels). Every n-th payload
+ * of a prefix is kept as a training sample, and once enough samples are collected, trainDictionaries() trains a new
+ * dictionary and swaps it in atomically, so compressing threads never wait for training. The last few dictionaries
+ * stay available for decompression (see Config::keepDictionaries); the output is a regular zstd frame carrying the id of its dictionary, so decompress()
+ * doesn't need to know the topic and other zstd implementations can decode it given dictionaryContent().
+ *
+ * Topics come from clients, so only the first Config::maxPrefixes prefixes get their own entry; payloads of any
+ * further prefix share the OTHER_PREFIX entry and its dictionary.
+ *
+ * ZSTD contexts are thread local and reused. Without libzstd at build time (NIOEV_HAS_ZSTD undefined), compress()
+ * never compresses and decompress() throws.
+ */
+class PayloadCompressor final {
+public:
+    // can't collide with a real prefix, published topics never contain wildcards
+    static constexpr const char* OTHER_PREFIX = "#";
+
+    struct Config {
+        // payloads below this stay uncompressed, the saved bytes aren't worth the latency
+        size_t minSize = 64;
+        int level = 3;
+        uint prefixLevels = 1;
+        // prefixes with their own samples and dictionaries, not counting OTHER_PREFIX and loadDictionary()
+        size_t maxPrefixes = 256;
+        // every n-th payload of a prefix becomes a training sample
+        uint32_t sampleEvery = 16;
+        // samples needed to (re)train the dictionary of a prefix
+        size_t samplesForTraining = 1000;
+        // samples longer than this are cut off
+        size_t maxSampleSize = 4096;
+        size_t dictionarySize = 16 * 1024;
+        /* dictionaries kept per prefix, including the current one; older ones are dropped when a new one is
+         * installed, after which payloads compressed with them can't be decompressed anymore
+         */
+        size_t keepDictionaries = 4;
+        // protects against decompression bombs
+        size_t maxDecompressedSize = 268435455;
+    };
+    struct DictionaryStats {
+        std::string prefix;
+        // 0 while the prefix has no trained dictionary yet
+        uint32_t dictionaryId{0};
+        bool current{false};
+        uint64_t compressedPayloads{0};
+        // not smaller after compression, or below minSize on a prefix that has larger payloads too
+        uint64_t skippedPayloads{0};
+        uint64_t inputBytes{0};
+        uint64_t outputBytes{0};
+        uint64_t compressNanoseconds{0};
+        uint64_t decompressedPayloads{0};
+        uint64_t decompressNanoseconds{0};
+
+        [[nodiscard]] double ratio() const {
+            return outputBytes ? double(inputBytes) / outputBytes : 0;
+        }
+    };
+
+    explicit PayloadCompressor(Config config);
+    ~PayloadCompressor();
+    PayloadCompressor(const PayloadCompressor&) = delete;
+    void operator=(const PayloadCompressor&) = delete;
+
+    static bool isAvailable();
+
+    // nullopt if the payload should be sent uncompressed, otherwise a zstd frame to send with Compression::ZSTD
+    std::optional<SharedBuffer> compress(std::string_view topic, const SharedBuffer& payload);
+    // throws on corrupt data, unknown dictionaries or output above maxDecompressedSize
+    SharedBuffer decompress(const SharedBuffer& compressed);
+
+    // Trains and swaps in new dictionaries for all prefixes with enough samples. Expensive, keep it off the hot path.
+    void trainDictionaries();
+    /* Calls trainDictionaries() on the timer thread. The timer task can outlive the compressor: destroying the
+     * compressor or calling stopTrainingPeriodically() detaches it, waiting for a training that is running right now.
+     */
+    void trainPeriodically(Timers& timers, std::chrono::steady_clock::duration every);
+    void stopTrainingPeriodically();
+
+    // e.g. for persisting dictionaries or handing them to clients that decompress themselves
+    [[nodiscard]] std::optional<std::vector<uint8_t>> dictionaryContent(uint32_t dictionaryId) const;
+    // makes a dictionary (e.g. persisted from an earlier run) the current one of the prefix
+    void loadDictionary(const std::string& prefix, std::vector<uint8_t> content);
+
+    [[nodiscard]] std::vector<DictionaryStats> getStats() const;
+
+private:
+    struct Dictionary;
+    struct Prefix;
+    struct PeriodicTraining;
+
+    std::string_view prefixOf(std::string_view topic) const;
+    Prefix* findPrefix(std::string_view prefix) const;
+    // unknown prefixes beyond maxPrefixes end up in OTHER_PREFIX unless `capped` is false
+    Prefix& getPrefix(std::string_view prefix, bool capped);
+    void sample(Prefix& prefix, const SharedBuffer& payload);
+    void install(Prefix& prefix, std::shared_ptr<Dictionary> dictionary);
+    std::shared_ptr<Dictionary> findDictionary(uint32_t id) const;
+
+    Config mConfig;
+    mutable std::shared_mutex mMutex;
+    std::map<std::string, std::unique_ptr<Prefix>, std::less<>> mPrefixes;
+    // entries of mPrefixes that count against maxPrefixes
+    size_t mCappedPrefixes{0};
+    // the dictionaries of all prefixes, for decompression
+    std::unordered_map<uint32_t, std::shared_ptr<Dictionary>> mDictionaries;
+    uint32_t mNextDictionaryId{1};
+    // shared with the timer tasks of trainPeriodically()
+    std::shared_ptr<PeriodicTraining> mPeriodicTraining;
+};
+
+}
\ No newline at end of file
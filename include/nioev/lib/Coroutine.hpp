@@ -0,0 +1,425 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "nioev/lib/Coroutine.hpp requires C++20, link against the nioev_coro target"
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "GenServer.hpp"
+#include "Timers.hpp"
+
+namespace nioev::lib {
+
+/* Recycles coroutine frames in per-thread free lists, bucketed into size classes of 64 bytes. A frame is returned to
+ * the pool of the thread that destroys it, which is usually not the one that allocated it because tasks hop between
+ * worker threads. That's fine, the pools just even out over time. Frames above the largest size class go straight
+ * to the global allocator.
+ */
+class CoroutineFramePool final {
+public:
+    static void* allocate(size_t size);
+    static void deallocate(void* ptr, size_t size) noexcept;
+};
+
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+struct TaskPromiseBase {
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            // symmetric transfer back to whoever awaited us, so deep task chains don't grow the stack
+            return handle.promise().mContinuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    static void* operator new(size_t size) {
+        return CoroutineFramePool::allocate(size);
+    }
+    static void operator delete(void* ptr, size_t size) noexcept {
+        CoroutineFramePool::deallocate(ptr, size);
+    }
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+    void unhandled_exception() {
+        mException = std::current_exception();
+    }
+    void rethrowIfFailed() {
+        if(mException)
+            std::rethrow_exception(mException);
+    }
+
+    std::coroutine_handle<> mContinuation{std::noop_coroutine()};
+    std::exception_ptr mException;
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase {
+    Task<T> get_return_object() noexcept;
+    template<typename U>
+    void return_value(U&& value) {
+        mValue.emplace(std::forward<U>(value));
+    }
+    T takeResult() {
+        rethrowIfFailed();
+        return std::move(*mValue);
+    }
+    std::optional<T> mValue;
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+    void takeResult() {
+        rethrowIfFailed();
+    }
+};
+
+}
+
+/* A lazily started coroutine. Nothing runs until the task is co_awaited (or handed to spawn()/syncWait()), at which
+ * point the awaiting coroutine is suspended and resumed again once the task finishes - on whichever thread the task
+ * finished on.
+ */
+template<typename T>
+class [[nodiscard]] Task final {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task(const Task&) = delete;
+    void operator=(const Task&) = delete;
+    Task(Task&& other) noexcept
+    : mHandle(std::exchange(other.mHandle, {})) {
+
+    }
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            if(mHandle)
+                mHandle.destroy();
+            mHandle = std::exchange(other.mHandle, {});
+        }
+        return *this;
+    }
+    ~Task() {
+        if(mHandle)
+            mHandle.destroy();
+    }
+
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+            bool await_ready() noexcept {
+                return !handle || handle.done();
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().mContinuation = awaiting;
+                return handle;
+            }
+            T await_resume() {
+                if(!handle)
+                    throw std::logic_error{"Awaiting an empty task"};
+                return handle.promise().takeResult();
+            }
+        };
+        return Awaiter{mHandle};
+    }
+
+private:
+    friend struct detail::TaskPromise<T>;
+    explicit Task(std::coroutine_handle<promise_type> handle)
+    : mHandle(handle) {
+
+    }
+    std::coroutine_handle<promise_type> mHandle;
+};
+
+namespace detail {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+}
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+}
+
+// Fire-and-forget coroutine that owns the task it awaits and frees its own frame when done.
+struct DetachedTask {
+    struct promise_type {
+        static void* operator new(size_t size) {
+            return CoroutineFramePool::allocate(size);
+        }
+        static void operator delete(void* ptr, size_t size) noexcept {
+            CoroutineFramePool::deallocate(ptr, size);
+        }
+        DetachedTask get_return_object() noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+}
+
+/* Starts a task without waiting for it. The task runs on the calling thread until its first suspension point. An
+ * exception escaping a spawned task terminates the process, catch inside the task if that can happen.
+ */
+inline void spawn(Task<void> task) {
+    [](Task<void> t) -> detail::DetachedTask {
+        co_await std::move(t);
+    }(std::move(task));
+}
+
+// Blocks the calling thread until the task finished. Meant for main() and tests, never call it on a worker thread.
+template<typename T>
+T syncWait(Task<T> task) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> result;
+    std::exception_ptr exception;
+    spawn([](Task<T> t, auto& result, std::exception_ptr& exception, std::mutex& mutex, std::condition_variable& cv, bool& done) -> Task<void> {
+        try {
+            if constexpr(std::is_void_v<T>) {
+                co_await std::move(t);
+                result.emplace(true);
+            } else {
+                result.emplace(co_await std::move(t));
+            }
+        } catch(...) {
+            exception = std::current_exception();
+        }
+        // notify with the lock held, the waiting thread may destroy everything right after it got the lock back
+        std::lock_guard<std::mutex> lock{mutex};
+        done = true;
+        cv.notify_one();
+    }(std::move(task), result, exception, mutex, cv, done));
+    std::unique_lock<std::mutex> lock{mutex};
+    cv.wait(lock, [&] { return done; });
+    if(exception)
+        std::rethrow_exception(exception);
+    if constexpr(!std::is_void_v<T>) {
+        return std::move(*result);
+    }
+}
+
+/* A GenServer whose tasks are suspended coroutines. Awaiting one of its awaitables parks the coroutine in the queue
+ * and the worker thread resumes it directly, so a hop between threads costs a single queue entry of one pointer
+ * instead of a heap allocated std::function plus the continuation state around it.
+ */
+class CoroutineExecutor final : public GenServer<std::coroutine_handle<>> {
+public:
+    explicit CoroutineExecutor(std::string threadName, std::optional<IdleStrategy::Config> idleStrategy = {})
+    : GenServer(std::move(threadName)) {
+        if(idleStrategy)
+            enableIdleStrategy(*idleStrategy);
+        startThread();
+    }
+    ~CoroutineExecutor() override {
+        mStopping = true;
+        stopThread();
+    }
+
+    // co_await executor.schedule(); continues on the worker thread
+    auto schedule() noexcept {
+        struct Awaiter {
+            CoroutineExecutor& executor;
+            bool await_ready() noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> handle) {
+                executor.resumeOnWorker(handle);
+            }
+            void await_resume() noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+    // runs func on the worker thread and continues there with its result: auto session = co_await sessions.call([&]{ return load(id); });
+    template<typename Func>
+    auto call(Func&& func) {
+        struct Awaiter {
+            CoroutineExecutor& executor;
+            std::decay_t<Func> func;
+            bool await_ready() noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> handle) {
+                executor.resumeOnWorker(handle);
+            }
+            decltype(auto) await_resume() {
+                return func();
+            }
+        };
+        return Awaiter{*this, std::forward<Func>(func)};
+    }
+
+    // continues on the worker thread after the delay, without involving any other thread
+    auto sleep(std::chrono::milliseconds delay) {
+        struct Awaiter {
+            CoroutineExecutor& executor;
+            std::chrono::milliseconds delay;
+            bool await_ready() noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> handle) {
+                if(executor.enqueueDelayed(std::move(handle), delay) != GenServerEnqueueResult::Success) {
+                    throw std::runtime_error{"Failed to enqueue coroutine"};
+                }
+            }
+            void await_resume() noexcept {}
+        };
+        return Awaiter{*this, delay};
+    }
+
+    // For awaiters: throws on the awaiting thread if the executor doesn't accept the coroutine (e.g. it is stopping).
+    void resumeOnWorker(std::coroutine_handle<> handle) {
+        if(enqueue(std::move(handle)) != GenServerEnqueueResult::Success) {
+            throw std::runtime_error{"Failed to enqueue coroutine"};
+        }
+    }
+    /* For threads that must not throw, like the Timers thread. If the executor doesn't accept the coroutine, it stays
+     * suspended and is counted in abandonedCoroutines(), the same fate as coroutines still queued when it stops.
+     */
+    bool tryResumeOnWorker(std::coroutine_handle<> handle) noexcept {
+        try {
+            if(enqueue(std::move(handle)) == GenServerEnqueueResult::Success) {
+                return true;
+            }
+        } catch(...) {
+        }
+        mAbandoned.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    [[nodiscard]] uint64_t abandonedCoroutines() const {
+        return mAbandoned.load(std::memory_order_relaxed);
+    }
+
+protected:
+    void handleTask(std::coroutine_handle<>&& handle) override {
+        handle.resume();
+    }
+    // a stopping executor would never resume what's enqueued now
+    bool allowEnqueue(const std::coroutine_handle<>&) override {
+        return !mStopping;
+    }
+
+private:
+    std::atomic<bool> mStopping{false};
+    std::atomic<uint64_t> mAbandoned{0};
+};
+
+namespace detail {
+
+template<typename Result>
+using CallResultSlot = std::optional<std::conditional_t<std::is_void_v<Result>, bool, Result>>;
+
+template<typename Result>
+struct GenServerCallCompletion {
+    std::coroutine_handle<> handle;
+    CallResultSlot<Result>* result;
+    template<typename... Args>
+    void operator()(Args&&... args) const {
+        if constexpr(std::is_void_v<Result>) {
+            static_assert(sizeof...(Args) == 0, "call<void>() completes without a result");
+            result->emplace(true);
+        } else {
+            result->emplace(std::forward<Args>(args)...);
+        }
+        handle.resume();
+    }
+};
+
+template<typename Result, typename TaskType, typename MakeTask>
+struct GenServerCallAwaiter {
+    GenServer<TaskType>& server;
+    MakeTask makeTask;
+    CallResultSlot<Result> result;
+    bool await_ready() noexcept {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+        // the awaiter may be gone as soon as the task is enqueued, only a failed enqueue may touch it again
+        if(server.enqueue(makeTask(GenServerCallCompletion<Result>{handle, &result})) != GenServerEnqueueResult::Success) {
+            throw std::runtime_error{"Failed to enqueue task"};
+        }
+    }
+    Result await_resume() {
+        if constexpr(!std::is_void_v<Result>) {
+            return std::move(*result);
+        }
+    }
+};
+
+}
+
+/* Awaits a request on an existing GenServer<TaskType> without touching the server, for task types that carry a
+ * completion callback like hand-written continuations do. makeTask gets a copyable callback (it fits into a
+ * std::function member) and returns the task; the server's handleTask() calls it exactly once with the result, which
+ * resumes the coroutine right there on the server's worker thread:
+ *
+ *     auto session = co_await call<Session>(sessions, [&](auto done) { return LoadSession{clientId, std::move(done)}; });
+ *
+ * Throws on the awaiting thread if the server doesn't accept the task. A callback that is never called leaves the
+ * coroutine suspended for good, just like a continuation that is never called. Servers written for coroutines can
+ * derive from CoroutineExecutor instead and use its call(), which saves the callback.
+ */
+template<typename Result = void, typename TaskType, typename MakeTask>
+auto call(GenServer<TaskType>& server, MakeTask&& makeTask) {
+    return detail::GenServerCallAwaiter<Result, TaskType, std::decay_t<MakeTask>>{server, std::forward<MakeTask>(makeTask), {}};
+}
+
+/* Suspends for the given duration using the shared Timers thread, then continues on the executor's worker thread.
+ * It's a free function taking the executor rather than Timers::sleep(), because Timers is part of the C++17 library
+ * and runs its callbacks with its own lock held, so we never resume on the timer thread itself. Failing to add the
+ * timer throws on the awaiting thread; if the executor stopped by the time the timer fires, the coroutine is
+ * abandoned (see CoroutineExecutor::tryResumeOnWorker()) since nothing may throw on the timer thread.
+ */
+inline auto sleep(Timers& timers, std::chrono::steady_clock::duration duration, CoroutineExecutor& executor) {
+    struct Awaiter {
+        Timers& timers;
+        std::chrono::steady_clock::duration duration;
+        CoroutineExecutor& executor;
+        bool await_ready() noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> handle) {
+            timers.addOneShotTask(duration, [handle, &executor = executor]() noexcept {
+                executor.tryResumeOnWorker(handle);
+            });
+        }
+        void await_resume() noexcept {}
+    };
+    return Awaiter{timers, duration, executor};
+}
+
+}
\ No newline at end of file
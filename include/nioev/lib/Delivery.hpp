@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SubscriptionTree.hpp"
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+/* A message as handed to subscribers. Topic and payload are refcounted and shared by every subscriber the message is
+ * delivered to, so a subscriber that wants to queue a message just copies it, which bumps two refcounts instead of
+ * copying the payload.
+ */
+struct DeliveryMessage {
+    std::shared_ptr<const std::string> topic;
+    SharedBuffer payload;
+    QoS qos{QoS::QoS0};
+    Retained retained{Retained::No};
+
+    DeliveryMessage() = default;
+    DeliveryMessage(std::shared_ptr<const std::string> topic, SharedBuffer payload, QoS qos, Retained retained)
+    : topic(std::move(topic)), payload(std::move(payload)), qos(qos), retained(retained) {
+
+    }
+    // copies topic and payload once, for callers that don't have them in shared form yet
+    DeliveryMessage(std::string_view topic, const uint8_t* payload, size_t payloadLen, QoS qos, Retained retained)
+    : topic(std::make_shared<const std::string>(topic)), qos(qos), retained(retained) {
+        this->payload.append(payload, payloadLen);
+    }
+
+    [[nodiscard]] const std::string& topicString() const {
+        return *topic;
+    }
+};
+
+// The messages of one delivery call, valid only for the duration of that call.
+class DeliveryBatch final {
+public:
+    class Iterator {
+    public:
+        explicit Iterator(const DeliveryMessage* const* current)
+        : mCurrent(current) {
+
+        }
+        const DeliveryMessage& operator*() const {
+            return **mCurrent;
+        }
+        const DeliveryMessage* operator->() const {
+            return *mCurrent;
+        }
+        Iterator& operator++() {
+            ++mCurrent;
+            return *this;
+        }
+        bool operator==(const Iterator& other) const {
+            return mCurrent == other.mCurrent;
+        }
+        bool operator!=(const Iterator& other) const {
+            return mCurrent != other.mCurrent;
+        }
+
+    private:
+        const DeliveryMessage* const* mCurrent;
+    };
+
+    DeliveryBatch(const DeliveryMessage* const* messages, size_t count)
+    : mMessages(messages), mCount(count) {
+
+    }
+    [[nodiscard]] size_t size() const {
+        return mCount;
+    }
+    [[nodiscard]] bool empty() const {
+        return mCount == 0;
+    }
+    const DeliveryMessage& operator[](size_t index) const {
+        return *mMessages[index];
+    }
+    [[nodiscard]] Iterator begin() const {
+        return Iterator{mMessages};
+    }
+    [[nodiscard]] Iterator end() const {
+        return Iterator{mMessages + mCount};
+    }
+
+private:
+    const DeliveryMessage* const* mMessages;
+    size_t mCount;
+};
+
+/* Receives all messages routed to it since the last flush in a single call, in publish order. The batch itself is
+ * only valid during the call; copy the messages that should be kept.
+ */
+class BatchSubscriber {
+public:
+    virtual void deliver(const DeliveryBatch& batch) = 0;
+    virtual ~BatchSubscriber() = default;
+};
+
+// Lets a Subscriber that still takes one message per call receive batches. The subscriber must outlive the adapter.
+class SubscriberAdapter final : public BatchSubscriber {
+public:
+    explicit SubscriberAdapter(Subscriber& subscriber)
+    : mSubscriber(subscriber) {
+
+    }
+    void deliver(const DeliveryBatch& batch) override {
+        for(auto& message: batch) {
+            mSubscriber(*message.topic, message.payload.data(), message.payload.size(), message.qos, message.retained);
+        }
+    }
+
+private:
+    Subscriber& mSubscriber;
+};
+
+/* Collects the recipients of a number of messages and then delivers them with one call per subscriber, instead of
+ * one virtual call per message and subscriber. Messages are kept until flush() returns, recipients are delivered
+ * in the order they were first added. Each recipient gets every message routed to it once, in routing order, no
+ * matter how many of its filters match. Not thread safe; use one per routing thread. Message and recipient lists keep
+ * their capacity between flushes.
+ */
+class BatchDispatcher final {
+public:
+    struct Stats {
+        uint64_t messages{0};
+        uint64_t deliveries{0};
+        uint64_t deliverCalls{0};
+        uint64_t flushes{0};
+    };
+
+    // adds the message and every subscriber matching its topic; returns the number of recipients
+    template<template<typename> class Alloc>
+    size_t route(const SubscriptionTree<BatchSubscriber*, Alloc>& tree, DeliveryMessage message) {
+        auto index = addMessage(std::move(message));
+        size_t recipients = 0;
+        tree.forEveryMatch(*mMessages[index].topic, [&](BatchSubscriber*& subscriber) {
+            addRecipient(*subscriber, index);
+            recipients += 1;
+        });
+        return recipients;
+    }
+    /* Calls every recipient once with its messages and drops the references to all messages. If a subscriber throws,
+     * the remaining ones aren't called and their messages are dropped.
+     */
+    void flush();
+    [[nodiscard]] size_t pendingMessages() const {
+        return mMessages.size();
+    }
+    [[nodiscard]] Stats getStats() const {
+        return mStats;
+    }
+
+private:
+    struct Recipient {
+        BatchSubscriber* subscriber{nullptr};
+        // position in mRecipientSlots, so clear() doesn't have to scan the whole table
+        size_t slot{0};
+        std::vector<uint32_t> messages;
+    };
+    struct RecipientSlot {
+        BatchSubscriber* subscriber{nullptr};
+        uint32_t recipient{0};
+    };
+    // returns the index to pass to addRecipient()
+    size_t addMessage(DeliveryMessage message);
+    // only for the message added last, which makes skipping a repeated recipient a check of its last entry
+    void addRecipient(BatchSubscriber& subscriber, size_t messageIndex);
+    Recipient& recipientFor(BatchSubscriber& subscriber);
+    void growRecipientSlots();
+    void clear();
+
+    std::vector<DeliveryMessage> mMessages;
+    // only the first mRecipientCount entries are in use, the others keep their capacity for later flushes
+    std::vector<Recipient> mRecipients;
+    size_t mRecipientCount{0};
+    /* Open addressing table from subscriber to its entry in mRecipients. A std::unordered_map would allocate a node
+     * for every recipient of every flush, which at high fan-out costs more than the delivery itself.
+     */
+    std::vector<RecipientSlot> mRecipientSlots;
+    std::vector<const DeliveryMessage*> mBatch;
+    Stats mStats;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+enum class ExpiryKind : uint8_t
+{
+    // MESSAGE_EXPIRY_INTERVAL of a retained message
+    RETAINED_MESSAGE,
+    // MESSAGE_EXPIRY_INTERVAL of a message queued for an offline session
+    QUEUED_MESSAGE,
+    // SESSION_EXPIRY_INTERVAL, counting from the disconnect
+    SESSION,
+    // when the will message of a disconnected client is due, which is a deadline as well
+    WILL
+};
+static constexpr size_t EXPIRY_KIND_COUNT = 4;
+
+static inline const char* expiryKindToString(ExpiryKind kind) {
+    switch(kind) {
+    case ExpiryKind::RETAINED_MESSAGE:
+        return "retained_message";
+    case ExpiryKind::QUEUED_MESSAGE:
+        return "queued_message";
+    case ExpiryKind::SESSION:
+        return "session";
+    case ExpiryKind::WILL:
+        return "will";
+    }
+    return "<unknown>";
+}
+
+// MESSAGE_EXPIRY_INTERVAL, SESSION_EXPIRY_INTERVAL or WILL_DELAY_INTERVAL from a property list, if it's there.
+template<template<typename> class Alloc>
+std::optional<uint32_t> findIntervalProperty(const BasicPropertyList<Alloc>& properties, MQTTProperty property) {
+    auto it = properties.find(property);
+    if(it == properties.end()) {
+        return {};
+    }
+    return std::get<uint32_t>(it->second);
+}
+
+/* Deadlines of everything in a broker that expires: retained and queued messages, sessions and wills. The objects
+ * themselves stay wherever the broker keeps them, the index only knows them by kind and a caller chosen 64 bit id.
+ *
+ * Expiry is meant to happen in two ways. Lazily: before handing out a retained or queued message, expireIfDue() tells
+ * whether it has expired (and forgets it if so), and remainingSeconds() gives the value to patch into its
+ * MESSAGE_EXPIRY_INTERVAL (see PacketCodec<V5, PUBLISH>::rewriteMessageExpiry()). And incrementally: expireDue()
+ * hands out at most a given number of due entries per call, so a periodic task reclaims the memory of messages nobody
+ * asks for anymore without ever scanning everything or stalling on a burst of deadlines.
+ *
+ * Deadlines are kept in a min heap over a slab of entries; each entry knows its heap position, so rescheduling and
+ * cancelling are O(log n) without searching. Not thread safe.
+ */
+class ExpiryIndex final {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        uint64_t scheduled{0};
+        uint64_t cancelled{0};
+        uint64_t expiredOnAccess{0};
+        uint64_t expiredInBatches{0};
+    };
+
+    // Sets or replaces the deadline of an entry.
+    void schedule(ExpiryKind kind, uint64_t id, Clock::time_point deadline);
+    // For MQTT intervals in seconds.
+    void scheduleAfter(ExpiryKind kind, uint64_t id, uint32_t seconds, Clock::time_point now) {
+        schedule(kind, id, now + std::chrono::seconds{seconds});
+    }
+    // Returns false if the entry wasn't scheduled.
+    bool cancel(ExpiryKind kind, uint64_t id);
+
+    /* When a client disconnects: its session expires after SESSION_EXPIRY_INTERVAL seconds (0xFFFFFFFF never) and its
+     * will, if it has one, is due after WILL_DELAY_INTERVAL seconds, but at the latest when the session expires.
+     */
+    void scheduleDisconnect(uint64_t sessionId, uint32_t sessionExpirySeconds, std::optional<uint32_t> willDelaySeconds, Clock::time_point now);
+    // When a client reconnects to its session, which cancels both session expiry and will.
+    void cancelDisconnect(uint64_t sessionId) {
+        cancel(ExpiryKind::SESSION, sessionId);
+        cancel(ExpiryKind::WILL, sessionId);
+    }
+
+    [[nodiscard]] std::optional<Clock::time_point> deadlineOf(ExpiryKind kind, uint64_t id) const;
+    // Seconds left, rounded up so a message is never announced as expired before it is; nullopt if there's no deadline.
+    [[nodiscard]] std::optional<uint32_t> remainingSeconds(ExpiryKind kind, uint64_t id, Clock::time_point now) const;
+    // The lazy path: returns true and removes the entry if its deadline passed.
+    bool expireIfDue(ExpiryKind kind, uint64_t id, Clock::time_point now);
+
+    /* Calls callback(ExpiryKind, uint64_t id) for up to maxEntries entries whose deadline passed, earliest first, after
+     * removing them from the index; the callback may schedule or cancel entries. Returns how many expired.
+     */
+    template<typename Callback>
+    size_t expireDue(Clock::time_point now, size_t maxEntries, Callback&& callback) {
+        size_t ret = 0;
+        while(ret < maxEntries && !mHeap.empty() && mHeap.front().deadline <= now) {
+            auto slot = mHeap.front().slot;
+            auto kind = mEntries[slot].kind;
+            auto id = mEntries[slot].id;
+            erase(slot);
+            mStats.expiredInBatches += 1;
+            ret += 1;
+            callback(kind, id);
+        }
+        return ret;
+    }
+
+    [[nodiscard]] std::optional<Clock::time_point> nextDeadline() const {
+        if(mHeap.empty()) {
+            return {};
+        }
+        return mHeap.front().deadline;
+    }
+    [[nodiscard]] size_t size() const {
+        return mHeap.size();
+    }
+    [[nodiscard]] size_t size(ExpiryKind kind) const {
+        return mSlots[static_cast<size_t>(kind)].size();
+    }
+    [[nodiscard]] const Stats& getStats() const {
+        return mStats;
+    }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        uint64_t id{0};
+        uint32_t heapIndex{NONE};
+        ExpiryKind kind{ExpiryKind::RETAINED_MESSAGE};
+    };
+    // the deadline is kept in the heap itself, so sifting compares without touching the entries
+    struct HeapNode {
+        Clock::time_point deadline;
+        uint32_t slot;
+    };
+
+    [[nodiscard]] uint32_t find(ExpiryKind kind, uint64_t id) const;
+    void erase(uint32_t slot);
+    void siftUp(uint32_t index);
+    void siftDown(uint32_t index);
+    void place(uint32_t index, const HeapNode& node) {
+        mHeap[index] = node;
+        mEntries[node.slot].heapIndex = index;
+    }
+
+    std::vector<Entry> mEntries;
+    std::vector<uint32_t> mFreeSlots;
+    // 4-ary, which is shallower than a binary heap and compares children that share a cache line
+    std::vector<HeapNode> mHeap;
+    // per kind, from id to slot
+    std::array<std::unordered_map<uint64_t, uint32_t>, EXPIRY_KIND_COUNT> mSlots;
+    Stats mStats;
+};
+
+}
\ No newline at end of file
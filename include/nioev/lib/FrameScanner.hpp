@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+// Where one MQTT packet is inside a receive buffer.
+struct FrameDescriptor {
+    // offset of the fixed header
+    uint32_t offset;
+    // variable header and payload start at offset + headerLength
+    uint8_t headerLength;
+    MQTTMessageType type;
+    // lower four bits of the first byte
+    uint8_t flags;
+    uint32_t remainingLength;
+
+    [[nodiscard]] uint32_t bodyOffset() const {
+        return offset + headerLength;
+    }
+    [[nodiscard]] uint32_t size() const {
+        return headerLength + remainingLength;
+    }
+};
+
+struct FrameScanResult {
+    size_t frameCount{0};
+    // bytes covered by the found frames; everything after that is an incomplete packet that needs more data
+    size_t consumed{0};
+    // the data after `consumed` is not a valid fixed header, the connection should be dropped
+    bool malformed{false};
+};
+
+/* Finds all complete packets in a buffer in one pass instead of decoding them one by one through BinaryDecoder. Each
+ * remaining length decides where the next packet starts, so decoding it is on the critical path of the whole scan; the
+ * usual one and two byte lengths are therefore decoded without a branch. Packets are only located, never copied, so a
+ * read full of small pipelined PUBLISHes and PUBACKs is framed in a tight loop.
+ *
+ * Scanning stops at the first incomplete packet, a malformed fixed header, a packet larger than maxPacketSize or when
+ * `frames` is full; call it again with data + consumed to continue.
+ */
+class FrameScanner final {
+public:
+    explicit FrameScanner(uint32_t maxPacketSize = 268435455 + 5)
+    : mMaxPacketSize(maxPacketSize) {
+
+    }
+
+    FrameScanResult scan(const uint8_t* data, size_t length, FrameDescriptor* frames, size_t maxFrames) const {
+        FrameScanResult ret;
+        size_t offset = 0;
+        while(ret.frameCount < maxFrames && length - offset >= 2) {
+            uint8_t first = data[offset];
+            uint8_t type = first >> 4;
+            uint32_t remainingLength;
+            int varIntLength;
+            if(length - offset >= 3) {
+                // Remaining lengths of one or two bytes (packets under 16KiB) are by far the most common and which one
+                // comes next is a coin flip, so pick between them without a branch. Only longer ones take the loop.
+                uint32_t b0 = data[offset + 1];
+                uint32_t b1 = data[offset + 2];
+                if(__builtin_expect(b0 & b1 & 0x80, 0)) {
+                    varIntLength = decodeVarByteInt(data + offset + 1, length - offset - 1, remainingLength);
+                } else {
+                    uint32_t continued = b0 >> 7;
+                    remainingLength = (b0 & 0x7F) | (((b1 & 0x7F) << 7) & -continued);
+                    varIntLength = 1 + continued;
+                }
+            } else {
+                varIntLength = decodeVarByteInt(data + offset + 1, length - offset - 1, remainingLength);
+            }
+            if(type == 0 || type >= static_cast<uint8_t>(MQTTMessageType::Count) || varIntLength < 0) {
+                ret.malformed = true;
+                break;
+            }
+            if(varIntLength == 0) {
+                break;
+            }
+            uint32_t headerLength = 1 + varIntLength;
+            uint64_t frameSize = uint64_t(headerLength) + remainingLength;
+            if(frameSize > mMaxPacketSize) {
+                ret.malformed = true;
+                break;
+            }
+            if(frameSize > length - offset) {
+                break;
+            }
+            frames[ret.frameCount++] = FrameDescriptor{static_cast<uint32_t>(offset), static_cast<uint8_t>(headerLength), static_cast<MQTTMessageType>(type), static_cast<uint8_t>(first & 0x0F), remainingLength};
+            offset += frameSize;
+        }
+        ret.consumed = offset;
+        return ret;
+    }
+    template<size_t N>
+    FrameScanResult scan(const uint8_t* data, size_t length, std::array<FrameDescriptor, N>& frames) const {
+        return scan(data, length, frames.data(), N);
+    }
+    // Appends all complete packets of the buffer to `frames`.
+    FrameScanResult scan(const uint8_t* data, size_t length, std::vector<FrameDescriptor>& frames) const {
+        FrameScanResult ret;
+        std::array<FrameDescriptor, 64> chunk;
+        while(true) {
+            auto result = scan(data + ret.consumed, length - ret.consumed, chunk);
+            for(size_t i = 0; i < result.frameCount; ++i) {
+                chunk[i].offset += ret.consumed;
+            }
+            frames.insert(frames.end(), chunk.begin(), chunk.begin() + result.frameCount);
+            ret.frameCount += result.frameCount;
+            ret.consumed += result.consumed;
+            ret.malformed = result.malformed;
+            if(result.frameCount < chunk.size()) {
+                return ret;
+            }
+        }
+    }
+
+private:
+    uint64_t mMaxPacketSize;
+};
+
+}
\ No newline at end of file
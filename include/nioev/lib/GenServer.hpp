@@ -9,6 +9,8 @@
 #include <optional>
 #include <list>
 
+#include "IdleStrategy.hpp"
+
 namespace nioev::lib {
 
 enum class GenServerEnqueueResult {
@@ -54,6 +56,13 @@ public:
         return GenServerEnqueueResult::Success;
     }
 
+    // Only available if the subclass enabled an idle strategy
+    [[nodiscard]] std::optional<IdleStrategy::Stats> getIdleStats() const {
+        if(!mIdleStrategy)
+            return {};
+        return mIdleStrategy->getStats();
+    }
+
     template<typename Filter>
     void filterDelayedTasks(const Filter& filter) {
         std::unique_lock<std::recursive_mutex> lock{mTasksMutex};
@@ -70,6 +79,14 @@ protected:
     virtual bool allowEnqueue(const TaskType& task) {
         return true;
     }
+    /* Makes the worker thread spin/yield/sleep adaptively while the queue is empty instead of blocking on the condition
+     * variable right away, which cuts wake-up latency for bursty workloads at the cost of some CPU. Call this before
+     * startThread().
+     */
+    void enableIdleStrategy(IdleStrategy::Config config = {}) {
+        assert(!mWorkerThread);
+        mIdleStrategy.emplace(config);
+    }
     void startThread() {
         std::unique_lock<std::recursive_mutex> lock{ mTasksMutex };
         mWorkerThread.template emplace([this]{workerThreadFunc();});
@@ -104,14 +121,25 @@ private:
         workerThreadEnter();
         while(true) {
             if(mDelayedTasks.empty() && mTasks.empty()) {
-                mTasksCV.wait(lock);
+                if(mIdleStrategy) {
+                    mIdleStrategy->idle(lock, mTasksCV);
+                } else {
+                    mTasksCV.wait(lock);
+                }
             } else if(!mDelayedTasks.empty() && mTasks.empty()) {
-                mTasksCV.wait_until(lock, mDelayedTasks.top().when);
+                if(mIdleStrategy) {
+                    mIdleStrategy->idle(lock, mTasksCV, mDelayedTasks.top().when);
+                } else {
+                    mTasksCV.wait_until(lock, mDelayedTasks.top().when);
+                }
             }
             if(!mShouldRun) {
                 workerThreadLeave();
                 return;
             }
+            if(mIdleStrategy && !mTasks.empty()) {
+                mIdleStrategy->reset();
+            }
             while(!mTasks.empty()) {
                 auto pub = std::move(mTasks.front());
                 mTasks.erase(mTasks.begin());
@@ -139,6 +167,7 @@ private:
     std::priority_queue<DelayedTaskType> mDelayedTasks;
     std::string mThreadName;
     std::optional<std::thread> mWorkerThread;
+    std::optional<IdleStrategy> mIdleStrategy;
 };
 
 }
\ No newline at end of file
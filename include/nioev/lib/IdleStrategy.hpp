@@ -0,0 +1,190 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "Enums.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace nioev::lib {
+
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/* Decides what a worker thread does when it found no work. It starts out spinning and escalates through the
+ * WorkerThreadSleepLevels the longer it stays idle, and drops back to spinning as soon as work arrives. This trades a
+ * bit of CPU right after a burst for low wake-up latency, while still going to sleep properly when there is nothing
+ * to do for a while.
+ *
+ * Usage in an event loop:
+ *
+ *     while(running) {
+ *         idle.idle(pollOnce());
+ *     }
+ *
+ * Only the owning thread calls idle()/reset(), the stats may be read from any thread.
+ */
+class IdleStrategy final {
+public:
+    struct Config {
+        // number of consecutive empty polls spent on each stage before escalating to the next one
+        uint32_t spinPolls = 1000;
+        uint32_t yieldPolls = 200;
+        uint32_t microsecondsPolls = 200;
+        uint32_t millisecondsPolls = 100;
+        std::chrono::microseconds microsecondsSleep{50};
+        std::chrono::microseconds millisecondsSleep{1000};
+        std::chrono::microseconds tensOfMillisecondsSleep{10000};
+    };
+    struct Stats {
+        // time spent idling and number of idle calls per stage; spinning comes first, then one entry per WorkerThreadSleepLevel
+        std::array<uint64_t, static_cast<int>(WorkerThreadSleepLevel::$COUNT) + 1> nanoseconds{};
+        std::array<uint64_t, static_cast<int>(WorkerThreadSleepLevel::$COUNT) + 1> calls{};
+        uint64_t wakeups{0};
+    };
+    static constexpr int SPIN_STAGE = 0;
+    static constexpr int YIELD_STAGE = static_cast<int>(WorkerThreadSleepLevel::YIELD) + 1;
+
+    IdleStrategy() = default;
+    explicit IdleStrategy(Config config)
+    : mConfig(config) {
+
+    }
+    IdleStrategy(const IdleStrategy&) = delete;
+    void operator=(const IdleStrategy&) = delete;
+
+    // Convenience for poll loops: resets if work was done, idles otherwise.
+    void idle(bool didWork) {
+        if(didWork) {
+            reset();
+        } else {
+            idle();
+        }
+    }
+    // Called after an empty poll, performs the idle action of the current stage.
+    void idle() {
+        auto stage = currentStage();
+        auto start = std::chrono::steady_clock::now();
+        switch(stage) {
+        case SPIN_STAGE:
+            cpuRelax();
+            break;
+        case YIELD_STAGE:
+            std::this_thread::yield();
+            break;
+        default:
+            std::this_thread::sleep_for(sleepDurationOf(stage));
+            break;
+        }
+        account(stage, start);
+    }
+    /* Variant for loops that wait on a condition variable, like GenServer. Spinning and yielding happen with the lock
+     * released; the sleeping stages wait on the condition variable, so a notify still wakes the thread immediately.
+     * Never sleeps past the deadline.
+     */
+    template<typename Lock, typename ConditionVariable>
+    void idle(Lock& lock, ConditionVariable& cv, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) {
+        auto stage = currentStage();
+        auto start = std::chrono::steady_clock::now();
+        switch(stage) {
+        case SPIN_STAGE:
+            lock.unlock();
+            cpuRelax();
+            lock.lock();
+            break;
+        case YIELD_STAGE:
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+            break;
+        default: {
+            auto until = start + sleepDurationOf(stage);
+            cv.wait_until(lock, deadline < until ? deadline : until);
+            break;
+        }
+        }
+        account(stage, start);
+    }
+    // Called when work arrived, drops back to spinning.
+    void reset() {
+        if(mEmptyPolls != 0) {
+            mEmptyPolls = 0;
+            mWakeups.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // The stage the next idle() call will use, -1 for spinning.
+    [[nodiscard]] int currentSleepLevel() const {
+        return currentStage() - 1;
+    }
+    [[nodiscard]] Stats getStats() const {
+        Stats ret;
+        for(size_t i = 0; i < ret.nanoseconds.size(); ++i) {
+            ret.nanoseconds[i] = mNanoseconds[i].load(std::memory_order_relaxed);
+            ret.calls[i] = mCalls[i].load(std::memory_order_relaxed);
+        }
+        ret.wakeups = mWakeups.load(std::memory_order_relaxed);
+        return ret;
+    }
+    static const char* stageToString(int stage) {
+        if(stage == SPIN_STAGE)
+            return "spin";
+        return workerThreadSleepLevelToString(static_cast<WorkerThreadSleepLevel>(stage - 1));
+    }
+
+private:
+    static constexpr int stageOf(WorkerThreadSleepLevel level) {
+        return static_cast<int>(level) + 1;
+    }
+    int currentStage() const {
+        auto polls = mEmptyPolls;
+        if(polls < mConfig.spinPolls)
+            return SPIN_STAGE;
+        polls -= mConfig.spinPolls;
+        if(polls < mConfig.yieldPolls)
+            return YIELD_STAGE;
+        polls -= mConfig.yieldPolls;
+        if(polls < mConfig.microsecondsPolls)
+            return stageOf(WorkerThreadSleepLevel::MICROSECONDS);
+        polls -= mConfig.microsecondsPolls;
+        if(polls < mConfig.millisecondsPolls)
+            return stageOf(WorkerThreadSleepLevel::MILLISECONDS);
+        return stageOf(WorkerThreadSleepLevel::TENS_OF_MILLISECONDS);
+    }
+    std::chrono::microseconds sleepDurationOf(int stage) const {
+        switch(static_cast<WorkerThreadSleepLevel>(stage - 1)) {
+        case WorkerThreadSleepLevel::MICROSECONDS:
+            return mConfig.microsecondsSleep;
+        case WorkerThreadSleepLevel::MILLISECONDS:
+            return mConfig.millisecondsSleep;
+        default:
+            return mConfig.tensOfMillisecondsSleep;
+        }
+    }
+    void account(int stage, std::chrono::steady_clock::time_point start) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        mNanoseconds[stage].fetch_add(elapsed, std::memory_order_relaxed);
+        mCalls[stage].fetch_add(1, std::memory_order_relaxed);
+        // saturate instead of wrapping around back to spinning
+        if(mEmptyPolls != UINT32_MAX)
+            mEmptyPolls += 1;
+    }
+
+    Config mConfig;
+    uint32_t mEmptyPolls{0};
+    std::array<std::atomic<uint64_t>, static_cast<int>(WorkerThreadSleepLevel::$COUNT) + 1> mNanoseconds{};
+    std::array<std::atomic<uint64_t>, static_cast<int>(WorkerThreadSleepLevel::$COUNT) + 1> mCalls{};
+    std::atomic<uint64_t> mWakeups{0};
+};
+
+}
\ No newline at end of file
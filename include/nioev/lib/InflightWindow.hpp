@@ -0,0 +1,288 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "Enums.hpp"
+#include "PacketIdAllocator.hpp"
+
+namespace nioev::lib {
+
+enum class InflightState : uint8_t
+{
+    // QoS 1, PUBLISH sent
+    AWAITING_PUBACK,
+    // QoS 2, PUBLISH sent
+    AWAITING_PUBREC,
+    // QoS 2, PUBREC received and PUBREL sent
+    AWAITING_PUBCOMP
+};
+
+static inline const char* inflightStateToString(InflightState state) {
+    switch(state) {
+    case InflightState::AWAITING_PUBACK:
+        return "awaiting_puback";
+    case InflightState::AWAITING_PUBREC:
+        return "awaiting_pubrec";
+    case InflightState::AWAITING_PUBCOMP:
+        return "awaiting_pubcomp";
+    }
+    return "<unknown>";
+}
+
+/* The outgoing QoS 1 and 2 messages of a session that haven't been acknowledged yet, at most RECEIVE_MAXIMUM of them.
+ * T is whatever is needed to send a message again, typically the encoded packet as a SharedBuffer.
+ *
+ * Entries live in a slab indexed by slot number and are found by packet id through a small open addressing table
+ * that grows with the number of messages in flight, not with the receive maximum. Since every message gets the same
+ * retransmission timeout, deadlines are ordered by when they were set, so a FIFO through the entries (intrusive, by
+ * slot number) is all the timer structure needed: acks unlink in O(1) and retransmitExpired() only looks at expired
+ * entries at its head.
+ */
+template<typename T>
+class InflightWindow final {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    InflightWindow(uint16_t receiveMaximum, Clock::duration retransmitAfter)
+    : mReceiveMaximum(receiveMaximum), mRetransmitAfter(retransmitAfter), mIndex(16, EMPTY) {
+
+    }
+
+    [[nodiscard]] bool hasCapacity() const {
+        return mCount < mReceiveMaximum;
+    }
+    [[nodiscard]] size_t size() const {
+        return mCount;
+    }
+
+    // Tracks a QoS 1 or 2 message. Returns its packet id, or nullopt if the window is full and it has to be queued.
+    std::optional<uint16_t> send(QoS qos, T message, Clock::time_point now) {
+        if(!hasCapacity()) {
+            return {};
+        }
+        auto id = mIds.allocate();
+        if(!id) {
+            return {};
+        }
+        insert(*id, qos == QoS::QoS2 ? InflightState::AWAITING_PUBREC : InflightState::AWAITING_PUBACK, std::move(message), now);
+        return id;
+    }
+    // Restores a message of a persisted session under its previous packet id; false if the id is taken or it's full.
+    bool restore(uint16_t id, InflightState state, T message, Clock::time_point now) {
+        if(!hasCapacity() || !mIds.reserve(id)) {
+            return false;
+        }
+        insert(id, state, std::move(message), now);
+        return true;
+    }
+
+    // Returns the message if the id belonged to a QoS 1 message, which is then done.
+    std::optional<T> onPubAck(uint16_t id) {
+        return removeIf(id, InflightState::AWAITING_PUBACK);
+    }
+    /* For QoS 2: returns true if the id was awaiting a PUBREC, in which case the caller sends PUBREL and the message
+     * itself is no longer needed for retransmission (only PUBREL is resent from now on).
+     */
+    bool onPubRec(uint16_t id, Clock::time_point now) {
+        auto slot = find(id);
+        if(slot == EMPTY || mEntries[slot].state != InflightState::AWAITING_PUBREC) {
+            return false;
+        }
+        auto& entry = mEntries[slot];
+        entry.state = InflightState::AWAITING_PUBCOMP;
+        entry.message = T{};
+        entry.attempts = 0;
+        unlinkDeadline(slot);
+        entry.deadline = now + mRetransmitAfter;
+        appendDeadline(slot);
+        return true;
+    }
+    // Returns true if the id was awaiting a PUBCOMP; the QoS 2 flow is then complete.
+    bool onPubComp(uint16_t id) {
+        return removeIf(id, InflightState::AWAITING_PUBCOMP).has_value();
+    }
+    // Drops a message regardless of its state, e.g. after a PUBACK or PUBREC with an error reason code.
+    std::optional<T> remove(uint16_t id) {
+        auto slot = find(id);
+        if(slot == EMPTY) {
+            return {};
+        }
+        return erase(slot);
+    }
+
+    [[nodiscard]] std::optional<Clock::time_point> nextDeadline() const {
+        if(mDeadlineHead == NONE) {
+            return {};
+        }
+        return mEntries[mDeadlineHead].deadline;
+    }
+    /* Calls callback(uint16_t packetId, InflightState state, const T& message, uint attempts) for every entry whose
+     * deadline passed, oldest first, and gives it a new deadline. For AWAITING_PUBCOMP the message is empty and PUBREL
+     * should be sent instead. The callback must not modify the window. Returns how many were due.
+     */
+    template<typename Callback>
+    size_t retransmitExpired(Clock::time_point now, Callback&& callback) {
+        size_t ret = 0;
+        // bounded, so that a zero timeout doesn't resend the same entries forever
+        while(ret < mCount && mEntries[mDeadlineHead].deadline <= now) {
+            auto slot = mDeadlineHead;
+            auto& entry = mEntries[slot];
+            if(entry.attempts < UINT8_MAX)
+                entry.attempts += 1;
+            unlinkDeadline(slot);
+            entry.deadline = now + mRetransmitAfter;
+            appendDeadline(slot);
+            callback(entry.packetId, entry.state, entry.message, static_cast<uint>(entry.attempts));
+            ret += 1;
+        }
+        return ret;
+    }
+    // In the order they were (re)sent, e.g. to resend everything with DUP set when a session is resumed.
+    template<typename Callback>
+    void forEach(Callback&& callback) const {
+        for(auto slot = mDeadlineHead; slot != NONE; slot = mEntries[slot].next) {
+            const auto& entry = mEntries[slot];
+            callback(entry.packetId, entry.state, entry.message);
+        }
+    }
+
+private:
+    static constexpr uint16_t NONE = UINT16_MAX;
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    struct Entry {
+        Clock::time_point deadline;
+        T message;
+        uint16_t packetId{0};
+        // neighbours in the deadline FIFO
+        uint16_t prev{NONE};
+        uint16_t next{NONE};
+        InflightState state{InflightState::AWAITING_PUBACK};
+        uint8_t attempts{0};
+    };
+
+    void insert(uint16_t id, InflightState state, T&& message, Clock::time_point now) {
+        uint16_t slot;
+        if(!mFreeSlots.empty()) {
+            slot = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        } else {
+            slot = mEntries.size();
+            mEntries.emplace_back();
+        }
+        auto& entry = mEntries[slot];
+        entry.packetId = id;
+        entry.state = state;
+        entry.message = std::move(message);
+        entry.attempts = 0;
+        entry.deadline = now + mRetransmitAfter;
+        appendDeadline(slot);
+        mCount += 1;
+        if(mCount * 2 > mIndex.size()) {
+            growIndex();
+        }
+        indexInsert(id, slot);
+    }
+    std::optional<T> removeIf(uint16_t id, InflightState state) {
+        auto slot = find(id);
+        if(slot == EMPTY || mEntries[slot].state != state) {
+            return {};
+        }
+        return erase(slot);
+    }
+    T erase(uint32_t slot) {
+        auto& entry = mEntries[slot];
+        indexErase(entry.packetId);
+        unlinkDeadline(slot);
+        mIds.release(entry.packetId);
+        mFreeSlots.push_back(slot);
+        mCount -= 1;
+        return std::move(entry.message);
+    }
+
+    void appendDeadline(uint16_t slot) {
+        auto& entry = mEntries[slot];
+        entry.prev = mDeadlineTail;
+        entry.next = NONE;
+        if(mDeadlineTail != NONE) {
+            mEntries[mDeadlineTail].next = slot;
+        } else {
+            mDeadlineHead = slot;
+        }
+        mDeadlineTail = slot;
+    }
+    void unlinkDeadline(uint16_t slot) {
+        auto& entry = mEntries[slot];
+        if(entry.prev != NONE) {
+            mEntries[entry.prev].next = entry.next;
+        } else {
+            mDeadlineHead = entry.next;
+        }
+        if(entry.next != NONE) {
+            mEntries[entry.next].prev = entry.prev;
+        } else {
+            mDeadlineTail = entry.prev;
+        }
+        entry.prev = entry.next = NONE;
+    }
+
+    // Linear probing over slot numbers, keyed by packet id. Ids are handed out round robin, so the id itself is hash
+    // enough; deletion shifts entries back instead of leaving tombstones.
+    uint32_t find(uint16_t id) const {
+        auto mask = mIndex.size() - 1;
+        for(size_t i = id & mask;; i = (i + 1) & mask) {
+            auto slot = mIndex[i];
+            if(slot == EMPTY || mEntries[slot].packetId == id) {
+                return slot;
+            }
+        }
+    }
+    void indexInsert(uint16_t id, uint32_t slot) {
+        auto mask = mIndex.size() - 1;
+        size_t i = id & mask;
+        while(mIndex[i] != EMPTY) {
+            i = (i + 1) & mask;
+        }
+        mIndex[i] = slot;
+    }
+    void indexErase(uint16_t id) {
+        auto mask = mIndex.size() - 1;
+        size_t i = id & mask;
+        while(mEntries[mIndex[i]].packetId != id) {
+            i = (i + 1) & mask;
+        }
+        for(size_t j = (i + 1) & mask; mIndex[j] != EMPTY; j = (j + 1) & mask) {
+            // move an entry back into the hole unless its home position lies cyclically in (i, j]
+            size_t home = mEntries[mIndex[j]].packetId & mask;
+            if(((j - home) & mask) >= ((j - i) & mask)) {
+                mIndex[i] = mIndex[j];
+                i = j;
+            }
+        }
+        mIndex[i] = EMPTY;
+    }
+    void growIndex() {
+        std::vector<uint32_t> old(mIndex.size() * 2, EMPTY);
+        old.swap(mIndex);
+        for(auto slot: old) {
+            if(slot != EMPTY) {
+                indexInsert(mEntries[slot].packetId, slot);
+            }
+        }
+    }
+
+    uint16_t mReceiveMaximum;
+    Clock::duration mRetransmitAfter;
+    PacketIdAllocator mIds;
+    std::vector<Entry> mEntries;
+    std::vector<uint16_t> mFreeSlots;
+    std::vector<uint32_t> mIndex;
+    uint16_t mDeadlineHead{NONE};
+    uint16_t mDeadlineTail{NONE};
+    uint32_t mCount{0};
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Timers.hpp"
+#include "Util.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace nioev::lib {
+
+/* Cheapest monotonic timestamp we can get. On x86 this is the TSC, which we assume to be invariant (constant_tsc and
+ * nonstop_tsc, true for every server CPU of the last decade). Ticks are converted to nanoseconds only when exporting.
+ */
+static inline uint64_t readLatencyTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/* Log-linear histogram in the style of HdrHistogram: every power of two is split into 16 linear sub buckets, which
+ * bounds the relative error to 1/16 over the whole 64 bit range in under 8KiB. It has exactly one writer, the owning
+ * thread, so recording is a couple of relaxed loads and stores and readers on other threads never block it.
+ */
+class LatencyHistogram final {
+public:
+    static constexpr uint SUB_BUCKET_BITS = 4;
+    static constexpr uint SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static constexpr uint BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    struct Snapshot {
+        std::array<uint64_t, BUCKET_COUNT> buckets{};
+        uint64_t count{0};
+        uint64_t sum{0};
+        uint64_t min{UINT64_MAX};
+        uint64_t max{0};
+
+        void merge(const Snapshot& other);
+        // value below which the given fraction (0 to 1) of the recorded values lie, in ticks
+        [[nodiscard]] uint64_t percentile(double fraction) const;
+    };
+
+    static constexpr uint bucketIndexOf(uint64_t value) {
+        if(value < SUB_BUCKETS)
+            return value;
+        uint msb = 63 - __builtin_clzll(value);
+        uint shift = msb - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+    }
+    static constexpr uint64_t bucketLowerBound(uint index) {
+        uint group = index / SUB_BUCKETS;
+        uint64_t sub = index % SUB_BUCKETS;
+        if(group == 0)
+            return sub;
+        return (SUB_BUCKETS + sub) << (group - 1);
+    }
+
+    void record(uint64_t ticks) {
+        increment(mBuckets[bucketIndexOf(ticks)], 1);
+        increment(mCount, 1);
+        increment(mSum, ticks);
+        if(ticks < mMin.load(std::memory_order_relaxed))
+            mMin.store(ticks, std::memory_order_relaxed);
+        if(ticks > mMax.load(std::memory_order_relaxed))
+            mMax.store(ticks, std::memory_order_relaxed);
+    }
+    [[nodiscard]] Snapshot snapshot() const;
+
+private:
+    static void increment(std::atomic<uint64_t>& counter, uint64_t by) {
+        // single writer, so no need for an atomic read-modify-write
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> mBuckets{};
+    std::atomic<uint64_t> mCount{0};
+    std::atomic<uint64_t> mSum{0};
+    std::atomic<uint64_t> mMin{UINT64_MAX};
+    std::atomic<uint64_t> mMax{0};
+};
+
+enum class LatencyExportFormat
+{
+    JSON,
+    BINARY
+};
+
+/* Process wide collection of latency histograms, one per scope and thread. Scopes are registered once per call site
+ * (see NIOEV_LATENCY_SCOPE), every thread lazily gets its own histogram per scope and snapshot() merges them on demand.
+ * Histograms of threads that exited are kept, so their samples aren't lost.
+ */
+class LatencyRegistry final {
+public:
+    static constexpr uint32_t MAX_SCOPES = 256;
+
+    struct ScopeSnapshot {
+        std::string name;
+        LatencyHistogram::Snapshot histogram;
+    };
+
+    static LatencyRegistry& instance();
+
+    // returns the id for the name, registering it if it's new; throws when running out of scope slots
+    uint32_t registerScope(const char* name);
+    void record(uint32_t scopeId, uint64_t ticks) {
+        auto threadHistograms = tThreadHistograms;
+        if(!threadHistograms) {
+            threadHistograms = registerThread();
+        }
+        auto histogram = threadHistograms->histograms[scopeId].load(std::memory_order_acquire);
+        if(!histogram) {
+            histogram = createHistogram(*threadHistograms, scopeId);
+        }
+        histogram->record(ticks);
+    }
+
+    // cumulative since start, diff two snapshots to get the values of an interval
+    [[nodiscard]] std::vector<ScopeSnapshot> snapshot() const;
+    [[nodiscard]] double nanosecondsPerTick() const;
+
+    /* {"scopes":[{"name":"route","count":12,"min":80,"mean":210.5,"p50":190,"p90":320,"p99":640,"p999":1280,"max":1311}]}
+     * All durations are in nanoseconds.
+     */
+    [[nodiscard]] std::string exportJson() const;
+    /* Version byte (1), picoseconds per tick (4 bytes), scope count (4 bytes), then per scope: name (string), count,
+     * sum, min, max in ticks (8 bytes each), number of non-empty buckets (2 bytes) and for each of those the bucket
+     * index (2 bytes) and its count (8 bytes). Bucket bounds are given by LatencyHistogram::bucketLowerBound().
+     */
+    [[nodiscard]] SharedBuffer exportBinary() const;
+
+    // Publishes a snapshot to LATENCY_TOPIC at the given interval using the timers thread.
+    void publishPeriodically(Timers& timers, std::chrono::steady_clock::duration every, LatencyExportFormat format, std::function<void(const char* topic, SharedBuffer&& payload)> publish);
+
+private:
+    struct ThreadHistograms {
+        std::array<std::atomic<LatencyHistogram*>, MAX_SCOPES> histograms{};
+        std::array<std::unique_ptr<LatencyHistogram>, MAX_SCOPES> storage;
+    };
+    LatencyRegistry();
+    ThreadHistograms* registerThread();
+    LatencyHistogram* createHistogram(ThreadHistograms& threadHistograms, uint32_t scopeId);
+
+    static thread_local ThreadHistograms* tThreadHistograms;
+
+    mutable std::mutex mMutex;
+    std::vector<std::string> mScopeNames;
+    std::vector<std::unique_ptr<ThreadHistograms>> mThreads;
+    uint64_t mStartTicks;
+    std::chrono::steady_clock::time_point mStartTime;
+};
+
+// A named call site, registered once. Usually created through NIOEV_LATENCY_SCOPE.
+class LatencyScope final {
+public:
+    explicit LatencyScope(const char* name)
+    : mId(LatencyRegistry::instance().registerScope(name)) {
+
+    }
+    void record(uint64_t ticks) const {
+        LatencyRegistry::instance().record(mId, ticks);
+    }
+
+private:
+    uint32_t mId;
+};
+
+// Records the time between construction and destruction into the given scope.
+class ScopedLatency final {
+public:
+    explicit ScopedLatency(const LatencyScope& scope)
+    : mScope(scope), mStart(readLatencyTicks()) {
+
+    }
+    ~ScopedLatency() {
+        mScope.record(readLatencyTicks() - mStart);
+    }
+    ScopedLatency(const ScopedLatency&) = delete;
+    void operator=(const ScopedLatency&) = delete;
+    ScopedLatency(ScopedLatency&&) = delete;
+    void operator=(ScopedLatency&&) = delete;
+
+private:
+    const LatencyScope& mScope;
+    uint64_t mStart;
+};
+
+}
+
+#define NIOEV_LATENCY_CONCAT_INNER(a, b) a##b
+#define NIOEV_LATENCY_CONCAT(a, b) NIOEV_LATENCY_CONCAT_INNER(a, b)
+// Measures the rest of the enclosing block: NIOEV_LATENCY_SCOPE("subscriptions.match");
+#define NIOEV_LATENCY_SCOPE(name)                                                                                                \
+    static const ::nioev::lib::LatencyScope NIOEV_LATENCY_CONCAT(nioevLatencyScope, __LINE__){name};                             \
+    const ::nioev::lib::ScopedLatency NIOEV_LATENCY_CONCAT(nioevScopedLatency, __LINE__){NIOEV_LATENCY_CONCAT(nioevLatencyScope, __LINE__)}
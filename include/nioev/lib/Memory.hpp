@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+namespace nioev::lib {
+
+struct AllocationStats {
+    uint64_t allocations{0};
+    uint64_t deallocations{0};
+    uint64_t bytesAllocated{0};
+    uint64_t bytesDeallocated{0};
+
+    [[nodiscard]] uint64_t bytesInUse() const {
+        return bytesAllocated - bytesDeallocated;
+    }
+};
+
+// Forwards to an upstream resource and counts what passes through. Thread safe.
+class CountingResource final : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+    : mUpstream(upstream) {
+
+    }
+    [[nodiscard]] AllocationStats getStats() const;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* mUpstream;
+    std::atomic<uint64_t> mAllocations{0};
+    std::atomic<uint64_t> mDeallocations{0};
+    std::atomic<uint64_t> mBytesAllocated{0};
+    std::atomic<uint64_t> mBytesDeallocated{0};
+};
+
+// The heap as seen by the pools and arenas below, so their stats show how often they actually had to go there.
+CountingResource& heapResource();
+
+/* Size class pools of the calling thread (std::pmr::unsynchronized_pool_resource on top of heapResource()). No locking
+ * at all, so memory from it must be freed on the same thread and must not outlive the thread. Good for anything that
+ * is created and destroyed while handling a request on one worker.
+ */
+std::pmr::memory_resource* threadPoolResource();
+// what the calling thread allocated from its pools
+AllocationStats threadPoolStats();
+
+/* Monotonic arena for everything that lives exactly as long as one packet: decoding, routing and encoding allocate
+ * by bumping a pointer, freeing is a no-op and reset() drops all of it at once. The first InlineSize bytes come from
+ * the arena itself, only bigger packets take further chunks from the upstream resource. Not thread safe.
+ *
+ *     PacketArena<> arena;
+ *     pmr::MQTTPacket packet{arena.allocator()};
+ *     ...
+ *     arena.reset();
+ */
+template<size_t InlineSize = 4096>
+class PacketArena final : public std::pmr::memory_resource {
+public:
+    explicit PacketArena(std::pmr::memory_resource* upstream = threadPoolResource())
+    : mMonotonic(mBuffer, InlineSize, upstream) {
+
+    }
+    PacketArena(const PacketArena&) = delete;
+    void operator=(const PacketArena&) = delete;
+
+    template<typename T = char>
+    std::pmr::polymorphic_allocator<T> allocator() {
+        return std::pmr::polymorphic_allocator<T>{this};
+    }
+    // frees everything allocated since the last reset; nothing allocated from the arena may be used afterwards
+    void reset() {
+        mMonotonic.release();
+    }
+    // cumulative over all resets
+    [[nodiscard]] const AllocationStats& getStats() const {
+        return mStats;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        mStats.allocations += 1;
+        mStats.bytesAllocated += bytes;
+        return mMonotonic.allocate(bytes, alignment);
+    }
+    void do_deallocate(void*, size_t bytes, size_t) override {
+        mStats.deallocations += 1;
+        mStats.bytesDeallocated += bytes;
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    alignas(std::max_align_t) std::byte mBuffer[InlineSize];
+    std::pmr::monotonic_buffer_resource mMonotonic;
+    AllocationStats mStats;
+};
+
+}
\ No newline at end of file
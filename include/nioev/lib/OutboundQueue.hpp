@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Delivery.hpp"
+
+namespace nioev::lib {
+
+enum class OutboundDropPolicy : uint8_t
+{
+    // a message that doesn't fit is rejected, the queue stays as it is
+    DROP_NEW,
+    // the oldest messages of any QoS are dropped until the new one fits
+    DROP_OLDEST,
+    // the oldest QoS 0 messages are dropped until the new one fits; if that isn't enough, the new message is rejected
+    DROP_OLDEST_QOS0
+};
+
+enum class OutboundPushResult : uint8_t
+{
+    QUEUED,
+    // queued and replaced an older QoS 0 message of the same topic
+    CONFLATED,
+    DROPPED
+};
+
+/* Messages waiting to be sent to one subscriber, bounded in count and bytes. With conflation enabled, a QoS 0 message
+ * replaces any QoS 0 message of the same topic that is still queued, so a slow client only gets the newest value of
+ * each topic instead of a backlog of stale ones. The replaced message is removed and the new one appended, so the
+ * queue is always in publish order; QoS 1 and 2 messages are never conflated.
+ *
+ * Entries live in a slab indexed by slot number and are linked into the queue order and, for QoS 0, into a second
+ * FIFO (for DROP_OLDEST_QOS0) and a hash chain by topic (for conflation). Slots are reused, so once the slab reached
+ * its high water mark, which is at most maxMessages, pushing and popping don't allocate.
+ */
+class OutboundQueue final {
+public:
+    struct Config {
+        size_t maxMessages = 1000;
+        // topic and payload sizes of all queued messages
+        size_t maxBytes = 1024 * 1024;
+        bool conflateQoS0 = true;
+        OutboundDropPolicy dropPolicy = OutboundDropPolicy::DROP_OLDEST_QOS0;
+    };
+    struct Stats {
+        uint64_t queued{0};
+        uint64_t conflated{0};
+        // rejected on push
+        uint64_t droppedNew{0};
+        // evicted to make room
+        uint64_t droppedOld{0};
+        uint64_t popped{0};
+    };
+
+    explicit OutboundQueue(Config config);
+
+    // Messages without a topic are rejected. A rejected message never conflates away the one it would have replaced.
+    OutboundPushResult push(DeliveryMessage message);
+    // pushes every message of the batch, e.g. from a BatchSubscriber::deliver()
+    void push(const DeliveryBatch& batch) {
+        for(auto& message: batch) {
+            push(message);
+        }
+    }
+    // front() and pop() must not be called on an empty queue
+    [[nodiscard]] const DeliveryMessage& front() const {
+        return mEntries[mHead].message;
+    }
+    DeliveryMessage pop();
+    /* Calls callback(const DeliveryMessage&) for up to `max` messages from the front, stopping early if it returns
+     * false; the message it returned false for stays queued. Returns how many were removed.
+     */
+    template<typename Callback>
+    size_t drain(size_t max, Callback&& callback) {
+        size_t ret = 0;
+        while(ret < max && mHead != NONE) {
+            if(!callback(std::as_const(mEntries[mHead].message))) {
+                break;
+            }
+            erase(mHead);
+            mStats.popped += 1;
+            ret += 1;
+        }
+        return ret;
+    }
+    void clear();
+
+    [[nodiscard]] bool empty() const {
+        return mCount == 0;
+    }
+    [[nodiscard]] size_t size() const {
+        return mCount;
+    }
+    [[nodiscard]] size_t bytes() const {
+        return mBytes;
+    }
+    [[nodiscard]] const Stats& getStats() const {
+        return mStats;
+    }
+
+    static size_t messageBytes(const DeliveryMessage& message) {
+        return (message.topic ? message.topic->size() : 0) + message.payload.size();
+    }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Entry {
+        DeliveryMessage message;
+        size_t hash{0};
+        // neighbours in the queue
+        uint32_t prev{NONE};
+        uint32_t next{NONE};
+        // neighbours in the QoS 0 FIFO
+        uint32_t prevQoS0{NONE};
+        uint32_t nextQoS0{NONE};
+        // next entry in the same topic bucket
+        uint32_t nextInBucket{NONE};
+    };
+
+    uint32_t findQoS0(std::string_view topic, size_t hash) const;
+    DeliveryMessage erase(uint32_t slot);
+    void bucketInsert(uint32_t slot);
+    void bucketErase(uint32_t slot);
+    void growBuckets();
+
+    Config mConfig;
+    std::vector<Entry> mEntries;
+    std::vector<uint32_t> mFreeSlots;
+    // heads of the topic hash chains of QoS 0 entries, grows with the number of those
+    std::vector<uint32_t> mBuckets;
+    uint32_t mHead{NONE}, mTail{NONE};
+    uint32_t mHeadQoS0{NONE}, mTailQoS0{NONE};
+    size_t mCount{0};
+    size_t mCountQoS0{0};
+    size_t mBytes{0};
+    Stats mStats;
+};
+
+}
\ No newline at end of file
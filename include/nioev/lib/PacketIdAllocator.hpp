@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+namespace nioev::lib {
+
+/* Packet ids 1 to 65535 of one session, allocated in O(1) from a three level bitmap of free ids: 1024 words with one
+ * bit per id, 16 words with one bit per non-full word below and a single word with one bit per non-full word of the
+ * middle level. Finding the next free id is at most a handful of masked ctz instructions.
+ *
+ * Ids are handed out round robin from a cursor instead of lowest first, so a just released id isn't reused right away
+ * and a late ack from a previous use can't be mistaken for an ack of the new one.
+ */
+class PacketIdAllocator final {
+public:
+    PacketIdAllocator() {
+        mFree.fill(~uint64_t(0));
+        mFreeWords.fill(~uint64_t(0));
+        mFreeGroups = 0xFFFF;
+        // 0 is not a valid packet id
+        markUsed(0);
+    }
+
+    // nullopt if all 65535 ids are in use
+    std::optional<uint16_t> allocate() {
+        auto id = findFree(mCursor);
+        if(!id) {
+            id = findFree(0);
+            if(!id) {
+                return {};
+            }
+        }
+        markUsed(*id);
+        mCursor = *id + 1;
+        return static_cast<uint16_t>(*id);
+    }
+    // Takes a specific id, e.g. one restored with a persisted session. Returns false if it's already in use.
+    bool reserve(uint16_t id) {
+        if(id == 0 || isAllocated(id)) {
+            return false;
+        }
+        markUsed(id);
+        return true;
+    }
+    void release(uint16_t id) {
+        if(id == 0 || !isAllocated(id)) {
+            return;
+        }
+        mFree[id >> 6] |= uint64_t(1) << (id & 63);
+        mFreeWords[id >> 12] |= uint64_t(1) << ((id >> 6) & 63);
+        mFreeGroups |= 1u << (id >> 12);
+        mAllocated -= 1;
+    }
+    [[nodiscard]] bool isAllocated(uint16_t id) const {
+        return (mFree[id >> 6] & (uint64_t(1) << (id & 63))) == 0;
+    }
+    // not counting the reserved id 0
+    [[nodiscard]] uint32_t allocatedCount() const {
+        return mAllocated - 1;
+    }
+
+private:
+    void markUsed(uint32_t id) {
+        auto& word = mFree[id >> 6];
+        word &= ~(uint64_t(1) << (id & 63));
+        if(word == 0) {
+            auto& group = mFreeWords[id >> 12];
+            group &= ~(uint64_t(1) << ((id >> 6) & 63));
+            if(group == 0) {
+                mFreeGroups &= ~(1u << (id >> 12));
+            }
+        }
+        mAllocated += 1;
+    }
+    // lowest free id >= start, if any
+    std::optional<uint32_t> findFree(uint32_t start) const {
+        if(start > 0xFFFF) {
+            return {};
+        }
+        uint32_t wordIndex = start >> 6;
+        uint64_t word = mFree[wordIndex] & (~uint64_t(0) << (start & 63));
+        if(word) {
+            return (wordIndex << 6) | __builtin_ctzll(word);
+        }
+        // the rest of this group of 64 words
+        uint32_t groupIndex = wordIndex >> 6;
+        uint32_t nextWord = (wordIndex & 63) + 1;
+        uint64_t group = nextWord < 64 ? mFreeWords[groupIndex] & (~uint64_t(0) << nextWord) : 0;
+        if(!group) {
+            // the following groups
+            uint32_t groups = groupIndex + 1 < 16 ? mFreeGroups & (0xFFFFu << (groupIndex + 1)) : 0;
+            if(!groups) {
+                return {};
+            }
+            groupIndex = __builtin_ctz(groups);
+            group = mFreeWords[groupIndex];
+        }
+        wordIndex = (groupIndex << 6) | __builtin_ctzll(group);
+        return (wordIndex << 6) | __builtin_ctzll(mFree[wordIndex]);
+    }
+
+    std::array<uint64_t, 1024> mFree;
+    std::array<uint64_t, 16> mFreeWords;
+    uint32_t mFreeGroups;
+    uint32_t mCursor{1};
+    uint32_t mAllocated{0};
+};
+
+}
\ No newline at end of file
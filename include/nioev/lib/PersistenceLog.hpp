@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "InflightWindow.hpp"
+#include "SubscriptionTree.hpp"
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+// CRC-32C (Castagnoli), using the SSE 4.2 instruction where the CPU has it.
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+
+enum class PersistRecordType : uint8_t
+{
+    SUBSCRIBE = 1,
+    UNSUBSCRIBE = 2,
+    // removes all subscriptions and inflight messages of the client
+    SESSION_DELETE = 3,
+    // an empty payload deletes the retained message
+    RETAIN = 4,
+    INFLIGHT = 5,
+    INFLIGHT_DONE = 6
+};
+
+// A record as replayed: all views point straight into the mapped segment and are valid as long as the replay is pinned.
+struct PersistRecord {
+    PersistRecordType type;
+    QoS qos;
+    InflightState inflightState;
+    uint16_t packetId;
+    std::string_view clientId;
+    // filter for (UN)SUBSCRIBE, topic for RETAIN and INFLIGHT
+    std::string_view topic;
+    std::string_view payload;
+};
+
+/* Append-only log of the state that has to survive a restart: subscriptions of persistent sessions, retained messages
+ * and outgoing QoS 1/2 messages in flight. Recovery maps the segments and replays the records as views into them, so a
+ * restart doesn't parse anything into intermediate strings and vectors.
+ *
+ * The log is a directory of segment files (segment-<sequence>.log), each preallocated and memory mapped; appending is
+ * a memcpy under a lock. A record is
+ *
+ *     crc32c(4) size(4) type(1) qos(1) inflightState(1) reserved(1) packetId(2) clientIdLength(2) topicLength(2)
+ *     reserved(2) payloadLength(4) clientId topic payload, padded to 8 bytes
+ *
+ * in native (little endian) byte order, with the CRC over everything after it. Replay of a segment stops at the first
+ * zero size or bad CRC, i.e. at a write torn by a crash. On open, existing segments are cut back to their last valid
+ * record and never appended to again; every run starts a fresh segment.
+ *
+ * Durability is group commit: appends return a sequence number and waitDurable() blocks until a background thread has
+ * msync()ed up to it. That thread syncs everything appended since its last round at once, so under load one sync
+ * covers many appends. Appends that don't call waitDurable() are still written, just without waiting for the disk.
+ *
+ * Full segments are sealed; once compactAfterSealedSegments of them have piled up, a background thread rewrites them
+ * into a single segment containing only the records that are still live (latest per key, not deleted) and removes the
+ * originals. The replay order stays correct at every step, so a crash during compaction loses nothing.
+ */
+class PersistenceLog final {
+    struct Segment;
+
+public:
+    struct Config {
+        std::string directory;
+        size_t segmentSize = 64 * 1024 * 1024;
+        std::chrono::microseconds groupCommitInterval{1000};
+        // 0 disables automatic compaction
+        size_t compactAfterSealedSegments = 4;
+    };
+    struct Stats {
+        size_t segments{0};
+        size_t bytes{0};
+        uint64_t appendedRecords{0};
+        uint64_t syncs{0};
+        uint64_t compactions{0};
+        uint64_t compactedAwayBytes{0};
+    };
+
+    /* Keeps the segments that a replay read from mapped, even after compaction has replaced or deleted them, so the
+     * views of the replayed records stay valid for as long as the pin lives. Only a few segments are held, but drop it
+     * once recovery has copied out what it needs; the space of compacted-away segments is freed only then.
+     */
+    class ReplayPin final {
+    public:
+        ReplayPin() = default;
+        [[nodiscard]] size_t segmentCount() const {
+            return mSegments.size();
+        }
+
+    private:
+        friend class PersistenceLog;
+        std::vector<std::shared_ptr<Segment>> mSegments;
+    };
+
+    explicit PersistenceLog(Config config);
+    ~PersistenceLog();
+    PersistenceLog(const PersistenceLog&) = delete;
+    void operator=(const PersistenceLog&) = delete;
+
+    uint64_t appendSubscribe(std::string_view clientId, std::string_view filter, QoS qos);
+    uint64_t appendUnsubscribe(std::string_view clientId, std::string_view filter);
+    uint64_t appendSessionDelete(std::string_view clientId);
+    uint64_t appendRetain(std::string_view topic, QoS qos, const uint8_t* payload, size_t payloadLength);
+    uint64_t appendInflight(std::string_view clientId, uint16_t packetId, InflightState state, QoS qos, std::string_view topic, const uint8_t* payload, size_t payloadLength);
+    uint64_t appendInflightDone(std::string_view clientId, uint16_t packetId);
+    // blocks until the record with this sequence number and everything before it is on disk, throws if syncing failed
+    void waitDurable(uint64_t sequence);
+
+    /* Replays all records in the order they were appended; records appended while replaying may or may not be included.
+     * Compaction runs in the background (already right after opening if enough sealed segments exist), so the views in
+     * the records are only guaranteed to stay valid while the returned pin is alive; copy them otherwise.
+     */
+    [[nodiscard]] ReplayPin replay(const std::function<void(const PersistRecord&)>& callback) const;
+
+    /* Rebuilds the subscriptions of all persisted sessions directly from the mapped records. subscriberFor maps a
+     * SUBSCRIBE, UNSUBSCRIBE or SESSION_DELETE record to the SubType stored in the tree, usually via its client id.
+     */
+    template<typename SubType, template<typename> class Alloc, typename SubscriberFor>
+    void recoverSubscriptions(SubscriptionTree<SubType, Alloc>& tree, SubscriberFor&& subscriberFor) const {
+        // the tree copies the filters, nothing has to stay pinned
+        (void)replay([&](const PersistRecord& record) {
+            switch(record.type) {
+            case PersistRecordType::SUBSCRIBE:
+                tree.addSubscription(record.topic, subscriberFor(record));
+                break;
+            case PersistRecordType::UNSUBSCRIBE:
+                tree.removeSubscription(record.topic, subscriberFor(record));
+                break;
+            case PersistRecordType::SESSION_DELETE:
+                tree.removeAllSubscriptions(subscriberFor(record));
+                break;
+            default:
+                break;
+            }
+        });
+    }
+
+    // Compacts all sealed segments now; normally done in the background.
+    void compact();
+    [[nodiscard]] Stats getStats() const;
+
+private:
+
+    uint64_t append(PersistRecordType type, QoS qos, InflightState state, uint16_t packetId, std::string_view clientId, std::string_view topic, std::string_view payload);
+    void openSegments();
+    std::shared_ptr<Segment> createSegment(uint64_t sequence, size_t size);
+    std::string segmentPath(uint64_t sequence) const;
+    void syncDirectory() const;
+    void syncNow();
+    void syncThreadFunc();
+    void compactionThreadFunc();
+
+    Config mConfig;
+    mutable std::mutex mMutex;
+    // oldest first, the last one is the active segment that is appended to
+    std::vector<std::shared_ptr<Segment>> mSegments;
+    std::shared_ptr<Segment> mActive;
+    uint64_t mNextSegmentSequence{1};
+    uint64_t mAppended{0};
+    // sealed segments that still have to be synced
+    std::vector<std::shared_ptr<Segment>> mUnsynced;
+
+    std::mutex mDurableMutex;
+    std::condition_variable mDurableCV;
+    std::condition_variable mSyncCV;
+    uint64_t mDurable{0};
+    bool mSyncRequested{false};
+    std::exception_ptr mSyncError;
+
+    // held for the whole duration of a compaction
+    std::mutex mCompactionRunMutex;
+    std::mutex mCompactionRequestMutex;
+    std::condition_variable mCompactionCV;
+    bool mCompactionRequested{false};
+
+    std::atomic<bool> mShouldRun{true};
+    std::atomic<uint64_t> mSyncs{0};
+    std::atomic<uint64_t> mCompactions{0};
+    std::atomic<uint64_t> mCompactedAwayBytes{0};
+    std::thread mSyncThread;
+    std::thread mCompactionThread;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,465 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+/* Codecs specialized at compile time on MQTTVersion and MQTTMessageType. BinaryEncoder/BinaryDecoder decide at runtime
+ * what to do, build a PropertyList for every packet and allocate for every field; these don't. For V4 all property
+ * handling is compiled out, packets without variable content are constexpr byte images that only get their packet
+ * id patched in, and decoding returns views into the received buffer instead of copies.
+ *
+ * Encoding writes the complete packet including the fixed header into a caller provided buffer; size the buffer with
+ * MAX_SIZE or the matching size() function. Decoding takes the variable header and payload, i.e. everything after the
+ * fixed header, and throws std::runtime_error on malformed packets like BinaryDecoder does.
+ *
+ * Use withMQTTVersion() to get from the runtime version of a connection to the compile time one once per batch:
+ *
+ *     withMQTTVersion(client.version, [&](auto version) {
+ *         auto len = PacketCodec<version, MQTTMessageType::PUBACK>::encode(out, packetId);
+ *     });
+ */
+template<MQTTVersion Version, MQTTMessageType Type, typename = void>
+struct PacketCodec;
+
+template<typename Func>
+decltype(auto) withMQTTVersion(MQTTVersion version, Func&& func) {
+    if(version == MQTTVersion::V5) {
+        return func(std::integral_constant<MQTTVersion, MQTTVersion::V5>{});
+    }
+    return func(std::integral_constant<MQTTVersion, MQTTVersion::V4>{});
+}
+
+namespace codec {
+
+constexpr uint8_t fixedHeaderByte(MQTTMessageType type) {
+    // PUBREL, SUBSCRIBE and UNSUBSCRIBE have reserved flags that must be 0b0010
+    uint8_t flags = (type == MQTTMessageType::PUBREL || type == MQTTMessageType::SUBSCRIBE || type == MQTTMessageType::UNSUBSCRIBE) ? 0x02 : 0x00;
+    return static_cast<uint8_t>(static_cast<uint8_t>(type) << 4) | flags;
+}
+
+inline uint8_t* write2Bytes(uint8_t* out, uint16_t value) {
+    out[0] = value >> 8;
+    out[1] = value & 0xFF;
+    return out + 2;
+}
+inline uint8_t* write4Bytes(uint8_t* out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+    return out + 4;
+}
+inline uint8_t* writeVarByteInt(uint8_t* out, uint32_t value) {
+    auto encoded = encodeVarByteInt(value);
+    memcpy(out, encoded.value, encoded.valueLength);
+    return out + encoded.valueLength;
+}
+constexpr size_t varByteIntSize(uint32_t value) {
+    return value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+}
+inline uint8_t* writeString(uint8_t* out, std::string_view str) {
+    out = write2Bytes(out, str.size());
+    if(!str.empty()) {
+        memcpy(out, str.data(), str.size());
+    }
+    return out + str.size();
+}
+
+inline uint16_t read2Bytes(const uint8_t* data) {
+    return (uint16_t(data[0]) << 8) | data[1];
+}
+
+// Bounds checked reader over a packet body that never copies.
+using Reader = ByteReader;
+
+// Size of the encoded property list without its length prefix, following the MQTT 5 encoding of each property type.
+template<template<typename> class Alloc>
+size_t propertyListSize(const BasicPropertyList<Alloc>& properties) {
+    size_t size = 0;
+    for(const auto& [id, value]: properties) {
+        size += 1;
+        switch(propertyToPropertyType(id)) {
+        case MQTTPropertyType::Byte:
+            size += 1;
+            break;
+        case MQTTPropertyType::TwoByteInt:
+            size += 2;
+            break;
+        case MQTTPropertyType::FourByteInt:
+            size += 4;
+            break;
+        case MQTTPropertyType::VarByteInt:
+            size += varByteIntSize(std::get<uint32_t>(value));
+            break;
+        case MQTTPropertyType::BinaryData:
+            size += 2 + std::get<BasicBytes<Alloc>>(value).size();
+            break;
+        case MQTTPropertyType::UTF8String:
+            size += 2 + std::get<BasicString<Alloc>>(value).size();
+            break;
+        case MQTTPropertyType::UTF8StringPair:
+            size += 4 + std::get<std::pair<BasicString<Alloc>, BasicString<Alloc>>>(value).first.size() + std::get<std::pair<BasicString<Alloc>, BasicString<Alloc>>>(value).second.size();
+            break;
+        }
+    }
+    return size;
+}
+
+template<template<typename> class Alloc>
+uint8_t* writePropertyList(uint8_t* out, const BasicPropertyList<Alloc>& properties, size_t encodedSize) {
+    out = writeVarByteInt(out, encodedSize);
+    for(const auto& [id, value]: properties) {
+        *out++ = static_cast<uint8_t>(id);
+        switch(propertyToPropertyType(id)) {
+        case MQTTPropertyType::Byte:
+            *out++ = std::get<uint8_t>(value);
+            break;
+        case MQTTPropertyType::TwoByteInt:
+            out = write2Bytes(out, std::get<uint16_t>(value));
+            break;
+        case MQTTPropertyType::FourByteInt:
+            out = write4Bytes(out, std::get<uint32_t>(value));
+            break;
+        case MQTTPropertyType::VarByteInt:
+            out = writeVarByteInt(out, std::get<uint32_t>(value));
+            break;
+        case MQTTPropertyType::BinaryData: {
+            auto& data = std::get<BasicBytes<Alloc>>(value);
+            out = writeString(out, std::string_view{(const char*)data.data(), data.size()});
+            break;
+        }
+        case MQTTPropertyType::UTF8String:
+            out = writeString(out, std::get<BasicString<Alloc>>(value));
+            break;
+        case MQTTPropertyType::UTF8StringPair:
+            out = writeString(out, std::get<std::pair<BasicString<Alloc>, BasicString<Alloc>>>(value).first);
+            out = writeString(out, std::get<std::pair<BasicString<Alloc>, BasicString<Alloc>>>(value).second);
+            break;
+        }
+    }
+    return out;
+}
+
+// Decodes properties without their length prefix, e.g. Packet::properties of a PUBLISH, with all memory from alloc.
+template<template<typename> class Alloc = std::allocator>
+BasicPropertyList<Alloc> decodePropertyList(std::string_view encoded, const Alloc<char>& alloc = {}) {
+    Reader reader{(const uint8_t*)encoded.data(), encoded.size()};
+    BasicPropertyList<Alloc> ret{alloc};
+    while(!reader.empty()) {
+        auto property = byteToMQTTProperty(reader.byte());
+        BasicMQTTPropertyValue<Alloc> value;
+        switch(propertyToPropertyType(property)) {
+        case MQTTPropertyType::Byte:
+            value = reader.byte();
+            break;
+        case MQTTPropertyType::TwoByteInt:
+            value = reader.twoBytes();
+            break;
+        case MQTTPropertyType::FourByteInt:
+            value = reader.fourBytes();
+            break;
+        case MQTTPropertyType::VarByteInt:
+            value = reader.varByteInt();
+            break;
+        case MQTTPropertyType::BinaryData: {
+            auto bytes = reader.string();
+            value = BasicBytes<Alloc>(bytes.begin(), bytes.end(), alloc);
+            break;
+        }
+        case MQTTPropertyType::UTF8String:
+            value = BasicString<Alloc>(reader.string(), alloc);
+            break;
+        case MQTTPropertyType::UTF8StringPair: {
+            BasicString<Alloc> key{reader.string(), alloc};
+            value = std::make_pair(std::move(key), BasicString<Alloc>(reader.string(), alloc));
+            break;
+        }
+        }
+        ret.emplace(property, std::move(value));
+    }
+    return ret;
+}
+
+template<MQTTMessageType Type>
+constexpr bool isAckType() {
+    return Type == MQTTMessageType::PUBACK || Type == MQTTMessageType::PUBREC || Type == MQTTMessageType::PUBREL || Type == MQTTMessageType::PUBCOMP;
+}
+
+}
+
+/* PUBACK, PUBREC, PUBREL, PUBCOMP (and UNSUBACK for V4): fixed header plus packet id. MQTT 5 allows leaving out the
+ * reason code and properties on success, so the success case is the same four byte image for both versions.
+ */
+template<MQTTVersion Version, MQTTMessageType Type>
+struct PacketCodec<Version, Type, std::enable_if_t<codec::isAckType<Type>() || (Type == MQTTMessageType::UNSUBACK && Version == MQTTVersion::V4)>> {
+    static constexpr std::array<uint8_t, 4> IMAGE{codec::fixedHeaderByte(Type), 0x02, 0x00, 0x00};
+    static constexpr size_t MAX_SIZE = Version == MQTTVersion::V5 ? 5 : 4;
+
+    struct Packet {
+        uint16_t packetId;
+        uint8_t reasonCode;
+    };
+
+    static size_t encode(uint8_t* out, uint16_t packetId) {
+        memcpy(out, IMAGE.data(), IMAGE.size());
+        codec::write2Bytes(out + 2, packetId);
+        return IMAGE.size();
+    }
+    // V4 has no reason codes, so there this is the plain image as well
+    static size_t encode(uint8_t* out, uint16_t packetId, uint8_t reasonCode) {
+        if(Version == MQTTVersion::V4 || reasonCode == 0)
+            return encode(out, packetId);
+        out[0] = IMAGE[0];
+        out[1] = 0x03;
+        codec::write2Bytes(out + 2, packetId);
+        out[4] = reasonCode;
+        return 5;
+    }
+    static Packet decode(const uint8_t* body, size_t length) {
+        if constexpr(Version == MQTTVersion::V4) {
+            if(length != 2) {
+                throw std::runtime_error{"Invalid ack packet length"};
+            }
+            return {codec::read2Bytes(body), 0};
+        } else {
+            if(length < 2) {
+                throw std::runtime_error{"Invalid ack packet length"};
+            }
+            // a reason string in the properties is only informational, so we don't look at it
+            return {codec::read2Bytes(body), length > 2 ? body[2] : uint8_t(0)};
+        }
+    }
+};
+
+// PINGREQ, PINGRESP and the V4 DISCONNECT never carry anything, they are just two constant bytes.
+template<MQTTVersion Version, MQTTMessageType Type>
+struct PacketCodec<Version, Type, std::enable_if_t<Type == MQTTMessageType::PINGREQ || Type == MQTTMessageType::PINGRESP || (Type == MQTTMessageType::DISCONNECT && Version == MQTTVersion::V4)>> {
+    static constexpr std::array<uint8_t, 2> IMAGE{codec::fixedHeaderByte(Type), 0x00};
+    static constexpr size_t MAX_SIZE = 2;
+
+    static size_t encode(uint8_t* out) {
+        memcpy(out, IMAGE.data(), IMAGE.size());
+        return IMAGE.size();
+    }
+    static void decode(const uint8_t*, size_t length) {
+        if(length != 0) {
+            throw std::runtime_error{"Invalid packet length"};
+        }
+    }
+};
+
+/* SUBACK with one return code per filter. The common single filter case is a constexpr image as well, V5 just has an
+ * additional empty property list in it.
+ */
+template<MQTTVersion Version>
+struct PacketCodec<Version, MQTTMessageType::SUBACK> {
+    static constexpr size_t PROPERTIES_SIZE = Version == MQTTVersion::V5 ? 1 : 0;
+    static constexpr std::array<uint8_t, 5 + PROPERTIES_SIZE> makeImage() {
+        std::array<uint8_t, 5 + PROPERTIES_SIZE> ret{codec::fixedHeaderByte(MQTTMessageType::SUBACK), 3 + PROPERTIES_SIZE, 0x00, 0x00};
+        return ret;
+    }
+    static constexpr std::array<uint8_t, 5 + PROPERTIES_SIZE> IMAGE = makeImage();
+
+    static constexpr size_t size(size_t returnCodes) {
+        auto remaining = 2 + PROPERTIES_SIZE + returnCodes;
+        return 1 + codec::varByteIntSize(remaining) + remaining;
+    }
+    static size_t encode(uint8_t* out, uint16_t packetId, uint8_t returnCode) {
+        memcpy(out, IMAGE.data(), IMAGE.size());
+        codec::write2Bytes(out + 2, packetId);
+        out[IMAGE.size() - 1] = returnCode;
+        return IMAGE.size();
+    }
+    static size_t encode(uint8_t* out, uint16_t packetId, const uint8_t* returnCodes, size_t count) {
+        auto start = out;
+        *out++ = IMAGE[0];
+        out = codec::writeVarByteInt(out, 2 + PROPERTIES_SIZE + count);
+        out = codec::write2Bytes(out, packetId);
+        if constexpr(Version == MQTTVersion::V5) {
+            *out++ = 0;
+        }
+        memcpy(out, returnCodes, count);
+        return out + count - start;
+    }
+};
+
+/* PUBLISH, the one packet that matters for throughput. Encoding writes everything up to the payload, so the payload
+ * can be sent straight from where it is (e.g. as a second iovec) or be appended by the caller. A non-zero topicAlias
+ * (V5 only) is sent as an additional TOPIC_ALIAS property, so a shared packet doesn't have to be copied for it.
+ */
+template<MQTTVersion Version>
+struct PacketCodec<Version, MQTTMessageType::PUBLISH> {
+    struct Packet {
+        std::string_view topic;
+        uint16_t packetId{0};
+        QoS qos{QoS::QoS0};
+        Retain retain{Retain::No};
+        bool dup{false};
+        // encoded properties without the length prefix, empty for V4; decode them on demand with codec::decodePropertyList
+        std::string_view properties;
+        std::string_view payload;
+    };
+
+    // fixed header, topic, packet id and properties - everything but the payload
+    template<template<typename> class Alloc = std::allocator>
+    static size_t headerSize(std::string_view topic, QoS qos, size_t payloadLength, const BasicPropertyList<Alloc>* properties = nullptr, uint16_t topicAlias = 0) {
+        size_t remaining = 2 + topic.size() + (qos != QoS::QoS0 ? 2 : 0) + payloadLength;
+        if constexpr(Version == MQTTVersion::V5) {
+            auto propertiesSize = (properties ? codec::propertyListSize(*properties) : 0) + (topicAlias ? 3 : 0);
+            remaining += codec::varByteIntSize(propertiesSize) + propertiesSize;
+        }
+        return 1 + codec::varByteIntSize(remaining) + remaining - payloadLength;
+    }
+    template<template<typename> class Alloc = std::allocator>
+    static size_t encodeHeader(uint8_t* out, std::string_view topic, QoS qos, Retain retain, uint16_t packetId, size_t payloadLength,
+        const BasicPropertyList<Alloc>* properties = nullptr, uint16_t topicAlias = 0) {
+        size_t propertiesSize = 0;
+        size_t remaining = 2 + topic.size() + (qos != QoS::QoS0 ? 2 : 0) + payloadLength;
+        if constexpr(Version == MQTTVersion::V5) {
+            propertiesSize = (properties ? codec::propertyListSize(*properties) : 0) + (topicAlias ? 3 : 0);
+            remaining += codec::varByteIntSize(propertiesSize) + propertiesSize;
+        }
+        auto start = out;
+        *out++ = codec::fixedHeaderByte(MQTTMessageType::PUBLISH) | (static_cast<uint8_t>(qos) << 1) | (retain == Retain::Yes ? 1 : 0);
+        out = codec::writeVarByteInt(out, remaining);
+        out = codec::writeString(out, topic);
+        if(qos != QoS::QoS0) {
+            out = codec::write2Bytes(out, packetId);
+        }
+        if constexpr(Version == MQTTVersion::V5) {
+            if(properties) {
+                out = codec::writePropertyList(out, *properties, propertiesSize);
+            } else {
+                out = codec::writeVarByteInt(out, propertiesSize);
+            }
+            if(topicAlias) {
+                *out++ = static_cast<uint8_t>(MQTTProperty::TOPIC_ALIAS);
+                out = codec::write2Bytes(out, topicAlias);
+            }
+        }
+        return out - start;
+    }
+    template<template<typename> class Alloc>
+    static void encode(BinaryEncoder& encoder, const BasicMQTTPacket<Alloc>& packet, uint16_t packetId, std::string_view topic, uint16_t topicAlias = 0) {
+        // the header of any valid packet fits on the stack, only absurd topics or property lists need the heap
+        uint8_t stackBuffer[512];
+        std::vector<uint8_t> heapBuffer;
+        auto size = headerSize(topic, packet.qos, packet.payload.size(), &packet.properties, topicAlias);
+        uint8_t* out = stackBuffer;
+        if(size > sizeof(stackBuffer)) {
+            heapBuffer.resize(size);
+            out = heapBuffer.data();
+        }
+        encoder.encodeBytes(out, encodeHeader(out, topic, packet.qos, packet.retain, packetId, packet.payload.size(), &packet.properties, topicAlias));
+        encoder.encodeBytes(packet.payload);
+    }
+    template<template<typename> class Alloc>
+    static void encode(BinaryEncoder& encoder, const BasicMQTTPacket<Alloc>& packet, uint16_t packetId) {
+        encode(encoder, packet, packetId, packet.topic);
+    }
+    // flags are the lower four bits of the fixed header byte
+    static Packet decode(const uint8_t* body, size_t length, uint8_t flags) {
+        codec::Reader reader{body, length};
+        Packet ret;
+        ret.qos = static_cast<QoS>((flags >> 1) & 0x03);
+        if(ret.qos != QoS::QoS0 && ret.qos != QoS::QoS1 && ret.qos != QoS::QoS2) {
+            throw std::runtime_error{"Invalid QoS"};
+        }
+        ret.retain = (flags & 0x01) ? Retain::Yes : Retain::No;
+        ret.dup = flags & 0x08;
+        ret.topic = reader.string();
+        if(ret.qos != QoS::QoS0) {
+            ret.packetId = reader.twoBytes();
+        }
+        if constexpr(Version == MQTTVersion::V5) {
+            auto propertiesLength = reader.varByteInt();
+            ret.properties = reader.bytes(propertiesLength);
+        }
+        ret.payload = reader.rest();
+        return ret;
+    }
+    /* Offset of the four byte MESSAGE_EXPIRY_INTERVAL value in an encoded PUBLISH (starting with the fixed header), 0
+     * if there is none, which is always the case for V4. A stored packet gets the remaining interval written there
+     * when it's delivered, which MQTT 5 requires, without being encoded again.
+     */
+    static size_t messageExpiryOffset(const uint8_t* packet, size_t length) {
+        if constexpr(Version == MQTTVersion::V4) {
+            return 0;
+        } else {
+            codec::Reader reader{packet, length};
+            auto flags = reader.byte() & 0x0F;
+            reader.varByteInt();
+            reader.string();
+            if((flags >> 1) & 0x03) {
+                reader.twoBytes();
+            }
+            auto propertiesLength = reader.varByteInt();
+            auto properties = reader.bytes(propertiesLength);
+            codec::Reader propertyReader{(const uint8_t*)properties.data(), properties.size()};
+            while(!propertyReader.empty()) {
+                auto property = byteToMQTTProperty(propertyReader.byte());
+                switch(propertyToPropertyType(property)) {
+                case MQTTPropertyType::Byte:
+                    propertyReader.byte();
+                    break;
+                case MQTTPropertyType::TwoByteInt:
+                    propertyReader.twoBytes();
+                    break;
+                case MQTTPropertyType::FourByteInt:
+                    if(property == MQTTProperty::MESSAGE_EXPIRY_INTERVAL) {
+                        auto offset = (const uint8_t*)properties.data() + (properties.size() - propertyReader.remaining()) - packet;
+                        propertyReader.fourBytes();
+                        return offset;
+                    }
+                    propertyReader.fourBytes();
+                    break;
+                case MQTTPropertyType::VarByteInt:
+                    propertyReader.varByteInt();
+                    break;
+                case MQTTPropertyType::BinaryData:
+                case MQTTPropertyType::UTF8String:
+                    propertyReader.string();
+                    break;
+                case MQTTPropertyType::UTF8StringPair:
+                    propertyReader.string();
+                    propertyReader.string();
+                    break;
+                }
+            }
+            return 0;
+        }
+    }
+    // Overwrites MESSAGE_EXPIRY_INTERVAL in place, false if the packet doesn't have one.
+    static bool rewriteMessageExpiry(uint8_t* packet, size_t length, uint32_t remainingSeconds) {
+        auto offset = messageExpiryOffset(packet, length);
+        if(offset == 0) {
+            return false;
+        }
+        codec::write4Bytes(packet + offset, remainingSeconds);
+        return true;
+    }
+    // Copies a decoded packet into an owning one, e.g. to queue it, with all memory from alloc.
+    template<template<typename> class Alloc = std::allocator>
+    static BasicMQTTPacket<Alloc> toMQTTPacket(const Packet& packet, const Alloc<char>& alloc = {}) {
+        BasicMQTTPacket<Alloc> ret{alloc};
+        ret.topic.assign(packet.topic.data(), packet.topic.size());
+        ret.payload.assign(packet.payload.begin(), packet.payload.end());
+        ret.qos = packet.qos;
+        ret.retain = packet.retain;
+        if constexpr(Version == MQTTVersion::V5) {
+            ret.properties = codec::decodePropertyList<Alloc>(packet.properties, alloc);
+        }
+        return ret;
+    }
+};
+
+}
\ No newline at end of file
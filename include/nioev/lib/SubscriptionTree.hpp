@@ -1,12 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <vector>
 #include <string>
 #include <functional>
 #include "Util.hpp"
 #include <string_view>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace nioev::lib {
@@ -22,18 +28,130 @@ enum class RemoveSubRet {
     DeletedLastSubFromTopic
 };
 
-template<typename SubType>
+/* Shape and estimated memory of a SubscriptionTree or one of its top level subtrees, see
+ * SubscriptionTree::collectStats(). Fan-out and subscriber histograms use power of two buckets: bucket 0 counts zeros,
+ * bucket i counts values in [2^(i-1), 2^i) and the last bucket everything above.
+ */
+struct SubscriptionTreeStats {
+    static constexpr size_t HISTOGRAM_BUCKETS = 16;
+
+    uint64_t nodes{0};
+    uint64_t nodesWithSubscribers{0};
+    // (filter, subscriber) pairs
+    uint64_t subscriptions{0};
+    // of those, the ones whose filter contains + or #
+    uint64_t wildcardSubscriptions{0};
+    // levels named + and #; every + has to be followed on each match that gets there
+    uint64_t singleLevelWildcardNodes{0};
+    uint64_t multiLevelWildcardNodes{0};
+    uint64_t maxDepth{0};
+    /* Nodes, level names, hash buckets and subscriber entries, estimated from the container layout of libstdc++.
+     * Memory that subscribers own themselves (e.g. the heap part of a std::string) isn't included.
+     */
+    uint64_t estimatedBytes{0};
+    // nodes per depth, the root is at depth 0 and the last bucket holds everything deeper
+    std::array<uint64_t, HISTOGRAM_BUCKETS> depthHistogram{};
+    // children per node
+    std::array<uint64_t, HISTOGRAM_BUCKETS> fanOutHistogram{};
+    std::array<uint64_t, HISTOGRAM_BUCKETS> subscribersHistogram{};
+
+    static size_t histogramBucket(uint64_t value) {
+        if(value == 0)
+            return 0;
+        return std::min<size_t>(64 - __builtin_clzll(value), HISTOGRAM_BUCKETS - 1);
+    }
+    void merge(const SubscriptionTreeStats& other);
+};
+
+/* Samples how expensive forEveryMatch() is, attributed to the first level of the topic, e.g. the tenant. Every n-th
+ * match on a thread is measured: how many tree nodes it visited and how many subscribers it found. Recording takes a
+ * mutex, but only for sampled matches; the others pay for a thread local countdown. Attach it with
+ * SubscriptionTree::setMatchCostSampler(), it can be read from any thread while matching goes on.
+ *
+ * Only the first maxPrefixes distinct prefixes get their own entry, later ones are added up under OTHER_PREFIX so
+ * clients publishing to random top level topics can't grow the sampler without bound.
+ */
+class MatchCostSampler final {
+public:
+    struct PrefixCost {
+        std::string prefix;
+        uint64_t sampledMatches{0};
+        uint64_t nodesVisited{0};
+        uint64_t maxNodesVisited{0};
+        uint64_t subscribersMatched{0};
+    };
+
+    // can't collide with a real prefix, published topics never contain wildcards
+    static constexpr const char* OTHER_PREFIX = "#";
+
+    explicit MatchCostSampler(uint32_t sampleEvery = 1024, size_t maxPrefixes = 256)
+    : mSampleEvery(std::max<uint32_t>(sampleEvery, 1)), mMaxPrefixes(maxPrefixes) {
+        mOther.prefix = OTHER_PREFIX;
+    }
+    MatchCostSampler(const MatchCostSampler&) = delete;
+    void operator=(const MatchCostSampler&) = delete;
+
+    bool shouldSample() const {
+        // shared by all samplers on the thread, which doesn't matter for sampling
+        static thread_local uint32_t countdown = 0;
+        if(countdown == 0) {
+            countdown = mSampleEvery - 1;
+            return true;
+        }
+        countdown -= 1;
+        return false;
+    }
+    void record(std::string_view topic, uint64_t nodesVisited, uint64_t subscribersMatched);
+    // most visited nodes first
+    [[nodiscard]] std::vector<PrefixCost> snapshot() const;
+    void reset();
+
+private:
+    const uint32_t mSampleEvery;
+    const size_t mMaxPrefixes;
+    mutable std::mutex mMutex;
+    std::unordered_map<std::string, PrefixCost> mCosts;
+    PrefixCost mOther;
+};
+
+/* Alloc is std::allocator or std::pmr::polymorphic_allocator (see pmr::SubscriptionTree); with the latter all nodes,
+ * level names and subscriber sets come from the memory resource the tree was constructed with.
+ */
+template<typename SubType, template<typename> class Alloc = std::allocator>
 class SubscriptionTree {
 private:
+    using Key = BasicString<Alloc>;
     struct TreeNode {
-        std::unordered_map<std::string, TreeNode> children;
-        std::unordered_set<SubType> subscribers;
+        // lets a polymorphic allocator pass itself on to the nodes it creates
+        using allocator_type = Alloc<char>;
+
+        TreeNode() = default;
+        explicit TreeNode(const allocator_type& alloc)
+        : children(alloc), subscribers(alloc) {
+
+        }
+        TreeNode(const TreeNode& other, const allocator_type& alloc)
+        : children(other.children, alloc), subscribers(other.subscribers, alloc) {
+
+        }
+        TreeNode(TreeNode&& other, const allocator_type& alloc)
+        : children(std::move(other.children), alloc), subscribers(std::move(other.subscribers), alloc) {
+
+        }
+        std::unordered_map<Key, TreeNode, std::hash<Key>, std::equal_to<Key>, Alloc<std::pair<const Key, TreeNode>>> children;
+        std::unordered_set<SubType, std::hash<SubType>, std::equal_to<SubType>, Alloc<SubType>> subscribers;
     };
 public:
+    SubscriptionTree() = default;
+    explicit SubscriptionTree(const Alloc<char>& alloc)
+    : root(alloc) {
+
+    }
+
     void addSubscription(const std::string_view &topicFilter, SubType subscriberId) {
         TreeNode* currentNode = &root;
         lib::splitString(topicFilter, '/', [&](std::string_view part) {
-            currentNode = &currentNode->children.emplace(std::string{part}, TreeNode{}).first->second;
+            currentNode = &childFor(*currentNode, part);
             return IterationDecision::Continue;
         });
         currentNode->subscribers.erase(subscriberId);
@@ -44,9 +162,9 @@ public:
         TreeNode* prevNode = nullptr;
         TreeNode* currentNode = &root;
         bool found = true;
-        std::string lastPart;
+        std::string_view lastPart;
         lib::splitString(topicFilter, '/', [&](std::string_view part) {
-            auto it = currentNode->children.find(std::string{part});
+            auto it = currentNode->children.find(Key{part});
             if(it == currentNode->children.end()) {
                 found = false;
                 return IterationDecision::Stop;
@@ -60,7 +178,7 @@ public:
             return RemoveSubRet::NotFound;
         currentNode->subscribers.erase(subscriberId);
         if(currentNode->subscribers.empty() && currentNode->children.empty() && prevNode) {
-            prevNode->children.erase(lastPart);
+            prevNode->children.erase(Key{lastPart});
             return RemoveSubRet::DeletedLastSubFromTopic;
         }
         return RemoveSubRet::Default;
@@ -68,32 +186,75 @@ public:
 
     void forEveryMatch(const std::string_view &topic, std::function<void(SubType& )>&& callback)const {
         std::vector<const TreeNode*> currentNodes{&root};
+        // counting is cheaper than checking whether this match is sampled
+        uint64_t nodesVisited = 1, subscribersMatched = 0;
         lib::splitString(topic, '/', [&](std::string_view part) {
             std::vector<const TreeNode*> nextNodes;
             for(auto currentNode: currentNodes) {
-                auto it = currentNode->children.find("#");
+                auto it = currentNode->children.find(Key{"#"});
                 if(it != currentNode->children.end()) {
+                    nodesVisited += 1;
+                    subscribersMatched += it->second.subscribers.size();
                     for(auto& s: it->second.subscribers) {
                         callback(const_cast<SubType&>(s));
                     }
                 }
-                it = currentNode->children.find(std::string{part});
+                it = currentNode->children.find(Key{part});
                 if(it != currentNode->children.end()) {
                     nextNodes.emplace_back(&it->second);
                 }
-                it = currentNode->children.find("+");
+                it = currentNode->children.find(Key{"+"});
                 if(it != currentNode->children.end()) {
                     nextNodes.emplace_back(&it->second);
                 }
             }
+            nodesVisited += nextNodes.size();
             currentNodes = nextNodes;
             return IterationDecision::Continue;
         });
         for(auto currentNode: currentNodes) {
+            subscribersMatched += currentNode->subscribers.size();
             for(auto& s: currentNode->subscribers) {
                 callback(const_cast<SubType&>(s));
             }
         }
+        if(mMatchCostSampler && mMatchCostSampler->shouldSample()) {
+            mMatchCostSampler->record(topic, nodesVisited, subscribersMatched);
+        }
+    }
+
+    // The sampler must outlive the tree (and its copies) or be detached again with nullptr.
+    void setMatchCostSampler(MatchCostSampler* sampler) {
+        mMatchCostSampler = sampler;
+    }
+
+    /* Walks the whole tree. Collecting only reads, so it can run under the same shared lock as matching; with an
+     * exclusive lock, collect the top level prefixes one by one to keep each pause short.
+     */
+    [[nodiscard]] SubscriptionTreeStats collectStats() const {
+        SubscriptionTreeStats ret;
+        collectSubtreeStats(ret, nullptr, root, 0);
+        return ret;
+    }
+    /* Stats of the subtree under the given first level, with depths counted from the root; nullopt if there is none.
+     * Merging the stats of all topLevelPrefixes() gives collectStats() minus the root node itself.
+     */
+    [[nodiscard]] std::optional<SubscriptionTreeStats> collectStats(std::string_view topLevel) const {
+        auto it = root.children.find(Key{topLevel});
+        if(it == root.children.end()) {
+            return {};
+        }
+        SubscriptionTreeStats ret;
+        collectSubtreeStats(ret, &it->first, it->second, 1);
+        return ret;
+    }
+    [[nodiscard]] std::vector<std::string> topLevelPrefixes() const {
+        std::vector<std::string> ret;
+        ret.reserve(root.children.size());
+        for(auto& [part, child]: root.children) {
+            ret.emplace_back(part.data(), part.size());
+        }
+        return ret;
     }
 
     std::vector<std::string> removeAllSubscriptions(const SubType& subscriberId) {
@@ -101,17 +262,189 @@ public:
         removeAllSubsRec(subscriberId, &root, "", ret);
         return ret;
     }
+
+    /* Adds a batch of (filter, subscriber) pairs. When the batch is sorted by filter, consecutive filters share their
+     * leading levels, which are then compared against the previous filter instead of being looked up again. Any order
+     * gives the same tree, unsorted batches just share less.
+     */
+    template<typename Range>
+    void bulkAdd(const Range& subscriptions) {
+        // levels of the previous filter and their nodes; nodes of an unordered_map never move, so these stay valid
+        std::vector<std::pair<std::string_view, TreeNode*>> path;
+        for(const auto& [topicFilter, subscriberId]: subscriptions) {
+            TreeNode* currentNode = &root;
+            size_t depth = 0;
+            bool shared = true;
+            lib::splitString(topicFilter, '/', [&](std::string_view part) {
+                if(shared && depth < path.size() && path[depth].first == part) {
+                    currentNode = path[depth].second;
+                } else {
+                    shared = false;
+                    currentNode = &childFor(*currentNode, part);
+                    path.resize(depth);
+                    path.emplace_back(part, currentNode);
+                }
+                depth += 1;
+                return IterationDecision::Continue;
+            });
+            currentNode->subscribers.erase(subscriberId);
+            currentNode->subscribers.emplace(subscriberId);
+        }
+    }
+
+    /* Writes the tree as a compact binary image:
+     *
+     *     "NIOEVSUB" version(1) node
+     *     node = partLength(varint) part subscriberCount(varint) subscriber* childCount(varint) node*
+     *
+     * Nodes are written depth first, so each level is stored once no matter how many filters share it. Varints are the
+     * MQTT variable byte integers. encodeSubscriber(BinaryEncoder&, const SubType&) writes a single subscriber.
+     */
+    template<typename EncodeSubscriber>
+    void serialize(BinaryEncoder& out, EncodeSubscriber&& encodeSubscriber) const {
+        out.encodeBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        out.encodeByte(SNAPSHOT_VERSION);
+        std::vector<std::pair<std::string_view, const TreeNode*>> stack{{std::string_view{}, &root}};
+        while(!stack.empty()) {
+            auto [part, node] = stack.back();
+            stack.pop_back();
+            encodeSnapshotInt(out, part.size());
+            out.encodeBytes(part.data(), part.size());
+            encodeSnapshotInt(out, node->subscribers.size());
+            for(auto& subscriber: node->subscribers) {
+                encodeSubscriber(out, subscriber);
+            }
+            encodeSnapshotInt(out, node->children.size());
+            // the stack hands them out again right away, so the children follow their parent
+            for(auto& [childPart, child]: node->children) {
+                stack.emplace_back(childPart, &child);
+            }
+        }
+    }
+
+    /* Replaces the contents of the tree with an image written by serialize() in a single pass, sizing every node's
+     * containers up front from the stored counts. decodeSubscriber(ByteReader&) reads a single subscriber. Throws on
+     * malformed input, in which case the tree is left unchanged.
+     */
+    template<typename DecodeSubscriber>
+    void deserialize(const uint8_t* data, size_t length, DecodeSubscriber&& decodeSubscriber) {
+        ByteReader reader{data, length};
+        if(reader.bytes(sizeof(SNAPSHOT_MAGIC)) != std::string_view{SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)} || reader.byte() != SNAPSHOT_VERSION) {
+            throw std::runtime_error{"Not a subscription tree snapshot"};
+        }
+        auto readNode = [&](TreeNode& node) {
+            // every entry takes at least a byte, so corrupt counts can't make us reserve more than the input size
+            auto subscriberCount = reader.varByteInt();
+            node.subscribers.reserve(std::min<size_t>(subscriberCount, reader.remaining()));
+            for(uint32_t i = 0; i < subscriberCount; ++i) {
+                node.subscribers.emplace(decodeSubscriber(reader));
+            }
+            auto childCount = reader.varByteInt();
+            node.children.reserve(std::min<size_t>(childCount, reader.remaining()));
+            return childCount;
+        };
+        TreeNode newRoot{root.children.get_allocator()};
+        if(reader.varByteInt() != 0) {
+            throw std::runtime_error{"Subscription tree snapshot root has a name"};
+        }
+        // nodes whose children are still being read and how many of them are left
+        std::vector<std::pair<TreeNode*, uint32_t>> stack;
+        if(auto childCount = readNode(newRoot); childCount > 0) {
+            stack.emplace_back(&newRoot, childCount);
+        }
+        while(!stack.empty()) {
+            auto& [parent, remaining] = stack.back();
+            if(remaining == 0) {
+                stack.pop_back();
+                continue;
+            }
+            remaining -= 1;
+            auto part = reader.bytes(reader.varByteInt());
+            auto [it, inserted] = parent->children.emplace(std::piecewise_construct, std::forward_as_tuple(part), std::forward_as_tuple());
+            if(!inserted) {
+                throw std::runtime_error{"Duplicate level in subscription tree snapshot"};
+            }
+            if(auto childCount = readNode(it->second); childCount > 0) {
+                stack.emplace_back(&it->second, childCount);
+            }
+        }
+        if(!reader.empty()) {
+            throw std::runtime_error{"Trailing data after subscription tree snapshot"};
+        }
+        root = std::move(newRoot);
+    }
 private:
+    static constexpr char SNAPSHOT_MAGIC[8] = {'N', 'I', 'O', 'E', 'V', 'S', 'U', 'B'};
+    static constexpr uint8_t SNAPSHOT_VERSION = 1;
+
+    static void encodeSnapshotInt(BinaryEncoder& out, uint32_t value) {
+        auto encoded = lib::encodeVarByteInt(value);
+        out.encodeBytes(encoded.value, encoded.valueLength);
+    }
+
+    // the allocator reaches the key and the node through uses-allocator construction
+    static TreeNode& childFor(TreeNode& node, std::string_view part) {
+        return node.children.emplace(std::piecewise_construct, std::forward_as_tuple(part), std::forward_as_tuple()).first->second;
+    }
+
+    static size_t estimateKeyBytes(const Key& key) {
+        // std::string keeps up to 15 characters inline
+        return key.capacity() > 15 ? key.capacity() + 1 : 0;
+    }
+    // iterative, since filters can be deep enough to exhaust the stack; part is nullptr for the root
+    static void collectSubtreeStats(SubscriptionTreeStats& stats, const Key* startPart, const TreeNode& start, uint64_t startDepth) {
+        struct Pending {
+            const Key* part;
+            const TreeNode* node;
+            uint64_t depth;
+            bool underWildcard;
+        };
+        // hash table nodes hold a next pointer and the cached hash next to the value
+        constexpr size_t HASH_NODE_OVERHEAD = 2 * sizeof(void*);
+        std::vector<Pending> stack{{startPart, &start, startDepth, false}};
+        while(!stack.empty()) {
+            auto [part, node, depth, underWildcard] = stack.back();
+            stack.pop_back();
+            if(part) {
+                stats.estimatedBytes += sizeof(std::pair<const Key, TreeNode>) + HASH_NODE_OVERHEAD + estimateKeyBytes(*part);
+                if(*part == "+") {
+                    stats.singleLevelWildcardNodes += 1;
+                    underWildcard = true;
+                } else if(*part == "#") {
+                    stats.multiLevelWildcardNodes += 1;
+                    underWildcard = true;
+                }
+            }
+            stats.nodes += 1;
+            stats.maxDepth = std::max(stats.maxDepth, depth);
+            stats.depthHistogram[std::min<size_t>(depth, SubscriptionTreeStats::HISTOGRAM_BUCKETS - 1)] += 1;
+            stats.fanOutHistogram[SubscriptionTreeStats::histogramBucket(node->children.size())] += 1;
+            stats.subscribersHistogram[SubscriptionTreeStats::histogramBucket(node->subscribers.size())] += 1;
+            if(!node->subscribers.empty()) {
+                stats.nodesWithSubscribers += 1;
+                stats.subscriptions += node->subscribers.size();
+                if(underWildcard)
+                    stats.wildcardSubscriptions += node->subscribers.size();
+            }
+            stats.estimatedBytes += node->children.bucket_count() * sizeof(void*) + node->subscribers.bucket_count() * sizeof(void*) +
+                node->subscribers.size() * (sizeof(SubType) + HASH_NODE_OVERHEAD);
+            for(auto& [childPart, child]: node->children) {
+                stack.push_back({&childPart, &child, depth + 1, underWildcard});
+            }
+        }
+    }
+
     TreeNode root;
+    MatchCostSampler* mMatchCostSampler{nullptr};
 
-    bool removeAllSubsRec(const SubType& subscriberId, SubscriptionTree<SubType>::TreeNode* current, const std::string& currentSubPath, std::vector<std::string>& deletedSubs) {
+    bool removeAllSubsRec(const SubType& subscriberId, TreeNode* current, const std::string& currentSubPath, std::vector<std::string>& deletedSubs) {
         current->subscribers.erase(subscriberId);
         if(current->subscribers.empty() && current->children.empty() && !currentSubPath.empty()) {
             deletedSubs.emplace_back(currentSubPath.substr(0, currentSubPath.size() - 1));
             return true;
         }
         for(auto it = current->children.begin(); it != current->children.end();) {
-            if(removeAllSubsRec(subscriberId, &it->second, currentSubPath + it->first + "/", deletedSubs)) {
+            if(removeAllSubsRec(subscriberId, &it->second, std::string{currentSubPath}.append(it->first).append("/"), deletedSubs)) {
                 it = current->children.erase(it);
             } else {
                 ++it;
@@ -121,4 +454,9 @@ private:
     };
 };
 
+namespace pmr {
+template<typename SubType>
+using SubscriptionTree = lib::SubscriptionTree<SubType, std::pmr::polymorphic_allocator>;
+}
+
 }
\ No newline at end of file
@@ -16,6 +16,10 @@ public:
         std::function<void()> callback;
         std::chrono::steady_clock::time_point lastTimeRun;
     };
+    struct OneShotTask {
+        std::chrono::steady_clock::time_point when;
+        std::function<void()> callback;
+    };
 
     Timers() : mThread([this] { tasksThreadFunc(); }) { }
     ~Timers();
@@ -27,12 +31,18 @@ public:
         mTasks.emplace_back(PeriodicTask{every, std::move(callback), std::chrono::steady_clock::now()});
         mTasksCV.notify_one();
     }
+    // Callbacks run on the timer thread with the tasks lock held, so they must not add tasks themselves.
+    void addOneShotTask(std::chrono::steady_clock::duration delay, std::function<void()>&& callback) {
+        std::lock_guard<std::mutex> lock{ mTasksMutex };
+        mTasks.emplace_back(OneShotTask{std::chrono::steady_clock::now() + delay, std::move(callback)});
+        mTasksCV.notify_one();
+    }
 
 private:
     std::atomic<bool> mShouldRun = true;
     std::mutex mTasksMutex;
     std::condition_variable mTasksCV;
-    std::list<std::variant<PeriodicTask>> mTasks;
+    std::list<std::variant<PeriodicTask, OneShotTask>> mTasks;
     std::thread mThread;
 };
 
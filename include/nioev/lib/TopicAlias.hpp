@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "StaticCodec.hpp"
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+/* Topic aliases (MQTT 5) of one connection, client to broker. The maximum is the TOPIC_ALIAS_MAXIMUM we sent in the
+ * CONNACK. Each alias slot keeps its topic string, so resolving is an index into a vector and rebinding an alias reuses
+ * the string's memory.
+ */
+class InboundTopicAliases final {
+public:
+    explicit InboundTopicAliases(uint16_t maximum)
+    : mTopics(maximum) {
+
+    }
+
+    /* Applies the TOPIC_ALIAS of a received PUBLISH: a non-empty topic (re)binds the alias to it, an empty one is
+     * replaced by the topic bound to the alias. Throws std::runtime_error on the protocol errors the spec lists (alias
+     * 0, above the maximum, or unknown), which should end the connection with reason code 0x94.
+     */
+    const std::string& resolve(uint16_t alias, std::string_view topic) {
+        if(alias == 0 || alias > mTopics.size()) {
+            throw std::runtime_error{"Invalid topic alias " + std::to_string(alias)};
+        }
+        auto& slot = mTopics[alias - 1];
+        if(!topic.empty()) {
+            slot.assign(topic.data(), topic.size());
+        } else if(slot.empty()) {
+            throw std::runtime_error{"Unknown topic alias " + std::to_string(alias)};
+        }
+        return slot;
+    }
+    /* Resolves the alias of a decoded packet in place. The TOPIC_ALIAS property is removed because an alias only means
+     * something on the connection it was received on and must not be forwarded.
+     */
+    template<template<typename> class Alloc>
+    void resolve(BasicMQTTPacket<Alloc>& packet) {
+        auto it = packet.properties.find(MQTTProperty::TOPIC_ALIAS);
+        if(it == packet.properties.end()) {
+            if(packet.topic.empty()) {
+                throw std::runtime_error{"Empty topic without topic alias"};
+            }
+            return;
+        }
+        auto alias = std::get<uint16_t>(it->second);
+        packet.properties.erase(it);
+        if(packet.topic.empty()) {
+            auto& topic = resolve(alias, {});
+            packet.topic.assign(topic.data(), topic.size());
+        } else {
+            resolve(alias, packet.topic);
+        }
+    }
+    [[nodiscard]] uint16_t getMaximum() const {
+        return mTopics.size();
+    }
+
+private:
+    std::vector<std::string> mTopics;
+};
+
+/* Eviction policies for OutboundTopicAliases decide which alias to rebind once all are in use. A policy gets:
+ *     void assigned(uint16_t alias) - the alias was (re)bound to a topic
+ *     void used(uint16_t alias)     - the alias was sent again for its topic
+ *     uint16_t victim()             - the alias to rebind next
+ * Aliases are 1 to maximum, all of them are assigned before victim() is called.
+ */
+
+// Rebinds the alias that wasn't used for the longest time. Intrusive list over the alias numbers, everything O(1).
+class LruAliasEviction final {
+public:
+    explicit LruAliasEviction(uint16_t maximum)
+    : mPrev(maximum + 1, 0), mNext(maximum + 1, 0) {
+
+    }
+    void assigned(uint16_t alias) {
+        if(mPrev[alias] || mNext[alias] || mHead == alias) {
+            unlink(alias);
+        }
+        pushFront(alias);
+    }
+    void used(uint16_t alias) {
+        if(mHead == alias)
+            return;
+        unlink(alias);
+        pushFront(alias);
+    }
+    uint16_t victim() const {
+        return mTail;
+    }
+
+private:
+    void unlink(uint16_t alias) {
+        if(mPrev[alias]) {
+            mNext[mPrev[alias]] = mNext[alias];
+        } else {
+            mHead = mNext[alias];
+        }
+        if(mNext[alias]) {
+            mPrev[mNext[alias]] = mPrev[alias];
+        } else {
+            mTail = mPrev[alias];
+        }
+        mPrev[alias] = mNext[alias] = 0;
+    }
+    void pushFront(uint16_t alias) {
+        mNext[alias] = mHead;
+        if(mHead) {
+            mPrev[mHead] = alias;
+        } else {
+            mTail = alias;
+        }
+        mHead = alias;
+    }
+    // 0 is not a valid alias, so it marks the ends of the list
+    std::vector<uint16_t> mPrev, mNext;
+    uint16_t mHead{0}, mTail{0};
+};
+
+/* Rebinds a rarely used alias, which keeps the topics of devices that publish all the time aliased even when many
+ * one-off topics pass through. Like Redis' LFU it's approximated: counters are halved regularly so that old popularity
+ * fades, and the victim is the least used of a few aliases sampled round robin, which keeps it O(1).
+ */
+class LfuAliasEviction final {
+public:
+    static constexpr uint SAMPLES = 8;
+
+    explicit LfuAliasEviction(uint16_t maximum)
+    : mCounts(maximum + 1, 0), mDecayEvery(std::max<uint32_t>(maximum * 16u, 256)) {
+
+    }
+    void assigned(uint16_t alias) {
+        mCounts[alias] = 1;
+        tick();
+    }
+    void used(uint16_t alias) {
+        if(mCounts[alias] < UINT16_MAX)
+            mCounts[alias] += 1;
+        tick();
+    }
+    uint16_t victim() {
+        uint16_t maximum = mCounts.size() - 1;
+        uint16_t ret = 0;
+        for(uint i = 0; i < std::min<uint>(SAMPLES, maximum); ++i) {
+            mCursor = mCursor % maximum + 1;
+            if(ret == 0 || mCounts[mCursor] < mCounts[ret]) {
+                ret = mCursor;
+            }
+        }
+        return ret;
+    }
+
+private:
+    void tick() {
+        if(++mUses < mDecayEvery)
+            return;
+        mUses = 0;
+        for(auto& count: mCounts) {
+            count /= 2;
+        }
+    }
+    std::vector<uint16_t> mCounts;
+    uint32_t mDecayEvery;
+    uint32_t mUses{0};
+    uint16_t mCursor{0};
+};
+
+/* Topic aliases (MQTT 5) of one connection, broker to client, within the TOPIC_ALIAS_MAXIMUM the client sent in its
+ * CONNECT. The first PUBLISH to a topic binds an alias and still carries the topic; later ones only carry the alias and
+ * an empty topic. When all aliases are bound, the eviction policy picks which one gets rebound.
+ */
+template<typename EvictionPolicy = LruAliasEviction>
+class OutboundTopicAliases final {
+public:
+    struct Assignment {
+        // 0 means don't use an alias
+        uint16_t alias{0};
+        // whether the topic has to be sent along, i.e. the alias was just (re)bound
+        bool sendTopic{true};
+    };
+
+    explicit OutboundTopicAliases(uint16_t maximum)
+    : mMaximum(maximum), mPolicy(maximum) {
+
+    }
+
+    Assignment assign(std::string_view topic) {
+        if(mMaximum == 0) {
+            return {};
+        }
+        auto it = mAliases.find(topic);
+        if(it != mAliases.end()) {
+            mPolicy.used(it->second);
+            return {it->second, false};
+        }
+        uint16_t alias;
+        // keys view the strings in mTopics, which a deque never moves
+        if(mTopics.size() < mMaximum) {
+            mTopics.emplace_back(topic);
+            alias = mTopics.size();
+            mAliases.emplace(mTopics.back(), alias);
+        } else {
+            alias = mPolicy.victim();
+            auto& slot = mTopics[alias - 1];
+            // reuse the map node and the string's memory, so rebinding doesn't allocate
+            auto node = mAliases.extract(slot);
+            slot.assign(topic.data(), topic.size());
+            node.key() = slot;
+            mAliases.insert(std::move(node));
+        }
+        mPolicy.assigned(alias);
+        return {alias, true};
+    }
+
+    // Encodes a complete PUBLISH packet for this connection, with alias and empty topic whenever possible.
+    template<template<typename> class Alloc>
+    void encodePublish(BinaryEncoder& encoder, const BasicMQTTPacket<Alloc>& packet, uint16_t packetId) {
+        auto assignment = assign(packet.topic);
+        PacketCodec<MQTTVersion::V5, MQTTMessageType::PUBLISH>::encode(encoder, packet, packetId, assignment.sendTopic ? std::string_view{packet.topic} : std::string_view{}, assignment.alias);
+    }
+
+    [[nodiscard]] uint16_t getMaximum() const {
+        return mMaximum;
+    }
+
+private:
+    uint16_t mMaximum;
+    EvictionPolicy mPolicy;
+    std::deque<std::string> mTopics;
+    std::unordered_map<std::string_view, uint16_t> mAliases;
+};
+
+}
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <optional>
 #include <stdexcept>
 #include <memory>
+#include <memory_resource>
 #include <vector>
 #include <string_view>
 #include <algorithm>
@@ -27,6 +28,7 @@ namespace nioev::lib {
 using uint = unsigned int;
 
 constexpr const char* LOG_TOPIC = "$NIOEV/log";
+constexpr const char* LATENCY_TOPIC = "$NIOEV/latency";
 
 template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
@@ -69,6 +71,11 @@ public:
             mBuffer = std::make_shared<std::vector<uint8_t>>();
         mBuffer->insert(mBuffer->end(), (uint8_t*)data, (uint8_t*)data + size);
     }
+    void resize(size_t newSize) {
+        if(!mBuffer)
+            mBuffer = std::make_shared<std::vector<uint8_t>>();
+        mBuffer->resize(newSize);
+    }
     void insert(size_t index, const void* data, size_t size) {
         if(!mBuffer) {
             if(index == 0) {
@@ -138,33 +145,200 @@ struct VarByteInt {
     uint8_t valueLength{0};
 };
 static inline VarByteInt encodeVarByteInt(uint32_t value) {
+    // values of 2^28 and above don't fit into the four bytes MQTT allows
+    if(value >= 268435456) {
+        throw std::runtime_error{"Var length integer too large: " + std::to_string(value)};
+    }
     VarByteInt ret;
-    size_t offset = 0;
-    do {
-        uint8_t encodeByte = value % 128;
-        value = value / 128;
-        // if there are more bytes to encode, set the upper bit
-        if(value > 0) {
-            encodeByte |= 128;
-        }
-        memcpy(&ret.value[offset], &encodeByte, 1);
-        offset += 1;
-    } while(value > 0);
-    ret.valueLength = offset;
+    ret.value[0] = (value & 0x7F) | 0x80;
+    ret.value[1] = ((value >> 7) & 0x7F) | 0x80;
+    ret.value[2] = ((value >> 14) & 0x7F) | 0x80;
+    ret.value[3] = value >> 21;
+    ret.valueLength = value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+    // the last byte has no continuation bit
+    ret.value[ret.valueLength - 1] &= 0x7F;
     return ret;
 }
 
-using MQTTPropertyValue = std::variant<uint8_t, uint16_t, std::vector<uint8_t>, std::string, std::pair<std::string, std::string>, uint32_t>;
-using PropertyList = std::unordered_multimap<MQTTProperty, MQTTPropertyValue>;
+/* Decodes a variable byte integer from at most `available` bytes. Returns how many bytes it took, 0 if it's incomplete
+ * and -1 if it's malformed (longer than four bytes).
+ */
+static inline int decodeVarByteInt(const uint8_t* data, size_t available, uint32_t& value) {
+    value = 0;
+    for(size_t i = 0; i < 4; ++i) {
+        if(i >= available) {
+            return 0;
+        }
+        value |= uint32_t(data[i] & 0x7F) << (7 * i);
+        if((data[i] & 0x80) == 0) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+// Bounds checked reader over a buffer that hands out views instead of copies.
+class ByteReader {
+public:
+    ByteReader(const uint8_t* data, size_t length)
+    : mData(data), mLength(length) {
+
+    }
+    uint8_t byte() {
+        require(1);
+        return mData[mOffset++];
+    }
+    uint16_t twoBytes() {
+        require(2);
+        uint16_t ret = (uint16_t(mData[mOffset]) << 8) | mData[mOffset + 1];
+        mOffset += 2;
+        return ret;
+    }
+    uint32_t fourBytes() {
+        require(4);
+        uint32_t ret = (uint32_t(mData[mOffset]) << 24) | (uint32_t(mData[mOffset + 1]) << 16) | (uint32_t(mData[mOffset + 2]) << 8) | mData[mOffset + 3];
+        mOffset += 4;
+        return ret;
+    }
+    uint32_t varByteInt() {
+        uint32_t value;
+        auto length = decodeVarByteInt(mData + mOffset, mLength - mOffset, value);
+        if(length <= 0) {
+            throw std::runtime_error{length == 0 ? "Out of bounds decoding" : "Failed to decode var length"};
+        }
+        mOffset += length;
+        return value;
+    }
+    std::string_view string() {
+        auto len = twoBytes();
+        return bytes(len);
+    }
+    std::string_view bytes(size_t len) {
+        require(len);
+        std::string_view ret{(const char*)mData + mOffset, len};
+        mOffset += len;
+        return ret;
+    }
+    std::string_view rest() {
+        return bytes(mLength - mOffset);
+    }
+    [[nodiscard]] bool empty() const {
+        return mOffset >= mLength;
+    }
+    [[nodiscard]] size_t remaining() const {
+        return mLength - mOffset;
+    }
+
+private:
+    void require(size_t len) {
+        if(len > mLength - mOffset) {
+            throw std::runtime_error{"Out of bounds decoding"};
+        }
+    }
+    const uint8_t* mData;
+    size_t mLength;
+    size_t mOffset{0};
+};
+
+/* Packets and property lists are templates over the allocator, so that they can live in an arena or a pool (see
+ * Memory.hpp). Alloc is std::allocator for the regular types below and std::pmr::polymorphic_allocator for the ones in
+ * nioev::lib::pmr.
+ */
+template<template<typename> class Alloc>
+using BasicString = std::basic_string<char, std::char_traits<char>, Alloc<char>>;
+template<template<typename> class Alloc>
+using BasicBytes = std::vector<uint8_t, Alloc<uint8_t>>;
+/* std::variant isn't allocator aware, so copying a property list into another memory resource would copy the strings
+ * inside it with their default allocator. The allocator-extended constructors make containers rebuild the value with
+ * theirs instead; otherwise it's the plain variant.
+ */
+template<template<typename> class Alloc>
+struct BasicMQTTPropertyValue : std::variant<uint8_t, uint16_t, BasicBytes<Alloc>, BasicString<Alloc>, std::pair<BasicString<Alloc>, BasicString<Alloc>>, uint32_t> {
+    using Variant = std::variant<uint8_t, uint16_t, BasicBytes<Alloc>, BasicString<Alloc>, std::pair<BasicString<Alloc>, BasicString<Alloc>>, uint32_t>;
+    using allocator_type = Alloc<char>;
+    using Variant::Variant;
+    using Variant::operator=;
+
+    BasicMQTTPropertyValue() = default;
+    BasicMQTTPropertyValue(const BasicMQTTPropertyValue&) = default;
+    BasicMQTTPropertyValue(BasicMQTTPropertyValue&&) = default;
+    BasicMQTTPropertyValue& operator=(const BasicMQTTPropertyValue&) = default;
+    BasicMQTTPropertyValue& operator=(BasicMQTTPropertyValue&&) = default;
+    BasicMQTTPropertyValue(const BasicMQTTPropertyValue& other, const allocator_type& alloc)
+    : Variant(withAllocator(static_cast<const Variant&>(other), alloc)) {
+
+    }
+    BasicMQTTPropertyValue(BasicMQTTPropertyValue&& other, const allocator_type& alloc)
+    : Variant(withAllocator(static_cast<Variant&&>(other), alloc)) {
 
-struct MQTTPacket {
-    std::string topic;
-    std::vector<uint8_t> payload;
+    }
+
+private:
+    template<typename Other>
+    static Variant withAllocator(Other&& other, const allocator_type& alloc) {
+        return std::visit(
+            [&](auto&& value) -> Variant {
+                using T = std::decay_t<decltype(value)>;
+                using Value = decltype(value);
+                if constexpr(std::is_same_v<T, BasicString<Alloc>> || std::is_same_v<T, BasicBytes<Alloc>>) {
+                    return Variant{std::in_place_type<T>, std::forward<Value>(value), alloc};
+                } else if constexpr(std::is_same_v<T, std::pair<BasicString<Alloc>, BasicString<Alloc>>>) {
+                    return Variant{std::in_place_type<T>, BasicString<Alloc>{std::forward<Value>(value).first, alloc}, BasicString<Alloc>{std::forward<Value>(value).second, alloc}};
+                } else {
+                    return Variant{std::in_place_type<T>, value};
+                }
+            },
+            std::forward<Other>(other));
+    }
+};
+template<template<typename> class Alloc>
+using BasicPropertyList = std::unordered_multimap<MQTTProperty, BasicMQTTPropertyValue<Alloc>, std::hash<MQTTProperty>, std::equal_to<MQTTProperty>,
+    Alloc<std::pair<const MQTTProperty, BasicMQTTPropertyValue<Alloc>>>>;
+
+template<template<typename> class Alloc>
+struct BasicMQTTPacket {
+    // makes containers with a polymorphic allocator pass theirs on to the packet
+    using allocator_type = Alloc<char>;
+
+    BasicString<Alloc> topic;
+    BasicBytes<Alloc> payload;
     QoS qos;
     Retain retain;
-    PropertyList properties;
+    BasicPropertyList<Alloc> properties;
+
+    BasicMQTTPacket() = default;
+    explicit BasicMQTTPacket(const allocator_type& alloc)
+    : topic(alloc), payload(alloc), properties(alloc) {
+
+    }
+    BasicMQTTPacket(BasicString<Alloc> topic, BasicBytes<Alloc> payload, QoS qos, Retain retain, BasicPropertyList<Alloc> properties)
+    : topic(std::move(topic)), payload(std::move(payload)), qos(qos), retain(retain), properties(std::move(properties)) {
+
+    }
+    BasicMQTTPacket(const BasicMQTTPacket&) = default;
+    BasicMQTTPacket(BasicMQTTPacket&&) = default;
+    BasicMQTTPacket& operator=(const BasicMQTTPacket&) = default;
+    BasicMQTTPacket& operator=(BasicMQTTPacket&&) = default;
+    BasicMQTTPacket(const BasicMQTTPacket& other, const allocator_type& alloc)
+    : topic(other.topic, alloc), payload(other.payload, alloc), qos(other.qos), retain(other.retain), properties(other.properties, alloc) {
+
+    }
+    BasicMQTTPacket(BasicMQTTPacket&& other, const allocator_type& alloc)
+    : topic(std::move(other.topic), alloc), payload(std::move(other.payload), alloc), qos(other.qos), retain(other.retain), properties(std::move(other.properties), alloc) {
+
+    }
 };
 
+using MQTTPropertyValue = BasicMQTTPropertyValue<std::allocator>;
+using PropertyList = BasicPropertyList<std::allocator>;
+using MQTTPacket = BasicMQTTPacket<std::allocator>;
+
+namespace pmr {
+using MQTTPropertyValue = BasicMQTTPropertyValue<std::pmr::polymorphic_allocator>;
+using PropertyList = BasicPropertyList<std::pmr::polymorphic_allocator>;
+using MQTTPacket = BasicMQTTPacket<std::pmr::polymorphic_allocator>;
+}
+
 class BinaryEncoder {
 public:
     void encodeByte(uint8_t value) {
@@ -178,11 +352,16 @@ public:
         value = htonl(value);
         mData.append((uint8_t*)&value, 4);
     }
-    void encodeString(const std::string& str) {
+    void encode8Bytes(uint64_t value) {
+        encode4Bytes(value >> 32);
+        encode4Bytes(value & 0xFFFFFFFF);
+    }
+    void encodeString(std::string_view str) {
         encode2Bytes(str.size());
-        mData.append(str.c_str(), str.size());
+        mData.append(str.data(), str.size());
     }
-    void encodeBytes(const std::vector<uint8_t>& data) {
+    template<typename Allocator>
+    void encodeBytes(const std::vector<uint8_t, Allocator>& data) {
         mData.append(data.data(), data.size());
     }
     void encodeBytes(const void* data, size_t len) {
@@ -192,6 +371,10 @@ public:
         return std::move(mData);
     }
     void encodePropertyList(const PropertyList& propertyList) {
+        encodePropertyList<std::allocator>(propertyList);
+    }
+    template<template<typename> class Alloc>
+    void encodePropertyList(const BasicPropertyList<Alloc>& propertyList) {
         auto start = mData.size();
         for(const auto& [propId, propValue] : propertyList) {
             encodeByte(static_cast<uint8_t>(propId));
@@ -207,14 +390,14 @@ public:
                 encode4Bytes(std::get<uint32_t>(propValue));
                 break;
             case MQTTPropertyType::UTF8String:
-                encodeString(std::get<std::string>(propValue));
+                encodeString(std::get<BasicString<Alloc>>(propValue));
                 break;
             case MQTTPropertyType::UTF8StringPair:
-                encodeString(std::get<std::pair<std::string, std::string>>(propValue).first);
-                encodeString(std::get<std::pair<std::string, std::string>>(propValue).second);
+                encodeString(std::get<std::pair<BasicString<Alloc>, BasicString<Alloc>>>(propValue).first);
+                encodeString(std::get<std::pair<BasicString<Alloc>, BasicString<Alloc>>>(propValue).second);
                 break;
             case MQTTPropertyType::BinaryData:
-                encodeBytes(std::get<std::vector<uint8_t>>(propValue));
+                encodeBytes(std::get<BasicBytes<Alloc>>(propValue));
                 break;
             default:
                 assert(0);
@@ -261,6 +444,16 @@ public:
         mOffset += len;
         return ret;
     }
+    // a length prefixed string or binary data, pointing into the decoded buffer
+    std::string_view decodeView() {
+        auto len = decode2Bytes();
+        if(len > mData.size() - mOffset) {
+            throw std::runtime_error{"Out of bounds string"};
+        }
+        std::string_view ret{(const char*)mData.data() + mOffset, len};
+        mOffset += len;
+        return ret;
+    }
     std::vector<uint8_t> decodeBytesWithPrefixLength() {
         auto len = decode2Bytes();
         if(len > mData.size() - mOffset) {
@@ -285,7 +478,7 @@ public:
     }
     uint32_t decode4Bytes() {
         if(4 > mData.size() - mOffset) {
-            throw std::runtime_error{"Out of bounds 2 bytes decoding"};
+            throw std::runtime_error{"Out of bounds 4 bytes decoding"};
         }
         uint32_t len;
         memcpy(&len, mData.data() + mOffset, 4);
@@ -293,6 +486,10 @@ public:
         mOffset += 4;
         return len;
     }
+    uint64_t decode8Bytes() {
+        uint64_t high = decode4Bytes();
+        return (high << 32) | decode4Bytes();
+    }
     const uint8_t *getCurrentPtr() {
         return mData.data() + mOffset;
     }
@@ -304,7 +501,7 @@ public:
         mOffset += length;
     }
     PayloadType getRemainingBytes() {
-        PayloadType ret((const char*)mData.data() + mOffset, mData.size());
+        PayloadType ret((const char*)mData.data() + mOffset, mData.size() - mOffset);
         mOffset = mData.size();
         return ret;
     }
@@ -312,29 +509,29 @@ public:
         return mOffset >= mUsableSize;
     }
     uint32_t decodeVarLengthInteger() {
-        uint32_t multiplier = 1;
-        uint32_t value = 0;
-        uint8_t encodedByte;
-        do {
-            encodedByte = decodeByte();
-            value += uint32_t(encodedByte & 127) * multiplier;
-            if(multiplier > 128 * 128 * 128) {
-                throw std::runtime_error{"Failed to decode var length"};
-            }
-            multiplier *= 128;
-        } while ((encodedByte & 128) != 0);
+        uint32_t value;
+        auto length = decodeVarByteInt(mData.data() + mOffset, mOffset < mData.size() ? mData.size() - mOffset : 0, value);
+        if(length <= 0) {
+            throw std::runtime_error{length == 0 ? "Out of bounds var length decoding" : "Failed to decode var length"};
+        }
+        mOffset += length;
         return value;
     }
     PropertyList decodeProperties() {
+        return decodeProperties<std::allocator>({});
+    }
+    // decodes into a property list whose strings and nodes all come from alloc
+    template<template<typename> class Alloc>
+    BasicPropertyList<Alloc> decodeProperties(const Alloc<char>& alloc) {
         uint32_t length = decodeVarLengthInteger();
         if(mOffset + length > mData.size()) {
             throw std::runtime_error{"Not enough space for properties"};
         }
-        PropertyList ret;
+        BasicPropertyList<Alloc> ret{alloc};
         uint32_t start = mOffset;
         while(mOffset - start < length) {
             auto property = byteToMQTTProperty(decodeByte());
-            MQTTPropertyValue value;
+            BasicMQTTPropertyValue<Alloc> value;
             switch(propertyToPropertyType(property)) {
             case MQTTPropertyType::Byte:
                 value = decodeByte();
@@ -348,16 +545,20 @@ public:
             case MQTTPropertyType::VarByteInt:
                 value = decodeVarLengthInteger();
                 break;
-            case MQTTPropertyType::BinaryData:
-                value = decodeBytesWithPrefixLength();
+            case MQTTPropertyType::BinaryData: {
+                auto bytes = decodeView();
+                value = BasicBytes<Alloc>(bytes.begin(), bytes.end(), alloc);
                 break;
+            }
             case MQTTPropertyType::UTF8String:
-                value = decodeString();
+                value = BasicString<Alloc>(decodeView(), alloc);
                 break;
-            case MQTTPropertyType::UTF8StringPair:
-                value = std::make_pair(decodeString(), decodeString());
+            case MQTTPropertyType::UTF8StringPair: {
+                BasicString<Alloc> key{decodeView(), alloc};
+                value = std::make_pair(std::move(key), BasicString<Alloc>(decodeView(), alloc));
                 break;
             }
+            }
             ret.emplace(property, std::move(value));
         }
         return ret;
@@ -513,6 +714,7 @@ inline std::string_view getFileStem(const std::string& filename) {
     return std::string_view{filename}.substr(start, end - start);
 }
 
+// Logs the elapsed time, for rare operations only. Use NIOEV_LATENCY_SCOPE from LatencyHistogram.hpp in hot paths.
 class Stopwatch {
 public:
     Stopwatch(const char* name)
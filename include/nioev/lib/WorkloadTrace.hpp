@@ -0,0 +1,145 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Util.hpp"
+
+namespace nioev::lib {
+
+enum class TraceEventType : uint8_t
+{
+    SUBSCRIBE = 1,
+    UNSUBSCRIBE = 2,
+    PUBLISH = 3,
+    DISCONNECT = 4
+};
+
+struct TraceEvent {
+    TraceEventType type{TraceEventType::PUBLISH};
+    // nanoseconds since the start of the trace
+    uint64_t timestamp{0};
+    uint32_t clientId{0};
+    // topic for PUBLISH, filter for (UN)SUBSCRIBE, empty for DISCONNECT
+    std::string topic;
+    QoS qos{QoS::QoS0};
+    Retain retain{Retain::No};
+    // only the size of the payload is recorded, never the content
+    uint32_t payloadSize{0};
+    uint16_t propertyCount{0};
+};
+
+/* Writes a compact binary trace of broker traffic:
+ *
+ *     "NIOEVTRC" version(1 byte) { event }*
+ *     event = type(1) flags(1) timestampDelta(varint) clientId(varint) topicRef(varint) [topicLength(varint) topic]
+ *             [payloadSize(varint) propertyCount(varint)]   <- PUBLISH only
+ *
+ * flags hold the QoS in the lower two bits and retain in bit 2. Varints are LEB128 and can hold 64 bits, unlike the
+ * MQTT ones. Topics are interned: topicRef is (index << 1) | isNew, and only new topics are followed by their text,
+ * so each distinct topic is stored once no matter how often it's published to.
+ *
+ * Recording is thread safe, events are buffered in memory and written out in large chunks.
+ */
+class TraceWriter final {
+public:
+    static constexpr const char MAGIC[8] = {'N', 'I', 'O', 'E', 'V', 'T', 'R', 'C'};
+    static constexpr uint8_t VERSION = 1;
+
+    explicit TraceWriter(const std::string& path);
+    ~TraceWriter();
+    TraceWriter(const TraceWriter&) = delete;
+    void operator=(const TraceWriter&) = delete;
+
+    void recordSubscribe(uint32_t clientId, const std::string& filter, QoS qos);
+    void recordUnsubscribe(uint32_t clientId, const std::string& filter);
+    void recordPublish(uint32_t clientId, const MQTTPacket& packet);
+    void recordDisconnect(uint32_t clientId);
+    // for events with their own timestamp, e.g. from the generator; timestamps must not decrease
+    void record(const TraceEvent& event);
+    void flush();
+
+private:
+    uint64_t now() const;
+    void writeVarInt(uint64_t value);
+    void flushLocked();
+
+    std::mutex mMutex;
+    FILE* mFile{nullptr};
+    std::vector<uint8_t> mBuffer;
+    std::unordered_map<std::string, uint64_t> mTopics;
+    uint64_t mLastTimestamp{0};
+    std::chrono::steady_clock::time_point mStart;
+};
+
+// Reads a whole trace into memory up front, so iterating it during a replay doesn't do any I/O.
+class TraceReader final {
+public:
+    explicit TraceReader(const std::string& path);
+    // nullopt at the end of the trace, throws on malformed data
+    std::optional<TraceEvent> next();
+    std::vector<TraceEvent> readAll();
+
+private:
+    uint64_t readVarInt();
+    uint8_t readByte();
+
+    std::vector<uint8_t> mData;
+    size_t mOffset{0};
+    std::vector<std::string> mTopics;
+    uint64_t mTimestamp{0};
+};
+
+/* Synthetic workload with the properties that microbenchmarks miss: an IoT style topic hierarchy
+ * (region/site/device/sensor), Zipf distributed topic popularity, subscriptions that mix exact filters and wildcards,
+ * subscribe/unsubscribe churn and clients that disconnect and come back.
+ */
+class WorkloadGenerator final {
+public:
+    struct Config {
+        uint32_t clients = 10000;
+        uint32_t regions = 10;
+        uint32_t sitesPerRegion = 20;
+        uint32_t devicesPerSite = 100;
+        uint32_t sensorsPerDevice = 5;
+        // s of the Zipf distribution over all topics, ~1 is typical for real traffic
+        double zipfExponent = 1.0;
+        uint32_t subscriptionsPerClient = 3;
+        // fraction of subscriptions that use + or #
+        double wildcardFraction = 0.2;
+        // of all events after the initial subscriptions, the rest are publishes
+        double churnFraction = 0.05;
+        double disconnectFraction = 0.005;
+        double eventsPerSecond = 100000;
+        uint32_t meanPayloadSize = 128;
+        uint64_t seed = 0x6E696F6576;
+    };
+    // Throws if the config yields no clients or no topics.
+    explicit WorkloadGenerator(Config config);
+
+    // Initial subscriptions of all clients followed by `events` mixed events.
+    std::vector<TraceEvent> generate(size_t events);
+    [[nodiscard]] size_t topicCount() const {
+        return mTopics.size();
+    }
+
+private:
+    std::string filterFor();
+    size_t zipfTopicIndex();
+    double uniform();
+
+    Config mConfig;
+    std::mt19937_64 mRandom;
+    std::vector<std::string> mTopics;
+    std::vector<double> mZipfCdf;
+    std::vector<std::vector<std::string>> mClientFilters;
+};
+
+}
\ No newline at end of file
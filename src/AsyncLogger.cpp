@@ -0,0 +1,311 @@
+#include "nioev/lib/AsyncLogger.hpp"
+#include "nioev/lib/IdleStrategy.hpp"
+
+#include <pthread.h>
+#include <ctime>
+
+namespace nioev::lib {
+
+struct AsyncLogger::Ring {
+    Ring(size_t capacity, std::string threadName, std::thread::id owner)
+    : slots(std::make_unique<LogRecord[]>(capacity)), mask(capacity - 1), threadName(std::move(threadName)), owner(owner) {
+
+    }
+    std::unique_ptr<LogRecord[]> slots;
+    const size_t mask;
+    const std::string threadName;
+    const std::thread::id owner;
+    alignas(64) std::atomic<uint64_t> head{0}; // written by the consumer
+    alignas(64) std::atomic<uint64_t> tail{0}; // written by the producer
+    std::atomic<uint64_t> dropped{0};
+};
+
+std::array<std::atomic<const AsyncLogger::FormatInfo*>, AsyncLogger::MAX_FORMATS> AsyncLogger::gFormats{};
+std::atomic<uint32_t> AsyncLogger::gFormatCount{0};
+std::atomic<uint64_t> AsyncLogger::gNextLoggerId{1};
+
+namespace {
+struct ThreadRingCache {
+    uint64_t loggerId{0};
+    void* ring{nullptr};
+};
+thread_local ThreadRingCache tRingCache;
+
+size_t roundUpToPowerOfTwo(size_t value) {
+    size_t ret = 1;
+    while(ret < value)
+        ret <<= 1;
+    return ret;
+}
+}
+
+AsyncLogger::AsyncLogger(Config config, PublishCallback publish)
+: mConfig(config), mPublish(std::move(publish)), mId(gNextLoggerId.fetch_add(1)) {
+    mConfig.ringCapacity = roundUpToPowerOfTwo(std::max<size_t>(mConfig.ringCapacity, 2));
+    mConfig.debugSampleEvery = std::max<uint32_t>(mConfig.debugSampleEvery, 1);
+    mFormatStates.resize(MAX_FORMATS);
+    mThread = std::thread{[this] { consumerThreadFunc(); }};
+}
+
+AsyncLogger::~AsyncLogger() {
+    mShouldRun = false;
+    mThread.join();
+}
+
+uint16_t AsyncLogger::registerFormat(const char* format, LogLevel level) {
+    auto id = gFormatCount.fetch_add(1);
+    if(id >= MAX_FORMATS) {
+        throw std::runtime_error{"Too many log formats, can't register " + std::string{format}};
+    }
+    // intentionally leaked, formats live as long as the process
+    gFormats[id].store(new FormatInfo{format, level}, std::memory_order_release);
+    return id;
+}
+
+void AsyncLogger::writeArg(uint8_t*& out, uint8_t* end, LogRecord::ArgType type, const void* data, size_t len) {
+    // arguments that don't fit anymore are left out, formatting prints them as <?>
+    if(out + 1 + len > end) {
+        return;
+    }
+    *out++ = static_cast<uint8_t>(type);
+    memcpy(out, data, len);
+    out += len;
+}
+
+void AsyncLogger::writeString(uint8_t*& out, uint8_t* end, std::string_view str) {
+    if(out + 2 > end) {
+        return;
+    }
+    size_t len = std::min<size_t>({str.size(), 255, static_cast<size_t>(end - out - 2)});
+    *out++ = static_cast<uint8_t>(LogRecord::ArgType::STRING);
+    *out++ = static_cast<uint8_t>(len);
+    memcpy(out, str.data(), len);
+    out += len;
+}
+
+void AsyncLogger::push(const LogRecord& record) {
+    auto& cache = tRingCache;
+    Ring* ring;
+    if(cache.loggerId == mId) {
+        ring = static_cast<Ring*>(cache.ring);
+    } else {
+        ring = &registerThread();
+    }
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+    if(tail - ring->head.load(std::memory_order_acquire) > ring->mask) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring->slots[tail & ring->mask] = record;
+    ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+AsyncLogger::Ring& AsyncLogger::registerThread() {
+    char name[16] = { 0 };
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    std::lock_guard<std::mutex> lock{mRingsMutex};
+    // a thread that alternates between loggers keeps its ring, only the cache is per thread
+    auto self = std::this_thread::get_id();
+    Ring* ring = nullptr;
+    for(auto& r: mRings) {
+        if(r->owner == self) {
+            ring = r.get();
+            break;
+        }
+    }
+    if(!ring) {
+        mRings.emplace_back(std::make_unique<Ring>(mConfig.ringCapacity, name, self));
+        ring = mRings.back().get();
+    }
+    tRingCache.loggerId = mId;
+    tRingCache.ring = ring;
+    return *ring;
+}
+
+void AsyncLogger::consumerThreadFunc() {
+    pthread_setname_np(pthread_self(), "async-log");
+    // nobody waits for the logger, so there's no point in burning CPU spinning
+    IdleStrategy idle{IdleStrategy::Config{0, 10, 100, 100}};
+    std::string batch;
+    size_t batchLines = 0;
+    std::optional<std::chrono::steady_clock::time_point> batchStart;
+    while(true) {
+        bool stopping = !mShouldRun.load(std::memory_order_acquire);
+        bool didWork = drain(batch, batchLines);
+        if(batchLines > 0) {
+            auto now = std::chrono::steady_clock::now();
+            if(!batchStart)
+                batchStart = now;
+            if(stopping || batchLines >= mConfig.maxBatchLines || now - *batchStart >= mConfig.maxBatchDelay) {
+                publishBatch(batch, batchLines);
+                batchStart.reset();
+            }
+        }
+        if(stopping) {
+            // flush everything that was logged before the shutdown, not just a single batch
+            while(drain(batch, batchLines) || batchLines > 0) {
+                if(batchLines > 0)
+                    publishBatch(batch, batchLines);
+            }
+            return;
+        }
+        idle.idle(didWork);
+    }
+}
+
+bool AsyncLogger::drain(std::string& batch, size_t& batchLines) {
+    bool didWork = false;
+    {
+        // only pick up newly registered rings under the lock, formatting happens outside of it
+        std::lock_guard<std::mutex> lock{mRingsMutex};
+        for(size_t i = mDrainRings.size(); i < mRings.size(); ++i) {
+            mDrainRings.push_back(mRings[i].get());
+        }
+    }
+    for(auto* ring: mDrainRings) {
+        auto head = ring->head.load(std::memory_order_relaxed);
+        auto tail = ring->tail.load(std::memory_order_acquire);
+        while(head != tail && batchLines < mConfig.maxBatchLines) {
+            const auto& record = ring->slots[head & ring->mask];
+            auto format = gFormats[record.formatId].load(std::memory_order_acquire);
+            if(format && admit(record, *format, batch, batchLines)) {
+                formatRecord(record, *format, ring->threadName, batch);
+                batchLines += 1;
+            }
+            head += 1;
+            didWork = true;
+        }
+        ring->head.store(head, std::memory_order_release);
+    }
+    return didWork;
+}
+
+bool AsyncLogger::admit(const LogRecord& record, const FormatInfo& format, std::string& batch, size_t& batchLines) {
+    auto& state = mFormatStates[record.formatId];
+    if(format.level <= LogLevel::DEBUG && mConfig.debugSampleEvery > 1) {
+        if(state.sampleCounter++ % mConfig.debugSampleEvery != 0) {
+            mDroppedSampling.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    if(mConfig.maxRecordsPerSecondPerFormat == 0) {
+        return true;
+    }
+    int64_t second = record.timestamp / 1000000000;
+    if(second != state.windowStart) {
+        if(state.suppressed > 0) {
+            static const FormatInfo suppressedFormat{"Rate limit suppressed {} messages like '{}'", LogLevel::WARN};
+            LogRecord note{};
+            note.timestamp = record.timestamp;
+            uint8_t* out = note.args;
+            uint8_t* end = note.args + LogRecord::ARGS_SIZE;
+            encodeArg(out, end, state.suppressed);
+            encodeArg(out, end, format.format);
+            note.argCount = 2;
+            note.argBytes = out - note.args;
+            formatRecord(note, suppressedFormat, "async-log", batch);
+            batchLines += 1;
+        }
+        state.windowStart = second;
+        state.inWindow = 0;
+        state.suppressed = 0;
+    }
+    if(state.inWindow >= mConfig.maxRecordsPerSecondPerFormat) {
+        state.suppressed += 1;
+        mDroppedRateLimited.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    state.inWindow += 1;
+    return true;
+}
+
+void AsyncLogger::formatRecord(const LogRecord& record, const FormatInfo& format, const std::string& threadName, std::string& out) {
+    // same layout as LOG_PATTERN: [%Y-%m-%d %H:%M:%S.%e] [%-7l] [%-15N] %v
+    char buffer[128];
+    time_t seconds = record.timestamp / 1000000000;
+    auto millis = (record.timestamp / 1000000) % 1000;
+    tm time{};
+    localtime_r(&seconds, &time);
+    auto len = strftime(buffer, sizeof(buffer), "[%Y-%m-%d %H:%M:%S", &time);
+    snprintf(buffer + len, sizeof(buffer) - len, ".%03lu] [%-7s] [%-15s] ", static_cast<unsigned long>(millis), logLevelToString(format.level), threadName.c_str());
+    out += buffer;
+
+    const uint8_t* arg = record.args;
+    const uint8_t* argsEnd = record.args + record.argBytes;
+    auto appendNextArg = [&] {
+        if(arg >= argsEnd) {
+            out += "<?>";
+            return;
+        }
+        auto type = static_cast<LogRecord::ArgType>(*arg++);
+        switch(type) {
+        case LogRecord::ArgType::INT: {
+            int64_t v;
+            memcpy(&v, arg, 8);
+            arg += 8;
+            out += std::to_string(v);
+            break;
+        }
+        case LogRecord::ArgType::UINT: {
+            uint64_t v;
+            memcpy(&v, arg, 8);
+            arg += 8;
+            out += std::to_string(v);
+            break;
+        }
+        case LogRecord::ArgType::DOUBLE: {
+            double v;
+            memcpy(&v, arg, 8);
+            arg += 8;
+            snprintf(buffer, sizeof(buffer), "%g", v);
+            out += buffer;
+            break;
+        }
+        case LogRecord::ArgType::BOOL:
+            out += *arg++ ? "true" : "false";
+            break;
+        case LogRecord::ArgType::STRING: {
+            auto strLen = *arg++;
+            out.append(reinterpret_cast<const char*>(arg), strLen);
+            arg += strLen;
+            break;
+        }
+        }
+    };
+    for(const char* c = format.format; *c; ++c) {
+        if(c[0] == '{' && c[1] == '}') {
+            appendNextArg();
+            c += 1;
+        } else {
+            out += *c;
+        }
+    }
+    out += '\n';
+}
+
+void AsyncLogger::publishBatch(std::string& batch, size_t& batchLines) {
+    SharedBuffer buffer;
+    buffer.append(batch.data(), batch.size());
+    mPublish(LOG_TOPIC, std::move(buffer));
+    mPublishedLines.fetch_add(batchLines, std::memory_order_relaxed);
+    mPublishedBatches.fetch_add(1, std::memory_order_relaxed);
+    batch.clear();
+    batchLines = 0;
+}
+
+AsyncLogger::Stats AsyncLogger::getStats() const {
+    Stats ret;
+    {
+        std::lock_guard<std::mutex> lock{mRingsMutex};
+        for(auto& ring: mRings) {
+            ret.droppedRingFull += ring->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    ret.droppedRateLimited = mDroppedRateLimited.load(std::memory_order_relaxed);
+    ret.droppedSampling = mDroppedSampling.load(std::memory_order_relaxed);
+    ret.publishedLines = mPublishedLines.load(std::memory_order_relaxed);
+    ret.publishedBatches = mPublishedBatches.load(std::memory_order_relaxed);
+    return ret;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,520 @@
+#include "nioev/lib/BatchedSender.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef NIOEV_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace nioev::lib {
+
+struct BatchedSender::Socket {
+    int fd{-1};
+    SendQueue queue;
+    // in mDirty
+    bool dirty{false};
+    // an io_uring operation references this socket
+    bool inflight{false};
+    bool failed{false};
+    bool removed{false};
+    // bytes the sendmsg in flight was asked to write
+    size_t requested{0};
+    std::vector<iovec> iovecs;
+    msghdr message{};
+};
+
+// user_data of POLL_ADD operations, sockets are at least 8 byte aligned so the lowest bit is free
+static constexpr uint64_t POLL_TAG = 1;
+static constexpr uint64_t CANCEL_USER_DATA = 0;
+
+#ifdef NIOEV_HAS_IO_URING
+struct BatchedSender::Ring {
+    int fd{-1};
+    void* rings{nullptr};
+    size_t ringsSize{0};
+    io_uring_sqe* sqes{nullptr};
+    size_t sqesSize{0};
+    uint32_t* sqHead{nullptr};
+    uint32_t* sqTail{nullptr};
+    uint32_t sqMask{0};
+    uint32_t sqEntries{0};
+    uint32_t* sqArray{nullptr};
+    uint32_t* cqHead{nullptr};
+    uint32_t* cqTail{nullptr};
+    uint32_t cqMask{0};
+    uint32_t cqEntries{0};
+    io_uring_cqe* cqes{nullptr};
+    // prepared but not yet passed to io_uring_enter
+    uint32_t toSubmit{0};
+
+    ~Ring() {
+        if(sqes)
+            munmap(sqes, sqesSize);
+        if(rings)
+            munmap(rings, ringsSize);
+        if(fd >= 0)
+            close(fd);
+    }
+    // Sets up the ring, false if io_uring or one of the features we rely on isn't available.
+    bool setup(uint32_t entries) {
+        io_uring_params params{};
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if(fd < 0) {
+            return false;
+        }
+        uint32_t required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+        if((params.features & required) != required) {
+            return false;
+        }
+        ringsSize = std::max(params.sq_off.array + params.sq_entries * sizeof(uint32_t), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        auto mapped = mmap(nullptr, ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if(mapped == MAP_FAILED) {
+            return false;
+        }
+        rings = mapped;
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        mapped = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(mapped == MAP_FAILED) {
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(mapped);
+        auto base = static_cast<uint8_t*>(rings);
+        sqHead = reinterpret_cast<uint32_t*>(base + params.sq_off.head);
+        sqTail = reinterpret_cast<uint32_t*>(base + params.sq_off.tail);
+        sqMask = *reinterpret_cast<uint32_t*>(base + params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        sqArray = reinterpret_cast<uint32_t*>(base + params.sq_off.array);
+        cqHead = reinterpret_cast<uint32_t*>(base + params.cq_off.head);
+        cqTail = reinterpret_cast<uint32_t*>(base + params.cq_off.tail);
+        cqMask = *reinterpret_cast<uint32_t*>(base + params.cq_off.ring_mask);
+        cqEntries = params.cq_entries;
+        cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+        return true;
+    }
+    // nullptr if the submission queue is full
+    io_uring_sqe* nextSqe() {
+        auto tail = *sqTail;
+        if(tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            return nullptr;
+        }
+        auto index = tail & sqMask;
+        auto sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit += 1;
+        return sqe;
+    }
+};
+#else
+struct BatchedSender::Ring {
+    uint32_t toSubmit{0};
+};
+#endif
+
+BatchedSender::BatchedSender(Config config, ErrorCallback onError)
+: mConfig(config), mOnError(std::move(onError)) {
+    mConfig.maxIovecs = std::clamp<size_t>(mConfig.maxIovecs, 1, IOV_MAX);
+#ifdef NIOEV_HAS_IO_URING
+    if(mConfig.backend == SendBackend::IO_URING) {
+        auto ring = std::make_unique<Ring>();
+        if(ring->setup(mConfig.ringEntries)) {
+            mRing = std::move(ring);
+            mBackend = SendBackend::IO_URING;
+            return;
+        }
+    }
+#endif
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(mEpollFd < 0) {
+        throwErrno("Failed to create epoll instance");
+    }
+    mBackend = SendBackend::EPOLL;
+}
+
+BatchedSender::~BatchedSender() {
+#ifdef NIOEV_HAS_IO_URING
+    if(mRing) {
+        // the kernel may still read iovecs and buffers of operations in flight, so cancel them and wait until they're
+        // all done before freeing anything; retired sockets are only freed by their completion
+        for(auto& [fd, socket]: mSockets) {
+            socket->removed = true;
+            if(socket->inflight)
+                mRetired.emplace_back(std::move(socket));
+        }
+        mSockets.clear();
+        try {
+            // submitting can reap completions and with them free retired sockets, so don't iterate mRetired itself
+            std::vector<Socket*> retired;
+            for(auto& socket: mRetired) {
+                retired.push_back(socket.get());
+            }
+            for(auto socket: retired) {
+                if(std::any_of(mRetired.begin(), mRetired.end(), [&](auto& r) { return r.get() == socket; }))
+                    submitCancel(*socket);
+            }
+            // bounded, closing the ring cancels whatever is left anyway
+            for(int i = 0; i < 50 && mInflight > 0; ++i) {
+                submitRing(1, std::chrono::milliseconds{100});
+                reapCompletions();
+            }
+        } catch(...) {
+        }
+        mErrors.clear();
+    }
+#endif
+    if(mEpollFd >= 0) {
+        close(mEpollFd);
+    }
+}
+
+void BatchedSender::addSocket(int fd) {
+    auto socket = std::make_unique<Socket>();
+    socket->fd = fd;
+    socket->iovecs.resize(mConfig.maxIovecs);
+    if(mBackend == SendBackend::EPOLL) {
+        epoll_event event{};
+        event.events = EPOLLOUT | EPOLLET;
+        event.data.ptr = socket.get();
+        if(epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throwErrno("Failed to add socket to epoll");
+        }
+    }
+    if(!mSockets.emplace(fd, std::move(socket)).second) {
+        throw std::runtime_error{"Socket " + std::to_string(fd) + " was already added"};
+    }
+}
+
+void BatchedSender::removeSocket(int fd) {
+    auto it = mSockets.find(fd);
+    if(it == mSockets.end()) {
+        return;
+    }
+    auto& socket = *it->second;
+    socket.removed = true;
+    if(socket.dirty) {
+        mDirty.erase(std::find(mDirty.begin(), mDirty.end(), &socket));
+        socket.dirty = false;
+    }
+    if(mBackend == SendBackend::EPOLL) {
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    if(!socket.inflight) {
+        mSockets.erase(it);
+        return;
+    }
+    // a SENDMSG in flight still points into the queue, so it stays intact until handleCompletion() frees the socket
+    mRetired.emplace_back(std::move(it->second));
+    mSockets.erase(it);
+    submitCancel(*mRetired.back());
+    submitRing(0, std::chrono::milliseconds{0});
+}
+
+bool BatchedSender::enqueue(int fd, SharedBuffer buffer) {
+    auto it = mSockets.find(fd);
+    if(it == mSockets.end() || it->second->failed) {
+        return false;
+    }
+    auto& socket = *it->second;
+    if(mConfig.maxQueuedBytes > 0 && socket.queue.bytes() >= mConfig.maxQueuedBytes) {
+        return false;
+    }
+    socket.queue.push(std::move(buffer));
+    markDirty(socket);
+    return true;
+}
+
+void BatchedSender::flush() {
+    if(mRing) {
+        reapCompletions();
+    }
+    for(size_t i = 0; i < mDirty.size(); ++i) {
+        auto& socket = *mDirty[i];
+        socket.dirty = false;
+        if(socket.failed || socket.queue.empty()) {
+            continue;
+        }
+        if(mRing) {
+            if(!socket.inflight) {
+                submitSend(socket);
+            }
+        } else {
+            sendNow(socket);
+        }
+    }
+    mDirty.clear();
+    if(mRing && mRing->toSubmit > 0) {
+        submitRing(0, std::chrono::milliseconds{0});
+    }
+    reportErrors();
+}
+
+size_t BatchedSender::poll(std::chrono::milliseconds timeout) {
+    flush();
+    size_t ret = 0;
+    if(mRing) {
+        if(mInflight == 0) {
+            return 0;
+        }
+        submitRing(1, timeout);
+        ret = reapCompletions();
+    } else {
+        epoll_event events[64];
+        int count;
+        do {
+            count = epoll_wait(mEpollFd, events, std::size(events), timeout.count() < 0 ? -1 : timeout.count());
+            mStats.syscalls += 1;
+        } while(count < 0 && errno == EINTR);
+        if(count < 0) {
+            throwErrno("Failed to wait for sockets");
+        }
+        for(int i = 0; i < count; ++i) {
+            auto& socket = *static_cast<Socket*>(events[i].data.ptr);
+            if(!socket.queue.empty()) {
+                markDirty(socket);
+            }
+        }
+        ret = count;
+    }
+    flush();
+    return ret;
+}
+
+size_t BatchedSender::pendingBytes(int fd) const {
+    auto it = mSockets.find(fd);
+    if(it == mSockets.end()) {
+        return 0;
+    }
+    return it->second->queue.bytes();
+}
+
+void BatchedSender::markDirty(Socket& socket) {
+    if(!socket.dirty) {
+        socket.dirty = true;
+        mDirty.push_back(&socket);
+    }
+}
+
+void BatchedSender::fail(Socket& socket, int error) {
+    socket.failed = true;
+    socket.queue.clear();
+    mStats.errors += 1;
+    // reported once we're done iterating, so the callback may remove the socket
+    mErrors.emplace_back(socket.fd, error);
+}
+
+void BatchedSender::reportErrors() {
+    while(!mErrors.empty()) {
+        auto errors = std::move(mErrors);
+        mErrors.clear();
+        if(!mOnError)
+            continue;
+        for(auto [fd, error]: errors) {
+            mOnError(fd, error);
+        }
+    }
+}
+
+void BatchedSender::sendNow(Socket& socket) {
+    // edge triggered, so keep writing until the socket is full or there's nothing left
+    while(!socket.queue.empty()) {
+        auto& message = socket.message;
+        message.msg_iov = socket.iovecs.data();
+        message.msg_iovlen = socket.queue.fillIovecs(socket.iovecs.data(), socket.iovecs.size());
+        size_t requested = 0;
+        for(size_t i = 0; i < message.msg_iovlen; ++i) {
+            requested += socket.iovecs[i].iov_len;
+        }
+        auto result = sendmsg(socket.fd, &message, MSG_NOSIGNAL);
+        mStats.syscalls += 1;
+        mStats.sends += 1;
+        if(result < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                mStats.wouldBlock += 1;
+                return;
+            }
+            fail(socket, errno);
+            return;
+        }
+        if(size_t(result) < requested)
+            mStats.partialSends += 1;
+        mStats.bytesSent += result;
+        socket.queue.consume(result);
+    }
+}
+
+#ifdef NIOEV_HAS_IO_URING
+void BatchedSender::submitSend(Socket& socket) {
+    auto sqe = mRing->nextSqe();
+    if(!sqe) {
+        submitRing(0, std::chrono::milliseconds{0});
+        sqe = mRing->nextSqe();
+    }
+    if(!sqe) {
+        // the kernel hasn't consumed anything yet, try again on the next flush
+        markDirty(socket);
+        return;
+    }
+    auto& message = socket.message;
+    message.msg_iov = socket.iovecs.data();
+    message.msg_iovlen = socket.queue.fillIovecs(socket.iovecs.data(), socket.iovecs.size());
+    socket.requested = 0;
+    for(size_t i = 0; i < message.msg_iovlen; ++i) {
+        socket.requested += socket.iovecs[i].iov_len;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&message);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<uint64_t>(&socket);
+    socket.inflight = true;
+    mInflight += 1;
+    mStats.sends += 1;
+}
+
+void BatchedSender::submitPollOut(Socket& socket) {
+    auto sqe = mRing->nextSqe();
+    if(!sqe) {
+        submitRing(0, std::chrono::milliseconds{0});
+        sqe = mRing->nextSqe();
+    }
+    if(!sqe) {
+        markDirty(socket);
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = socket.fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = reinterpret_cast<uint64_t>(&socket) | POLL_TAG;
+    socket.inflight = true;
+    mInflight += 1;
+}
+
+// Cancels whichever operation the socket has in flight, its completion then comes back with -ECANCELED.
+void BatchedSender::submitCancel(Socket& socket) {
+    for(auto tag: {uint64_t{0}, POLL_TAG}) {
+        io_uring_sqe* sqe;
+        while(!(sqe = mRing->nextSqe())) {
+            submitRing(0, std::chrono::milliseconds{0});
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = reinterpret_cast<uint64_t>(&socket) | tag;
+        sqe->user_data = CANCEL_USER_DATA;
+    }
+}
+
+size_t BatchedSender::reapCompletions() {
+    size_t ret = 0;
+    while(true) {
+        // reloaded every time, handling a completion can end up reaping further ones
+        auto head = *mRing->cqHead;
+        if(head == __atomic_load_n(mRing->cqTail, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        auto& cqe = mRing->cqes[head & mRing->cqMask];
+        auto userData = cqe.user_data;
+        auto result = cqe.res;
+        __atomic_store_n(mRing->cqHead, head + 1, __ATOMIC_RELEASE);
+        if(userData != CANCEL_USER_DATA) {
+            handleCompletion(userData, result);
+            ret += 1;
+        }
+    }
+    return ret;
+}
+
+void BatchedSender::handleCompletion(uint64_t userData, int32_t result) {
+    auto& socket = *reinterpret_cast<Socket*>(userData & ~POLL_TAG);
+    socket.inflight = false;
+    mInflight -= 1;
+    if(socket.removed) {
+        mRetired.erase(std::find_if(mRetired.begin(), mRetired.end(), [&](auto& retired) { return retired.get() == &socket; }));
+        return;
+    }
+    if(userData & POLL_TAG) {
+        // writable or in an error state, the next send tells which
+        if(result != -ECANCELED)
+            markDirty(socket);
+        return;
+    }
+    if(result >= 0) {
+        if(size_t(result) < socket.requested)
+            mStats.partialSends += 1;
+        mStats.bytesSent += result;
+        socket.queue.consume(result);
+        if(!socket.queue.empty())
+            markDirty(socket);
+    } else if(result == -EAGAIN || result == -EWOULDBLOCK) {
+        mStats.wouldBlock += 1;
+        submitPollOut(socket);
+    } else if(result == -EINTR) {
+        markDirty(socket);
+    } else {
+        fail(socket, -result);
+    }
+}
+
+void BatchedSender::submitRing(uint32_t waitFor, std::chrono::milliseconds timeout) {
+    __kernel_timespec ts{};
+    io_uring_getevents_arg arg{};
+    uint32_t flags = 0;
+    if(waitFor > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if(timeout.count() >= 0) {
+            ts.tv_sec = timeout.count() / 1000;
+            ts.tv_nsec = (timeout.count() % 1000) * 1'000'000;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    }
+    while(true) {
+        auto result = syscall(__NR_io_uring_enter, mRing->fd, mRing->toSubmit, waitFor, flags, waitFor > 0 ? &arg : nullptr, sizeof(arg));
+        mStats.syscalls += 1;
+        if(result >= 0) {
+            mRing->toSubmit -= result;
+            return;
+        }
+        if(errno == ETIME || errno == EINTR) {
+            return;
+        }
+        if(errno == EAGAIN || errno == EBUSY) {
+            // out of completion space in the kernel, make some and try again
+            reapCompletions();
+            continue;
+        }
+        throwErrno("Failed to submit to io_uring");
+    }
+}
+#else
+void BatchedSender::submitSend(Socket&) {
+}
+
+void BatchedSender::submitPollOut(Socket&) {
+}
+
+void BatchedSender::submitCancel(Socket&) {
+}
+
+size_t BatchedSender::reapCompletions() {
+    return 0;
+}
+
+void BatchedSender::handleCompletion(uint64_t, int32_t) {
+}
+
+void BatchedSender::submitRing(uint32_t, std::chrono::milliseconds) {
+}
+#endif
+
+}
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "nioev/lib/Compression.hpp"
+#include "nioev/lib/LatencyHistogram.hpp"
+
+#include <mutex>
+
+#ifdef NIOEV_HAS_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+namespace nioev::lib {
+
+struct PayloadCompressor::Dictionary {
+    uint32_t id{0};
+    std::vector<uint8_t> content;
+#ifdef NIOEV_HAS_ZSTD
+    ZSTD_CDict* cdict{nullptr};
+    ZSTD_DDict* ddict{nullptr};
+#endif
+    std::atomic<uint64_t> compressedPayloads{0};
+    std::atomic<uint64_t> skippedPayloads{0};
+    std::atomic<uint64_t> inputBytes{0};
+    std::atomic<uint64_t> outputBytes{0};
+    std::atomic<uint64_t> compressTicks{0};
+    std::atomic<uint64_t> decompressedPayloads{0};
+    std::atomic<uint64_t> decompressTicks{0};
+
+    ~Dictionary() {
+#ifdef NIOEV_HAS_ZSTD
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+#endif
+    }
+};
+
+struct PayloadCompressor::Prefix {
+    std::string name;
+    // read with std::atomic_load, so compressing threads see a swap without taking a lock
+    std::shared_ptr<Dictionary> current;
+    // the last keepDictionaries dictionaries of this prefix, oldest first and including the current one, guarded by mMutex
+    std::vector<std::shared_ptr<Dictionary>> dictionaries;
+    std::atomic<uint64_t> seen{0};
+    std::mutex samplesMutex;
+    std::vector<uint8_t> samples;
+    std::vector<size_t> sampleSizes;
+};
+
+struct PayloadCompressor::PeriodicTraining {
+    std::mutex mutex;
+    // nullptr once the compressor is gone
+    PayloadCompressor* compressor;
+};
+
+#ifdef NIOEV_HAS_ZSTD
+namespace {
+struct ContextDeleter {
+    void operator()(ZSTD_CCtx* context) const {
+        ZSTD_freeCCtx(context);
+    }
+    void operator()(ZSTD_DCtx* context) const {
+        ZSTD_freeDCtx(context);
+    }
+};
+
+ZSTD_CCtx* compressionContext() {
+    thread_local std::unique_ptr<ZSTD_CCtx, ContextDeleter> context{ZSTD_createCCtx()};
+    return context.get();
+}
+
+ZSTD_DCtx* decompressionContext() {
+    thread_local std::unique_ptr<ZSTD_DCtx, ContextDeleter> context{ZSTD_createDCtx()};
+    return context.get();
+}
+}
+#endif
+
+PayloadCompressor::PayloadCompressor(Config config)
+: mConfig(config) {
+
+}
+
+PayloadCompressor::~PayloadCompressor() {
+    stopTrainingPeriodically();
+}
+
+bool PayloadCompressor::isAvailable() {
+#ifdef NIOEV_HAS_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string_view PayloadCompressor::prefixOf(std::string_view topic) const {
+    size_t end = 0;
+    for(uint level = 0; level < mConfig.prefixLevels; ++level) {
+        end = topic.find('/', end + (level > 0 ? 1 : 0));
+        if(end == std::string_view::npos) {
+            return topic;
+        }
+    }
+    return topic.substr(0, end);
+}
+
+PayloadCompressor::Prefix* PayloadCompressor::findPrefix(std::string_view name) const {
+    std::shared_lock<std::shared_mutex> lock{mMutex};
+    auto it = mPrefixes.find(name);
+    if(it == mPrefixes.end()) {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+PayloadCompressor::Prefix& PayloadCompressor::getPrefix(std::string_view name, bool capped) {
+    if(auto prefix = findPrefix(name)) {
+        return *prefix;
+    }
+    std::unique_lock<std::shared_mutex> lock{mMutex};
+    if(capped && name != OTHER_PREFIX && !mPrefixes.count(name)) {
+        if(mCappedPrefixes >= mConfig.maxPrefixes) {
+            name = OTHER_PREFIX;
+        } else {
+            mCappedPrefixes += 1;
+        }
+    }
+    auto& prefix = mPrefixes[std::string{name}];
+    if(!prefix) {
+        prefix = std::make_unique<Prefix>();
+        prefix->name = std::string{name};
+        // until the first dictionary is trained, payloads are compressed without one; this just collects their stats
+        prefix->current = std::make_shared<Dictionary>();
+        prefix->dictionaries.emplace_back(prefix->current);
+    }
+    return *prefix;
+}
+
+void PayloadCompressor::sample(Prefix& prefix, const SharedBuffer& payload) {
+    if(prefix.seen.fetch_add(1, std::memory_order_relaxed) % mConfig.sampleEvery != 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock{prefix.samplesMutex};
+    if(prefix.sampleSizes.size() >= mConfig.samplesForTraining) {
+        return;
+    }
+    auto size = std::min(payload.size(), mConfig.maxSampleSize);
+    prefix.samples.insert(prefix.samples.end(), payload.data(), payload.data() + size);
+    prefix.sampleSizes.push_back(size);
+}
+
+std::optional<SharedBuffer> PayloadCompressor::compress(std::string_view topic, const SharedBuffer& payload) {
+    if(payload.size() < mConfig.minSize) {
+        // small payloads only count towards prefixes that exist anyway
+        if(auto prefix = findPrefix(prefixOf(topic))) {
+            std::atomic_load(&prefix->current)->skippedPayloads.fetch_add(1, std::memory_order_relaxed);
+        }
+        return {};
+    }
+    auto& prefix = getPrefix(prefixOf(topic), true);
+    auto dictionary = std::atomic_load(&prefix.current);
+    sample(prefix, payload);
+#ifdef NIOEV_HAS_ZSTD
+    auto start = readLatencyTicks();
+    SharedBuffer ret;
+    ret.resize(ZSTD_compressBound(payload.size()));
+    size_t size;
+    if(dictionary->cdict) {
+        size = ZSTD_compress_usingCDict(compressionContext(), ret.data(), ret.size(), payload.data(), payload.size(), dictionary->cdict);
+    } else {
+        size = ZSTD_compressCCtx(compressionContext(), ret.data(), ret.size(), payload.data(), payload.size(), mConfig.level);
+    }
+    dictionary->compressTicks.fetch_add(readLatencyTicks() - start, std::memory_order_relaxed);
+    if(ZSTD_isError(size) || size >= payload.size()) {
+        dictionary->skippedPayloads.fetch_add(1, std::memory_order_relaxed);
+        return {};
+    }
+    ret.resize(size);
+    dictionary->compressedPayloads.fetch_add(1, std::memory_order_relaxed);
+    dictionary->inputBytes.fetch_add(payload.size(), std::memory_order_relaxed);
+    dictionary->outputBytes.fetch_add(size, std::memory_order_relaxed);
+    return ret;
+#else
+    dictionary->skippedPayloads.fetch_add(1, std::memory_order_relaxed);
+    return {};
+#endif
+}
+
+SharedBuffer PayloadCompressor::decompress(const SharedBuffer& compressed) {
+#ifdef NIOEV_HAS_ZSTD
+    auto contentSize = ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+    if(contentSize == ZSTD_CONTENTSIZE_ERROR) {
+        throw std::runtime_error{"Invalid zstd frame"};
+    }
+    if(contentSize == ZSTD_CONTENTSIZE_UNKNOWN) {
+        throw std::runtime_error{"zstd frame without content size"};
+    }
+    if(contentSize > mConfig.maxDecompressedSize) {
+        throw std::runtime_error{"Decompressed payload too large: " + std::to_string(contentSize)};
+    }
+    std::shared_ptr<Dictionary> dictionary;
+    auto dictionaryId = ZSTD_getDictID_fromFrame(compressed.data(), compressed.size());
+    if(dictionaryId != 0) {
+        dictionary = findDictionary(dictionaryId);
+        if(!dictionary) {
+            throw std::runtime_error{"Unknown zstd dictionary " + std::to_string(dictionaryId)};
+        }
+    }
+    auto start = readLatencyTicks();
+    SharedBuffer ret;
+    ret.resize(contentSize);
+    size_t size;
+    if(dictionary) {
+        size = ZSTD_decompress_usingDDict(decompressionContext(), ret.data(), ret.size(), compressed.data(), compressed.size(), dictionary->ddict);
+    } else {
+        size = ZSTD_decompressDCtx(decompressionContext(), ret.data(), ret.size(), compressed.data(), compressed.size());
+    }
+    if(ZSTD_isError(size) || size != contentSize) {
+        throw std::runtime_error{std::string{"Failed to decompress payload: "} + (ZSTD_isError(size) ? ZSTD_getErrorName(size) : "size mismatch")};
+    }
+    if(dictionary) {
+        dictionary->decompressTicks.fetch_add(readLatencyTicks() - start, std::memory_order_relaxed);
+        dictionary->decompressedPayloads.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ret;
+#else
+    (void)compressed;
+    throw std::runtime_error{"Built without zstd support"};
+#endif
+}
+
+void PayloadCompressor::trainDictionaries() {
+#ifdef NIOEV_HAS_ZSTD
+    std::vector<Prefix*> prefixes;
+    {
+        std::shared_lock<std::shared_mutex> lock{mMutex};
+        for(auto& [name, prefix]: mPrefixes) {
+            prefixes.push_back(prefix.get());
+        }
+    }
+    for(auto prefix: prefixes) {
+        std::vector<uint8_t> samples;
+        std::vector<size_t> sampleSizes;
+        {
+            std::lock_guard<std::mutex> lock{prefix->samplesMutex};
+            if(prefix->sampleSizes.size() < mConfig.samplesForTraining) {
+                continue;
+            }
+            samples.swap(prefix->samples);
+            sampleSizes.swap(prefix->sampleSizes);
+        }
+        std::vector<uint8_t> content(mConfig.dictionarySize);
+        auto size = ZDICT_trainFromBuffer(content.data(), content.size(), samples.data(), sampleSizes.data(), sampleSizes.size());
+        if(ZDICT_isError(size)) {
+            // usually too few or too uniform samples; try again with the next batch
+            continue;
+        }
+        content.resize(size);
+        uint32_t id;
+        {
+            std::unique_lock<std::shared_mutex> lock{mMutex};
+            id = mNextDictionaryId++;
+        }
+        // the trainer picks a random id, ours are unique; it's stored little endian right after the magic number
+        for(int i = 0; i < 4; ++i) {
+            content.at(4 + i) = (id >> (8 * i)) & 0xFF;
+        }
+        auto dictionary = std::make_shared<Dictionary>();
+        dictionary->id = id;
+        dictionary->content = std::move(content);
+        dictionary->cdict = ZSTD_createCDict(dictionary->content.data(), dictionary->content.size(), mConfig.level);
+        dictionary->ddict = ZSTD_createDDict(dictionary->content.data(), dictionary->content.size());
+        if(!dictionary->cdict || !dictionary->ddict) {
+            continue;
+        }
+        install(*prefix, std::move(dictionary));
+    }
+#endif
+}
+
+void PayloadCompressor::trainPeriodically(Timers& timers, std::chrono::steady_clock::duration every) {
+    if(!mPeriodicTraining) {
+        mPeriodicTraining = std::make_shared<PeriodicTraining>();
+        mPeriodicTraining->compressor = this;
+    }
+    // Timers can't remove tasks, so a detached task stays behind as a no-op
+    timers.addPeriodicTask(every, [training = mPeriodicTraining] {
+        std::lock_guard<std::mutex> lock{training->mutex};
+        if(training->compressor) {
+            training->compressor->trainDictionaries();
+        }
+    });
+}
+
+void PayloadCompressor::stopTrainingPeriodically() {
+    if(!mPeriodicTraining) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock{mPeriodicTraining->mutex};
+    mPeriodicTraining->compressor = nullptr;
+}
+
+void PayloadCompressor::install(Prefix& prefix, std::shared_ptr<Dictionary> dictionary) {
+    std::unique_lock<std::shared_mutex> lock{mMutex};
+    mDictionaries.emplace(dictionary->id, dictionary);
+    prefix.dictionaries.emplace_back(dictionary);
+    std::atomic_store(&prefix.current, std::move(dictionary));
+    // compress() and decompress() calls still using an evicted dictionary keep it alive until they're done
+    auto keep = std::max<size_t>(mConfig.keepDictionaries, 1);
+    if(prefix.dictionaries.size() > keep) {
+        auto evicted = prefix.dictionaries.size() - keep;
+        for(size_t i = 0; i < evicted; ++i) {
+            // id 0 is the stats placeholder from before the first dictionary, it isn't registered
+            if(prefix.dictionaries[i]->id != 0)
+                mDictionaries.erase(prefix.dictionaries[i]->id);
+        }
+        prefix.dictionaries.erase(prefix.dictionaries.begin(), prefix.dictionaries.begin() + evicted);
+    }
+}
+
+std::shared_ptr<PayloadCompressor::Dictionary> PayloadCompressor::findDictionary(uint32_t id) const {
+    std::shared_lock<std::shared_mutex> lock{mMutex};
+    auto it = mDictionaries.find(id);
+    if(it == mDictionaries.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+std::optional<std::vector<uint8_t>> PayloadCompressor::dictionaryContent(uint32_t dictionaryId) const {
+    auto dictionary = findDictionary(dictionaryId);
+    if(!dictionary) {
+        return {};
+    }
+    return dictionary->content;
+}
+
+void PayloadCompressor::loadDictionary(const std::string& prefixName, std::vector<uint8_t> content) {
+#ifdef NIOEV_HAS_ZSTD
+    auto id = ZDICT_getDictID(content.data(), content.size());
+    if(id == 0) {
+        throw std::runtime_error{"Not a zstd dictionary or one without an id"};
+    }
+    if(findDictionary(id)) {
+        throw std::runtime_error{"Dictionary " + std::to_string(id) + " is already loaded"};
+    }
+    auto dictionary = std::make_shared<Dictionary>();
+    dictionary->id = id;
+    dictionary->content = std::move(content);
+    dictionary->cdict = ZSTD_createCDict(dictionary->content.data(), dictionary->content.size(), mConfig.level);
+    dictionary->ddict = ZSTD_createDDict(dictionary->content.data(), dictionary->content.size());
+    if(!dictionary->cdict || !dictionary->ddict) {
+        throw std::runtime_error{"Invalid zstd dictionary"};
+    }
+    // loaded by the operator, not chosen by clients, so not capped
+    auto& prefix = getPrefix(prefixOf(prefixName), false);
+    {
+        std::unique_lock<std::shared_mutex> lock{mMutex};
+        mNextDictionaryId = std::max(mNextDictionaryId, id + 1);
+    }
+    install(prefix, std::move(dictionary));
+#else
+    (void)prefixName;
+    (void)content;
+    throw std::runtime_error{"Built without zstd support"};
+#endif
+}
+
+std::vector<PayloadCompressor::DictionaryStats> PayloadCompressor::getStats() const {
+    auto nanosecondsPerTick = LatencyRegistry::instance().nanosecondsPerTick();
+    std::vector<DictionaryStats> ret;
+    std::shared_lock<std::shared_mutex> lock{mMutex};
+    for(auto& [name, prefix]: mPrefixes) {
+        auto current = std::atomic_load(&prefix->current);
+        for(auto& dictionary: prefix->dictionaries) {
+            DictionaryStats stats;
+            stats.prefix = name;
+            stats.dictionaryId = dictionary->id;
+            stats.current = dictionary == current;
+            stats.compressedPayloads = dictionary->compressedPayloads.load(std::memory_order_relaxed);
+            stats.skippedPayloads = dictionary->skippedPayloads.load(std::memory_order_relaxed);
+            stats.inputBytes = dictionary->inputBytes.load(std::memory_order_relaxed);
+            stats.outputBytes = dictionary->outputBytes.load(std::memory_order_relaxed);
+            stats.compressNanoseconds = dictionary->compressTicks.load(std::memory_order_relaxed) * nanosecondsPerTick;
+            stats.decompressedPayloads = dictionary->decompressedPayloads.load(std::memory_order_relaxed);
+            stats.decompressNanoseconds = dictionary->decompressTicks.load(std::memory_order_relaxed) * nanosecondsPerTick;
+            ret.emplace_back(std::move(stats));
+        }
+    }
+    return ret;
+}
+
+}
\ No newline at end of file
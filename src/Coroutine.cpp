@@ -0,0 +1,72 @@
+#include "nioev/lib/Coroutine.hpp"
+
+#include <array>
+#include <new>
+
+namespace nioev::lib {
+
+namespace {
+
+constexpr size_t FRAME_GRANULARITY = 64;
+constexpr size_t FRAME_SIZE_CLASSES = 32;
+constexpr size_t MAX_CACHED_FRAMES_PER_CLASS = 256;
+
+struct FreeFrame {
+    FreeFrame* next;
+};
+
+struct ThreadFramePool {
+    std::array<FreeFrame*, FRAME_SIZE_CLASSES> freeLists{};
+    std::array<size_t, FRAME_SIZE_CLASSES> counts{};
+
+    ~ThreadFramePool() {
+        for(auto head: freeLists) {
+            while(head) {
+                auto next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+};
+
+thread_local ThreadFramePool gFramePool;
+
+size_t sizeClassOf(size_t size) {
+    return (size + FRAME_GRANULARITY - 1) / FRAME_GRANULARITY - 1;
+}
+
+}
+
+void* CoroutineFramePool::allocate(size_t size) {
+    auto sizeClass = sizeClassOf(size);
+    if(sizeClass >= FRAME_SIZE_CLASSES) {
+        return ::operator new(size);
+    }
+    auto& pool = gFramePool;
+    if(auto frame = pool.freeLists[sizeClass]) {
+        pool.freeLists[sizeClass] = frame->next;
+        pool.counts[sizeClass] -= 1;
+        return frame;
+    }
+    // always allocate the full size class so the frame can be reused by any coroutine of the same class
+    return ::operator new((sizeClass + 1) * FRAME_GRANULARITY);
+}
+
+void CoroutineFramePool::deallocate(void* ptr, size_t size) noexcept {
+    auto sizeClass = sizeClassOf(size);
+    if(sizeClass >= FRAME_SIZE_CLASSES) {
+        ::operator delete(ptr);
+        return;
+    }
+    auto& pool = gFramePool;
+    if(pool.counts[sizeClass] >= MAX_CACHED_FRAMES_PER_CLASS) {
+        ::operator delete(ptr);
+        return;
+    }
+    auto frame = new(ptr) FreeFrame{pool.freeLists[sizeClass]};
+    pool.freeLists[sizeClass] = frame;
+    pool.counts[sizeClass] += 1;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "nioev/lib/Delivery.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace nioev::lib {
+
+size_t BatchDispatcher::addMessage(DeliveryMessage message) {
+    mMessages.emplace_back(std::move(message));
+    mStats.messages += 1;
+    return mMessages.size() - 1;
+}
+
+void BatchDispatcher::addRecipient(BatchSubscriber& subscriber, size_t messageIndex) {
+    assert(messageIndex + 1 == mMessages.size());
+    auto& messages = recipientFor(subscriber).messages;
+    // the same subscriber can match a topic through several filters, it still gets the message once
+    if(!messages.empty() && messages.back() == messageIndex)
+        return;
+    messages.push_back(messageIndex);
+    mStats.deliveries += 1;
+}
+
+BatchDispatcher::Recipient& BatchDispatcher::recipientFor(BatchSubscriber& subscriber) {
+    // keep the table at most half full
+    if((mRecipientCount + 1) * 2 > mRecipientSlots.size()) {
+        growRecipientSlots();
+    }
+    size_t mask = mRecipientSlots.size() - 1;
+    size_t slot = (reinterpret_cast<uintptr_t>(&subscriber) * 0x9E3779B97F4A7C15ull >> 32) & mask;
+    while(true) {
+        auto& entry = mRecipientSlots[slot];
+        if(entry.subscriber == &subscriber) {
+            return mRecipients[entry.recipient];
+        }
+        if(entry.subscriber == nullptr) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if(mRecipientCount == mRecipients.size()) {
+        mRecipients.emplace_back();
+    }
+    auto& recipient = mRecipients[mRecipientCount];
+    recipient.subscriber = &subscriber;
+    recipient.slot = slot;
+    mRecipientSlots[slot] = {&subscriber, static_cast<uint32_t>(mRecipientCount)};
+    mRecipientCount += 1;
+    return recipient;
+}
+
+void BatchDispatcher::growRecipientSlots() {
+    std::vector<RecipientSlot> slots(std::max<size_t>(64, mRecipientSlots.size() * 2));
+    size_t mask = slots.size() - 1;
+    for(size_t i = 0; i < mRecipientCount; ++i) {
+        auto& recipient = mRecipients[i];
+        size_t slot = (reinterpret_cast<uintptr_t>(recipient.subscriber) * 0x9E3779B97F4A7C15ull >> 32) & mask;
+        while(slots[slot].subscriber) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = {recipient.subscriber, static_cast<uint32_t>(i)};
+        recipient.slot = slot;
+    }
+    mRecipientSlots = std::move(slots);
+}
+
+void BatchDispatcher::flush() {
+    struct ClearOnExit {
+        BatchDispatcher& dispatcher;
+        ~ClearOnExit() {
+            dispatcher.clear();
+        }
+    } clearOnExit{*this};
+    mStats.flushes += 1;
+    for(size_t i = 0; i < mRecipientCount; ++i) {
+        auto& recipient = mRecipients[i];
+        mBatch.clear();
+        for(auto index: recipient.messages) {
+            mBatch.push_back(&mMessages[index]);
+        }
+        mStats.deliverCalls += 1;
+        recipient.subscriber->deliver(DeliveryBatch{mBatch.data(), mBatch.size()});
+    }
+}
+
+void BatchDispatcher::clear() {
+    for(size_t i = 0; i < mRecipientCount; ++i) {
+        auto& recipient = mRecipients[i];
+        mRecipientSlots[recipient.slot] = {};
+        recipient.subscriber = nullptr;
+        recipient.messages.clear();
+    }
+    mRecipientCount = 0;
+    mMessages.clear();
+    mBatch.clear();
+}
+
+}
\ No newline at end of file
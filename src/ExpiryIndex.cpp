@@ -0,0 +1,149 @@
+#include "nioev/lib/ExpiryIndex.hpp"
+
+#include <algorithm>
+
+namespace nioev::lib {
+
+void ExpiryIndex::schedule(ExpiryKind kind, uint64_t id, Clock::time_point deadline) {
+    mStats.scheduled += 1;
+    auto [it, inserted] = mSlots[static_cast<size_t>(kind)].emplace(id, NONE);
+    if(!inserted) {
+        auto index = mEntries[it->second].heapIndex;
+        auto earlier = deadline < mHeap[index].deadline;
+        mHeap[index].deadline = deadline;
+        if(earlier) {
+            siftUp(index);
+        } else {
+            siftDown(index);
+        }
+        return;
+    }
+    uint32_t slot;
+    if(!mFreeSlots.empty()) {
+        slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+    } else {
+        slot = mEntries.size();
+        mEntries.emplace_back();
+    }
+    it->second = slot;
+    auto& entry = mEntries[slot];
+    entry.id = id;
+    entry.kind = kind;
+    mHeap.push_back({deadline, slot});
+    siftUp(mHeap.size() - 1);
+}
+
+bool ExpiryIndex::cancel(ExpiryKind kind, uint64_t id) {
+    auto slot = find(kind, id);
+    if(slot == NONE) {
+        return false;
+    }
+    erase(slot);
+    mStats.cancelled += 1;
+    return true;
+}
+
+void ExpiryIndex::scheduleDisconnect(uint64_t sessionId, uint32_t sessionExpirySeconds, std::optional<uint32_t> willDelaySeconds, Clock::time_point now) {
+    if(sessionExpirySeconds != UINT32_MAX) {
+        scheduleAfter(ExpiryKind::SESSION, sessionId, sessionExpirySeconds, now);
+    } else {
+        cancel(ExpiryKind::SESSION, sessionId);
+    }
+    if(willDelaySeconds) {
+        scheduleAfter(ExpiryKind::WILL, sessionId, std::min(*willDelaySeconds, sessionExpirySeconds), now);
+    } else {
+        cancel(ExpiryKind::WILL, sessionId);
+    }
+}
+
+std::optional<ExpiryIndex::Clock::time_point> ExpiryIndex::deadlineOf(ExpiryKind kind, uint64_t id) const {
+    auto slot = find(kind, id);
+    if(slot == NONE) {
+        return {};
+    }
+    return mHeap[mEntries[slot].heapIndex].deadline;
+}
+
+std::optional<uint32_t> ExpiryIndex::remainingSeconds(ExpiryKind kind, uint64_t id, Clock::time_point now) const {
+    auto deadline = deadlineOf(kind, id);
+    if(!deadline) {
+        return {};
+    }
+    if(*deadline <= now) {
+        return 0;
+    }
+    auto left = std::chrono::ceil<std::chrono::seconds>(*deadline - now).count();
+    return static_cast<uint32_t>(std::min<int64_t>(left, UINT32_MAX));
+}
+
+bool ExpiryIndex::expireIfDue(ExpiryKind kind, uint64_t id, Clock::time_point now) {
+    auto slot = find(kind, id);
+    if(slot == NONE || mHeap[mEntries[slot].heapIndex].deadline > now) {
+        return false;
+    }
+    erase(slot);
+    mStats.expiredOnAccess += 1;
+    return true;
+}
+
+uint32_t ExpiryIndex::find(ExpiryKind kind, uint64_t id) const {
+    auto& slots = mSlots[static_cast<size_t>(kind)];
+    auto it = slots.find(id);
+    return it == slots.end() ? NONE : it->second;
+}
+
+void ExpiryIndex::erase(uint32_t slot) {
+    auto& entry = mEntries[slot];
+    mSlots[static_cast<size_t>(entry.kind)].erase(entry.id);
+    auto index = entry.heapIndex;
+    auto last = mHeap.back();
+    mHeap.pop_back();
+    if(last.slot != slot) {
+        // move the last node into the hole and restore the heap in whichever direction it's off
+        place(index, last);
+        siftUp(index);
+        siftDown(mEntries[last.slot].heapIndex);
+    }
+    entry.heapIndex = NONE;
+    mFreeSlots.push_back(slot);
+}
+
+void ExpiryIndex::siftUp(uint32_t index) {
+    auto node = mHeap[index];
+    while(index > 0) {
+        auto parent = (index - 1) / 4;
+        if(mHeap[parent].deadline <= node.deadline) {
+            break;
+        }
+        place(index, mHeap[parent]);
+        index = parent;
+    }
+    place(index, node);
+}
+
+void ExpiryIndex::siftDown(uint32_t index) {
+    auto node = mHeap[index];
+    uint32_t size = mHeap.size();
+    while(true) {
+        auto first = index * 4 + 1;
+        if(first >= size) {
+            break;
+        }
+        auto child = first;
+        auto end = std::min(first + 4, size);
+        for(auto i = first + 1; i < end; ++i) {
+            if(mHeap[i].deadline < mHeap[child].deadline) {
+                child = i;
+            }
+        }
+        if(node.deadline <= mHeap[child].deadline) {
+            break;
+        }
+        place(index, mHeap[child]);
+        index = child;
+    }
+    place(index, node);
+}
+
+}
\ No newline at end of file
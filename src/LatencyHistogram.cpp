@@ -0,0 +1,184 @@
+#include "nioev/lib/LatencyHistogram.hpp"
+
+#include <cstdio>
+
+namespace nioev::lib {
+
+void LatencyHistogram::Snapshot::merge(const Snapshot& other) {
+    for(uint i = 0; i < BUCKET_COUNT; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double fraction) const {
+    if(count == 0)
+        return 0;
+    auto wanted = static_cast<uint64_t>(fraction * count + 0.5);
+    wanted = std::max<uint64_t>(wanted, 1);
+    uint64_t seen = 0;
+    for(uint i = 0; i < BUCKET_COUNT; ++i) {
+        seen += buckets[i];
+        if(seen >= wanted) {
+            // report the middle of the bucket, clamped to what was actually recorded
+            auto lower = bucketLowerBound(i);
+            auto upper = i + 1 < BUCKET_COUNT ? bucketLowerBound(i + 1) : max;
+            return std::clamp(lower + (upper - lower) / 2, min, max);
+        }
+    }
+    return max;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot ret;
+    for(uint i = 0; i < BUCKET_COUNT; ++i) {
+        ret.buckets[i] = mBuckets[i].load(std::memory_order_relaxed);
+    }
+    ret.count = mCount.load(std::memory_order_relaxed);
+    ret.sum = mSum.load(std::memory_order_relaxed);
+    ret.min = mMin.load(std::memory_order_relaxed);
+    ret.max = mMax.load(std::memory_order_relaxed);
+    return ret;
+}
+
+thread_local LatencyRegistry::ThreadHistograms* LatencyRegistry::tThreadHistograms = nullptr;
+
+LatencyRegistry::LatencyRegistry()
+: mStartTicks(readLatencyTicks()), mStartTime(std::chrono::steady_clock::now()) {
+
+}
+
+LatencyRegistry& LatencyRegistry::instance() {
+    // leaked on purpose so that scopes recorded during static destruction don't touch a dead registry
+    static auto registry = new LatencyRegistry;
+    return *registry;
+}
+
+uint32_t LatencyRegistry::registerScope(const char* name) {
+    std::lock_guard<std::mutex> lock{mMutex};
+    for(uint32_t i = 0; i < mScopeNames.size(); ++i) {
+        if(mScopeNames[i] == name) {
+            return i;
+        }
+    }
+    if(mScopeNames.size() >= MAX_SCOPES) {
+        throw std::runtime_error{"Too many latency scopes, can't register " + std::string{name}};
+    }
+    mScopeNames.emplace_back(name);
+    return mScopeNames.size() - 1;
+}
+
+LatencyRegistry::ThreadHistograms* LatencyRegistry::registerThread() {
+    std::lock_guard<std::mutex> lock{mMutex};
+    mThreads.emplace_back(std::make_unique<ThreadHistograms>());
+    tThreadHistograms = mThreads.back().get();
+    return tThreadHistograms;
+}
+
+LatencyHistogram* LatencyRegistry::createHistogram(ThreadHistograms& threadHistograms, uint32_t scopeId) {
+    std::lock_guard<std::mutex> lock{mMutex};
+    threadHistograms.storage[scopeId] = std::make_unique<LatencyHistogram>();
+    auto histogram = threadHistograms.storage[scopeId].get();
+    threadHistograms.histograms[scopeId].store(histogram, std::memory_order_release);
+    return histogram;
+}
+
+std::vector<LatencyRegistry::ScopeSnapshot> LatencyRegistry::snapshot() const {
+    std::lock_guard<std::mutex> lock{mMutex};
+    std::vector<ScopeSnapshot> ret;
+    ret.reserve(mScopeNames.size());
+    for(uint32_t scopeId = 0; scopeId < mScopeNames.size(); ++scopeId) {
+        ScopeSnapshot scope{mScopeNames[scopeId], {}};
+        for(auto& thread: mThreads) {
+            auto histogram = thread->histograms[scopeId].load(std::memory_order_acquire);
+            if(histogram) {
+                scope.histogram.merge(histogram->snapshot());
+            }
+        }
+        ret.emplace_back(std::move(scope));
+    }
+    return ret;
+}
+
+double LatencyRegistry::nanosecondsPerTick() const {
+#if defined(__x86_64__) || defined(__i386__)
+    // calibrate against the steady clock over the whole lifetime of the registry, which gets more precise over time
+    auto ticks = readLatencyTicks() - mStartTicks;
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mStartTime).count();
+    if(ticks == 0 || nanoseconds <= 0)
+        return 1.0;
+    return static_cast<double>(nanoseconds) / static_cast<double>(ticks);
+#else
+    return 1.0;
+#endif
+}
+
+std::string LatencyRegistry::exportJson() const {
+    auto scopes = snapshot();
+    auto nsPerTick = nanosecondsPerTick();
+    auto toNs = [nsPerTick](uint64_t ticks) {
+        return static_cast<uint64_t>(ticks * nsPerTick);
+    };
+    std::string ret = "{\"scopes\":[";
+    char buffer[512];
+    bool first = true;
+    for(auto& scope: scopes) {
+        auto& h = scope.histogram;
+        if(h.count == 0)
+            continue;
+        if(!first)
+            ret += ",";
+        first = false;
+        // scope names are identifiers from the source code, so they don't need escaping
+        snprintf(buffer, sizeof(buffer),
+            "{\"name\":\"%s\",\"count\":%lu,\"min\":%lu,\"mean\":%.1f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}",
+            scope.name.c_str(), h.count, toNs(h.min), h.sum * nsPerTick / h.count, toNs(h.percentile(0.5)), toNs(h.percentile(0.9)),
+            toNs(h.percentile(0.99)), toNs(h.percentile(0.999)), toNs(h.max));
+        ret += buffer;
+    }
+    ret += "]}";
+    return ret;
+}
+
+SharedBuffer LatencyRegistry::exportBinary() const {
+    auto scopes = snapshot();
+    BinaryEncoder encoder;
+    encoder.encodeByte(1);
+    encoder.encode4Bytes(static_cast<uint32_t>(nanosecondsPerTick() * 1000.0 + 0.5));
+    encoder.encode4Bytes(scopes.size());
+    for(auto& scope: scopes) {
+        auto& h = scope.histogram;
+        encoder.encodeString(scope.name);
+        encoder.encode8Bytes(h.count);
+        encoder.encode8Bytes(h.sum);
+        encoder.encode8Bytes(h.count ? h.min : 0);
+        encoder.encode8Bytes(h.max);
+        uint16_t nonEmpty = std::count_if(h.buckets.begin(), h.buckets.end(), [](uint64_t c) { return c != 0; });
+        encoder.encode2Bytes(nonEmpty);
+        for(uint i = 0; i < LatencyHistogram::BUCKET_COUNT; ++i) {
+            if(h.buckets[i] == 0)
+                continue;
+            encoder.encode2Bytes(i);
+            encoder.encode8Bytes(h.buckets[i]);
+        }
+    }
+    return encoder.moveData();
+}
+
+void LatencyRegistry::publishPeriodically(Timers& timers, std::chrono::steady_clock::duration every, LatencyExportFormat format, std::function<void(const char*, SharedBuffer&&)> publish) {
+    timers.addPeriodicTask(every, [this, format, publish = std::move(publish)] {
+        if(format == LatencyExportFormat::JSON) {
+            auto json = exportJson();
+            SharedBuffer buffer;
+            buffer.append(json.data(), json.size());
+            publish(LATENCY_TOPIC, std::move(buffer));
+        } else {
+            publish(LATENCY_TOPIC, exportBinary());
+        }
+    });
+}
+
+}
\ No newline at end of file
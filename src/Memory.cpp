@@ -0,0 +1,74 @@
+#include "nioev/lib/Memory.hpp"
+
+namespace nioev::lib {
+
+AllocationStats CountingResource::getStats() const {
+    AllocationStats stats;
+    stats.allocations = mAllocations.load(std::memory_order_relaxed);
+    stats.deallocations = mDeallocations.load(std::memory_order_relaxed);
+    stats.bytesAllocated = mBytesAllocated.load(std::memory_order_relaxed);
+    stats.bytesDeallocated = mBytesDeallocated.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment) {
+    auto ret = mUpstream->allocate(bytes, alignment);
+    mAllocations.fetch_add(1, std::memory_order_relaxed);
+    mBytesAllocated.fetch_add(bytes, std::memory_order_relaxed);
+    return ret;
+}
+
+void CountingResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    mUpstream->deallocate(p, bytes, alignment);
+    mDeallocations.fetch_add(1, std::memory_order_relaxed);
+    mBytesDeallocated.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+CountingResource& heapResource() {
+    // never destroyed, thread pools may give memory back to it during static destruction
+    static auto resource = new CountingResource{};
+    return *resource;
+}
+
+namespace {
+// Single threaded by definition, so the counters are plain integers.
+class ThreadPool final : public std::pmr::memory_resource {
+public:
+    ThreadPool()
+    : mPool(&heapResource()) {
+
+    }
+    AllocationStats stats;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        stats.allocations += 1;
+        stats.bytesAllocated += bytes;
+        return mPool.allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        stats.deallocations += 1;
+        stats.bytesDeallocated += bytes;
+        mPool.deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+    std::pmr::unsynchronized_pool_resource mPool;
+};
+
+ThreadPool& threadPool() {
+    thread_local ThreadPool pool;
+    return pool;
+}
+}
+
+std::pmr::memory_resource* threadPoolResource() {
+    return &threadPool();
+}
+
+AllocationStats threadPoolStats() {
+    return threadPool().stats;
+}
+
+}
\ No newline at end of file
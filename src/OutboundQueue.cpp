@@ -0,0 +1,192 @@
+#include "nioev/lib/OutboundQueue.hpp"
+
+#include <functional>
+
+namespace nioev::lib {
+
+OutboundQueue::OutboundQueue(Config config)
+: mConfig(config), mBuckets(16, NONE) {
+
+}
+
+OutboundPushResult OutboundQueue::push(DeliveryMessage message) {
+    if(!message.topic) {
+        // can't be sent, and conflation has nothing to go by
+        mStats.droppedNew += 1;
+        return OutboundPushResult::DROPPED;
+    }
+    auto bytes = messageBytes(message);
+    bool isQoS0 = message.qos == QoS::QoS0;
+    size_t hash = 0;
+    uint32_t previous = NONE;
+    if(isQoS0 && mConfig.conflateQoS0) {
+        hash = std::hash<std::string_view>{}(message.topicString());
+        previous = findQoS0(message.topicString(), hash);
+    }
+    if(bytes > mConfig.maxBytes || mConfig.maxMessages == 0) {
+        mStats.droppedNew += 1;
+        return OutboundPushResult::DROPPED;
+    }
+    /* The message being conflated away makes room for the new one, but it's only removed once the new one is
+     * certain to be queued; otherwise the subscriber would lose the latest value of the topic altogether.
+     */
+    size_t creditCount = previous != NONE ? 1 : 0;
+    size_t creditBytes = previous != NONE ? messageBytes(mEntries[previous].message) : 0;
+    auto fitsAfterConflation = [&] {
+        return mCount - creditCount < mConfig.maxMessages && mBytes - creditBytes + bytes <= mConfig.maxBytes;
+    };
+    if(!fitsAfterConflation()) {
+        switch(mConfig.dropPolicy) {
+        case OutboundDropPolicy::DROP_NEW:
+            break;
+        case OutboundDropPolicy::DROP_OLDEST:
+            // terminates at the latest with only `previous` left, which fits by the checks above
+            while(!fitsAfterConflation()) {
+                erase(mHead != previous ? mHead : mEntries[mHead].next);
+                mStats.droppedOld += 1;
+            }
+            break;
+        case OutboundDropPolicy::DROP_OLDEST_QOS0:
+            while(!fitsAfterConflation()) {
+                auto victim = mHeadQoS0;
+                if(victim != NONE && victim == previous)
+                    victim = mEntries[victim].nextQoS0;
+                if(victim == NONE)
+                    break;
+                erase(victim);
+                mStats.droppedOld += 1;
+            }
+            break;
+        }
+        if(!fitsAfterConflation()) {
+            mStats.droppedNew += 1;
+            return OutboundPushResult::DROPPED;
+        }
+    }
+    if(previous != NONE) {
+        erase(previous);
+        mStats.conflated += 1;
+    }
+
+    uint32_t slot;
+    if(!mFreeSlots.empty()) {
+        slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+    } else {
+        slot = mEntries.size();
+        mEntries.emplace_back();
+    }
+    auto& entry = mEntries[slot];
+    entry.message = std::move(message);
+    entry.hash = hash;
+    entry.prev = mTail;
+    entry.next = NONE;
+    if(mTail != NONE) {
+        mEntries[mTail].next = slot;
+    } else {
+        mHead = slot;
+    }
+    mTail = slot;
+    if(isQoS0) {
+        // before linking the new entry, growBuckets() rehashes everything in the QoS 0 FIFO
+        if(mConfig.conflateQoS0 && mCountQoS0 + 1 > mBuckets.size()) {
+            growBuckets();
+        }
+        entry.prevQoS0 = mTailQoS0;
+        entry.nextQoS0 = NONE;
+        if(mTailQoS0 != NONE) {
+            mEntries[mTailQoS0].nextQoS0 = slot;
+        } else {
+            mHeadQoS0 = slot;
+        }
+        mTailQoS0 = slot;
+        mCountQoS0 += 1;
+        if(mConfig.conflateQoS0) {
+            bucketInsert(slot);
+        }
+    }
+    mCount += 1;
+    mBytes += bytes;
+    mStats.queued += 1;
+    return previous != NONE ? OutboundPushResult::CONFLATED : OutboundPushResult::QUEUED;
+}
+
+DeliveryMessage OutboundQueue::pop() {
+    mStats.popped += 1;
+    return erase(mHead);
+}
+
+void OutboundQueue::clear() {
+    while(mHead != NONE) {
+        erase(mHead);
+    }
+}
+
+uint32_t OutboundQueue::findQoS0(std::string_view topic, size_t hash) const {
+    for(auto slot = mBuckets[hash & (mBuckets.size() - 1)]; slot != NONE; slot = mEntries[slot].nextInBucket) {
+        auto& entry = mEntries[slot];
+        // publishers share the topic string between all recipients, so the pointer comparison usually decides it
+        if(entry.hash == hash && (entry.message.topic->data() == topic.data() || entry.message.topicString() == topic)) {
+            return slot;
+        }
+    }
+    return NONE;
+}
+
+DeliveryMessage OutboundQueue::erase(uint32_t slot) {
+    auto& entry = mEntries[slot];
+    if(entry.prev != NONE) {
+        mEntries[entry.prev].next = entry.next;
+    } else {
+        mHead = entry.next;
+    }
+    if(entry.next != NONE) {
+        mEntries[entry.next].prev = entry.prev;
+    } else {
+        mTail = entry.prev;
+    }
+    if(entry.message.qos == QoS::QoS0) {
+        if(entry.prevQoS0 != NONE) {
+            mEntries[entry.prevQoS0].nextQoS0 = entry.nextQoS0;
+        } else {
+            mHeadQoS0 = entry.nextQoS0;
+        }
+        if(entry.nextQoS0 != NONE) {
+            mEntries[entry.nextQoS0].prevQoS0 = entry.prevQoS0;
+        } else {
+            mTailQoS0 = entry.prevQoS0;
+        }
+        if(mConfig.conflateQoS0) {
+            bucketErase(slot);
+        }
+        mCountQoS0 -= 1;
+    }
+    mBytes -= messageBytes(entry.message);
+    mCount -= 1;
+    entry.prev = entry.next = entry.prevQoS0 = entry.nextQoS0 = entry.nextInBucket = NONE;
+    mFreeSlots.push_back(slot);
+    return std::move(entry.message);
+}
+
+void OutboundQueue::bucketInsert(uint32_t slot) {
+    auto& head = mBuckets[mEntries[slot].hash & (mBuckets.size() - 1)];
+    mEntries[slot].nextInBucket = head;
+    head = slot;
+}
+
+void OutboundQueue::bucketErase(uint32_t slot) {
+    auto* link = &mBuckets[mEntries[slot].hash & (mBuckets.size() - 1)];
+    while(*link != slot) {
+        link = &mEntries[*link].nextInBucket;
+    }
+    *link = mEntries[slot].nextInBucket;
+}
+
+void OutboundQueue::growBuckets() {
+    mBuckets.assign(mBuckets.size() * 2, NONE);
+    for(auto slot = mHeadQoS0; slot != NONE; slot = mEntries[slot].nextQoS0) {
+        bucketInsert(slot);
+    }
+}
+
+}
\ No newline at end of file
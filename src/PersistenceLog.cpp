@@ -0,0 +1,682 @@
+#include "nioev/lib/PersistenceLog.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The persistence log format is little endian");
+
+namespace nioev::lib {
+
+struct PersistenceLog::Segment {
+    uint64_t sequence{0};
+    std::string path;
+    int fd{-1};
+    uint8_t* data{nullptr};
+    size_t mappedSize{0};
+    // bytes in use including the file header, guarded by mMutex
+    size_t used{0};
+    // only touched by the sync thread
+    size_t synced{0};
+
+    ~Segment() {
+        if(data) {
+            munmap(data, mappedSize);
+        }
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+};
+
+namespace {
+constexpr char FILE_MAGIC[8] = {'N', 'I', 'O', 'E', 'V', 'L', 'O', 'G'};
+constexpr uint8_t FILE_VERSION = 1;
+constexpr size_t FILE_HEADER_SIZE = 16;
+constexpr size_t RECORD_HEADER_SIZE = 24;
+constexpr const char* SEGMENT_PREFIX = "segment-";
+constexpr const char* SEGMENT_SUFFIX = ".log";
+constexpr const char* COMPACTION_FILE = "compaction.tmp";
+
+struct RecordHeader {
+    uint32_t crc;
+    uint32_t size;
+    uint8_t type;
+    uint8_t qos;
+    uint8_t inflightState;
+    uint8_t reserved1;
+    uint16_t packetId;
+    uint16_t clientIdLength;
+    uint16_t topicLength;
+    uint16_t reserved2;
+    uint32_t payloadLength;
+};
+static_assert(sizeof(RecordHeader) == RECORD_HEADER_SIZE);
+
+constexpr size_t padRecord(size_t size) {
+    return (size + 7) & ~size_t(7);
+}
+
+uint32_t crc32cTable(uint32_t crc, const uint8_t* data, size_t length) {
+    static const auto table = [] {
+        std::array<uint32_t, 256> ret{};
+        for(uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for(int bit = 0; bit < 8; ++bit) {
+                value = (value >> 1) ^ (0x82F63B78 & -(value & 1));
+            }
+            ret[i] = value;
+        }
+        return ret;
+    }();
+    for(size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t length) {
+    uint64_t crc64 = crc;
+    while(length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = crc64;
+    while(length > 0) {
+        crc = _mm_crc32_u8(crc, *data);
+        data += 1;
+        length -= 1;
+    }
+    return crc;
+}
+#endif
+
+// Calls the callback for every valid record and returns the offset just behind the last one.
+template<typename Callback>
+size_t forEachRecord(const uint8_t* data, size_t used, Callback&& callback) {
+    size_t offset = FILE_HEADER_SIZE;
+    while(offset + RECORD_HEADER_SIZE <= used) {
+        RecordHeader header;
+        memcpy(&header, data + offset, RECORD_HEADER_SIZE);
+        if(header.size < RECORD_HEADER_SIZE || header.size > used - offset) {
+            break;
+        }
+        if(uint64_t{RECORD_HEADER_SIZE} + header.clientIdLength + header.topicLength + header.payloadLength != header.size) {
+            break;
+        }
+        if(crc32c(0, data + offset + 4, header.size - 4) != header.crc) {
+            break;
+        }
+        auto recordData = reinterpret_cast<const char*>(data + offset + RECORD_HEADER_SIZE);
+        PersistRecord record{
+            static_cast<PersistRecordType>(header.type),
+            static_cast<QoS>(header.qos),
+            static_cast<InflightState>(header.inflightState),
+            header.packetId,
+            {recordData, header.clientIdLength},
+            {recordData + header.clientIdLength, header.topicLength},
+            {recordData + header.clientIdLength + header.topicLength, header.payloadLength}};
+        size_t length = std::min(padRecord(header.size), used - offset);
+        callback(record, data + offset, length);
+        offset += length;
+    }
+    return offset;
+}
+
+bool hasValidFileHeader(const uint8_t* data, size_t size) {
+    return size >= FILE_HEADER_SIZE && memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0 && data[sizeof(FILE_MAGIC)] == FILE_VERSION;
+}
+
+void writeFileHeader(uint8_t* out) {
+    memset(out, 0, FILE_HEADER_SIZE);
+    memcpy(out, FILE_MAGIC, sizeof(FILE_MAGIC));
+    out[sizeof(FILE_MAGIC)] = FILE_VERSION;
+}
+
+void syncRange(uint8_t* data, size_t begin, size_t end) {
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    begin -= begin % pageSize;
+    if(msync(data + begin, end - begin, MS_SYNC) < 0) {
+        throwErrno("Failed to sync persistence log");
+    }
+}
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    static const bool hasHardwareCrc = __builtin_cpu_supports("sse4.2");
+    if(hasHardwareCrc) {
+        return ~crc32cHardware(crc, static_cast<const uint8_t*>(data), length);
+    }
+#endif
+    return ~crc32cTable(crc, static_cast<const uint8_t*>(data), length);
+}
+
+PersistenceLog::PersistenceLog(Config config)
+: mConfig(std::move(config)) {
+    std::filesystem::create_directories(mConfig.directory);
+    openSegments();
+    mSyncThread = std::thread{[this] {
+        pthread_setname_np(pthread_self(), "persist-sync");
+        syncThreadFunc();
+    }};
+    mCompactionThread = std::thread{[this] {
+        pthread_setname_np(pthread_self(), "persist-compact");
+        compactionThreadFunc();
+    }};
+}
+
+PersistenceLog::~PersistenceLog() {
+    mShouldRun = false;
+    {
+        std::lock_guard<std::mutex> lock{mDurableMutex};
+        mSyncCV.notify_all();
+        mDurableCV.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock{mCompactionRequestMutex};
+        mCompactionCV.notify_all();
+    }
+    mSyncThread.join();
+    mCompactionThread.join();
+    // everything is synced now, drop the preallocated tail so the next start doesn't have to scan it
+    if(ftruncate(mActive->fd, mActive->used) < 0) {
+        // not a problem, replay stops at the zeroes
+    }
+}
+
+std::string PersistenceLog::segmentPath(uint64_t sequence) const {
+    return mConfig.directory + "/" + SEGMENT_PREFIX + std::to_string(sequence) + SEGMENT_SUFFIX;
+}
+
+void PersistenceLog::syncDirectory() const {
+    int fd = open(mConfig.directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        throwErrno("Failed to open " + mConfig.directory);
+    }
+    fsync(fd);
+    close(fd);
+}
+
+void PersistenceLog::openSegments() {
+    std::vector<uint64_t> sequences;
+    for(auto& entry: std::filesystem::directory_iterator(mConfig.directory)) {
+        auto name = entry.path().filename().string();
+        if(name == COMPACTION_FILE) {
+            // leftover of a compaction that crashed before it was complete
+            std::filesystem::remove(entry.path());
+            continue;
+        }
+        if(name.size() > strlen(SEGMENT_PREFIX) + strlen(SEGMENT_SUFFIX) && startsWith(name, SEGMENT_PREFIX) && name.substr(name.size() - strlen(SEGMENT_SUFFIX)) == SEGMENT_SUFFIX) {
+            sequences.push_back(std::strtoull(name.c_str() + strlen(SEGMENT_PREFIX), nullptr, 10));
+        }
+    }
+    std::sort(sequences.begin(), sequences.end());
+
+    for(auto sequence: sequences) {
+        auto segment = std::make_shared<Segment>();
+        segment->sequence = sequence;
+        segment->path = segmentPath(sequence);
+        segment->fd = open(segment->path.c_str(), O_RDWR | O_CLOEXEC);
+        if(segment->fd < 0) {
+            throwErrno("Failed to open " + segment->path);
+        }
+        auto fileSize = lseek(segment->fd, 0, SEEK_END);
+        if(fileSize < 0) {
+            throwErrno("Failed to read size of " + segment->path);
+        }
+        if(fileSize == 0) {
+            std::filesystem::remove(segment->path);
+            continue;
+        }
+        auto data = static_cast<uint8_t*>(mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, segment->fd, 0));
+        if(data == MAP_FAILED) {
+            throwErrno("Failed to map " + segment->path);
+        }
+        if(!hasValidFileHeader(data, fileSize)) {
+            // crashed while creating the segment, it can't contain anything
+            munmap(data, fileSize);
+            std::filesystem::remove(segment->path);
+            continue;
+        }
+        size_t validEnd = forEachRecord(data, fileSize, [](const PersistRecord&, const uint8_t*, size_t) {});
+        if(validEnd == FILE_HEADER_SIZE) {
+            munmap(data, fileSize);
+            std::filesystem::remove(segment->path);
+            continue;
+        }
+        if(validEnd < size_t(fileSize)) {
+            // cut off the preallocated space and anything torn, so that nothing stale behind it can resurface
+            munmap(data, fileSize);
+            if(ftruncate(segment->fd, validEnd) < 0) {
+                throwErrno("Failed to truncate " + segment->path);
+            }
+            fileSize = validEnd;
+            data = static_cast<uint8_t*>(mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, segment->fd, 0));
+            if(data == MAP_FAILED) {
+                throwErrno("Failed to map " + segment->path);
+            }
+        }
+        segment->data = data;
+        segment->mappedSize = fileSize;
+        segment->used = fileSize;
+        segment->synced = fileSize;
+        mSegments.emplace_back(std::move(segment));
+    }
+    if(!sequences.empty()) {
+        mNextSegmentSequence = sequences.back() + 1;
+    }
+    mActive = createSegment(mNextSegmentSequence++, mConfig.segmentSize);
+    mSegments.push_back(mActive);
+    if(mConfig.compactAfterSealedSegments > 0 && mSegments.size() - 1 >= mConfig.compactAfterSealedSegments) {
+        mCompactionRequested = true;
+    }
+}
+
+std::shared_ptr<PersistenceLog::Segment> PersistenceLog::createSegment(uint64_t sequence, size_t size) {
+    auto segment = std::make_shared<Segment>();
+    segment->sequence = sequence;
+    segment->path = segmentPath(sequence);
+    segment->fd = open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(segment->fd < 0) {
+        throwErrno("Failed to create " + segment->path);
+    }
+    // allocate all blocks up front, so appending never has to extend the file
+    int error = posix_fallocate(segment->fd, 0, size);
+    if(error != 0) {
+        errno = error;
+        throwErrno("Failed to allocate " + segment->path);
+    }
+    segment->data = static_cast<uint8_t*>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0));
+    if(segment->data == MAP_FAILED) {
+        segment->data = nullptr;
+        throwErrno("Failed to map " + segment->path);
+    }
+    segment->mappedSize = size;
+    writeFileHeader(segment->data);
+    segment->used = FILE_HEADER_SIZE;
+    syncDirectory();
+    return segment;
+}
+
+uint64_t PersistenceLog::append(PersistRecordType type, QoS qos, InflightState state, uint16_t packetId, std::string_view clientId, std::string_view topic, std::string_view payload) {
+    if(clientId.size() > UINT16_MAX || topic.size() > UINT16_MAX || payload.size() > UINT32_MAX - RECORD_HEADER_SIZE - 2 * UINT16_MAX) {
+        throw std::runtime_error{"Record too large for the persistence log"};
+    }
+    RecordHeader header{};
+    header.size = RECORD_HEADER_SIZE + clientId.size() + topic.size() + payload.size();
+    header.type = static_cast<uint8_t>(type);
+    header.qos = static_cast<uint8_t>(qos);
+    header.inflightState = static_cast<uint8_t>(state);
+    header.packetId = packetId;
+    header.clientIdLength = clientId.size();
+    header.topicLength = topic.size();
+    header.payloadLength = payload.size();
+    // checksum outside of the lock, under it we only copy
+    uint32_t crc = crc32c(0, reinterpret_cast<const uint8_t*>(&header) + 4, RECORD_HEADER_SIZE - 4);
+    crc = crc32c(crc, clientId.data(), clientId.size());
+    crc = crc32c(crc, topic.data(), topic.size());
+    crc = crc32c(crc, payload.data(), payload.size());
+    header.crc = crc;
+    size_t length = padRecord(header.size);
+
+    std::unique_lock<std::mutex> lock{mMutex};
+    if(mActive->used + length > mActive->mappedSize) {
+        mUnsynced.push_back(mActive);
+        mActive = createSegment(mNextSegmentSequence++, std::max(mConfig.segmentSize, FILE_HEADER_SIZE + length));
+        mSegments.push_back(mActive);
+        if(mConfig.compactAfterSealedSegments > 0 && mSegments.size() - 1 >= mConfig.compactAfterSealedSegments) {
+            std::lock_guard<std::mutex> requestLock{mCompactionRequestMutex};
+            mCompactionRequested = true;
+            mCompactionCV.notify_one();
+        }
+    }
+    uint8_t* out = mActive->data + mActive->used;
+    memcpy(out, &header, RECORD_HEADER_SIZE);
+    out += RECORD_HEADER_SIZE;
+    if(!clientId.empty()) {
+        memcpy(out, clientId.data(), clientId.size());
+        out += clientId.size();
+    }
+    if(!topic.empty()) {
+        memcpy(out, topic.data(), topic.size());
+        out += topic.size();
+    }
+    if(!payload.empty()) {
+        memcpy(out, payload.data(), payload.size());
+    }
+    // the padding is already zero, segments are only ever appended to
+    mActive->used += length;
+    return ++mAppended;
+}
+
+uint64_t PersistenceLog::appendSubscribe(std::string_view clientId, std::string_view filter, QoS qos) {
+    return append(PersistRecordType::SUBSCRIBE, qos, InflightState::AWAITING_PUBACK, 0, clientId, filter, {});
+}
+
+uint64_t PersistenceLog::appendUnsubscribe(std::string_view clientId, std::string_view filter) {
+    return append(PersistRecordType::UNSUBSCRIBE, QoS::QoS0, InflightState::AWAITING_PUBACK, 0, clientId, filter, {});
+}
+
+uint64_t PersistenceLog::appendSessionDelete(std::string_view clientId) {
+    return append(PersistRecordType::SESSION_DELETE, QoS::QoS0, InflightState::AWAITING_PUBACK, 0, clientId, {}, {});
+}
+
+uint64_t PersistenceLog::appendRetain(std::string_view topic, QoS qos, const uint8_t* payload, size_t payloadLength) {
+    return append(PersistRecordType::RETAIN, qos, InflightState::AWAITING_PUBACK, 0, {}, topic, {reinterpret_cast<const char*>(payload), payloadLength});
+}
+
+uint64_t PersistenceLog::appendInflight(std::string_view clientId, uint16_t packetId, InflightState state, QoS qos, std::string_view topic, const uint8_t* payload, size_t payloadLength) {
+    return append(PersistRecordType::INFLIGHT, qos, state, packetId, clientId, topic, {reinterpret_cast<const char*>(payload), payloadLength});
+}
+
+uint64_t PersistenceLog::appendInflightDone(std::string_view clientId, uint16_t packetId) {
+    return append(PersistRecordType::INFLIGHT_DONE, QoS::QoS0, InflightState::AWAITING_PUBACK, packetId, clientId, {}, {});
+}
+
+void PersistenceLog::waitDurable(uint64_t sequence) {
+    std::unique_lock<std::mutex> lock{mDurableMutex};
+    if(mDurable >= sequence) {
+        return;
+    }
+    mSyncRequested = true;
+    mSyncCV.notify_one();
+    mDurableCV.wait(lock, [&] { return mDurable >= sequence || mSyncError || !mShouldRun; });
+    if(mSyncError) {
+        std::rethrow_exception(mSyncError);
+    }
+}
+
+void PersistenceLog::syncNow() {
+    std::vector<std::shared_ptr<Segment>> sealed;
+    std::shared_ptr<Segment> active;
+    size_t activeEnd;
+    uint64_t target;
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        sealed.swap(mUnsynced);
+        active = mActive;
+        activeEnd = active->used;
+        target = mAppended;
+    }
+    {
+        std::lock_guard<std::mutex> lock{mDurableMutex};
+        if(target == mDurable && sealed.empty()) {
+            return;
+        }
+    }
+    for(auto& segment: sealed) {
+        // sealed segments don't change anymore, so reading used without the lock is fine
+        syncRange(segment->data, segment->synced, segment->used);
+        segment->synced = segment->used;
+        // give back the preallocated space that the segment didn't need
+        if(ftruncate(segment->fd, segment->used) < 0) {
+            // harmless, replay stops at the zeroes
+        }
+    }
+    if(activeEnd > active->synced) {
+        syncRange(active->data, active->synced, activeEnd);
+        active->synced = activeEnd;
+    }
+    mSyncs += 1;
+    std::lock_guard<std::mutex> lock{mDurableMutex};
+    mDurable = target;
+    mDurableCV.notify_all();
+}
+
+void PersistenceLog::syncThreadFunc() {
+    while(mShouldRun) {
+        {
+            std::unique_lock<std::mutex> lock{mDurableMutex};
+            mSyncCV.wait_for(lock, mConfig.groupCommitInterval, [&] { return mSyncRequested || !mShouldRun; });
+            mSyncRequested = false;
+        }
+        // everything that was appended while the previous sync ran goes out with this one
+        try {
+            syncNow();
+        } catch(...) {
+            std::lock_guard<std::mutex> lock{mDurableMutex};
+            mSyncError = std::current_exception();
+            mDurableCV.notify_all();
+        }
+    }
+    try {
+        syncNow();
+    } catch(...) {
+    }
+}
+
+void PersistenceLog::compactionThreadFunc() {
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock{mCompactionRequestMutex};
+            mCompactionCV.wait(lock, [&] { return mCompactionRequested || !mShouldRun; });
+            if(!mShouldRun) {
+                return;
+            }
+            mCompactionRequested = false;
+        }
+        try {
+            compact();
+        } catch(...) {
+            // the segments on disk are still consistent, the next request tries again
+        }
+    }
+}
+
+PersistenceLog::ReplayPin PersistenceLog::replay(const std::function<void(const PersistRecord&)>& callback) const {
+    ReplayPin pin;
+    std::vector<size_t> used;
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        pin.mSegments = mSegments;
+        for(auto& segment: mSegments) {
+            used.push_back(segment->used);
+        }
+    }
+    // a segment that compaction removes is only unmapped once the last pin to it is gone
+    for(size_t i = 0; i < pin.mSegments.size(); ++i) {
+        forEachRecord(pin.mSegments[i]->data, used[i], [&](const PersistRecord& record, const uint8_t*, size_t) { callback(record); });
+    }
+    return pin;
+}
+
+void PersistenceLog::compact() {
+    std::lock_guard<std::mutex> runLock{mCompactionRunMutex};
+    std::vector<std::pair<std::shared_ptr<Segment>, size_t>> sealed;
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        for(auto& segment: mSegments) {
+            if(segment != mActive) {
+                sealed.emplace_back(segment, segment->used);
+            }
+        }
+    }
+    if(sealed.empty()) {
+        return;
+    }
+
+    /* Everything older than the active segment is in the sealed ones, so only the latest record per key has to be kept
+     * and deletions (UNSUBSCRIBE, SESSION_DELETE, INFLIGHT_DONE, empty RETAIN) can be dropped together with what they
+     * delete.
+     */
+    struct RecordRef {
+        const uint8_t* data;
+        size_t length;
+        bool live;
+    };
+    struct ClientRecords {
+        std::unordered_map<std::string_view, size_t> subscriptions;
+        std::unordered_map<uint16_t, size_t> inflight;
+    };
+    std::vector<RecordRef> records;
+    std::unordered_map<std::string_view, ClientRecords> clients;
+    std::unordered_map<std::string_view, size_t> retained;
+    size_t inputBytes = 0;
+    auto replace = [&](size_t& slot, size_t index) {
+        records[slot].live = false;
+        slot = index;
+    };
+    for(auto& [segment, used]: sealed) {
+        inputBytes += used;
+        forEachRecord(segment->data, used, [&](const PersistRecord& record, const uint8_t* data, size_t length) {
+            size_t index = records.size();
+            records.push_back({data, length, true});
+            switch(record.type) {
+            case PersistRecordType::SUBSCRIBE: {
+                auto [it, inserted] = clients[record.clientId].subscriptions.emplace(record.topic, index);
+                if(!inserted)
+                    replace(it->second, index);
+                break;
+            }
+            case PersistRecordType::INFLIGHT: {
+                auto [it, inserted] = clients[record.clientId].inflight.emplace(record.packetId, index);
+                if(!inserted)
+                    replace(it->second, index);
+                break;
+            }
+            case PersistRecordType::RETAIN: {
+                auto [it, inserted] = retained.emplace(record.topic, index);
+                if(!inserted)
+                    replace(it->second, index);
+                if(record.payload.empty()) {
+                    records[index].live = false;
+                    retained.erase(it);
+                }
+                break;
+            }
+            case PersistRecordType::UNSUBSCRIBE: {
+                records[index].live = false;
+                auto client = clients.find(record.clientId);
+                if(client == clients.end())
+                    break;
+                auto it = client->second.subscriptions.find(record.topic);
+                if(it != client->second.subscriptions.end()) {
+                    records[it->second].live = false;
+                    client->second.subscriptions.erase(it);
+                }
+                break;
+            }
+            case PersistRecordType::INFLIGHT_DONE: {
+                records[index].live = false;
+                auto client = clients.find(record.clientId);
+                if(client == clients.end())
+                    break;
+                auto it = client->second.inflight.find(record.packetId);
+                if(it != client->second.inflight.end()) {
+                    records[it->second].live = false;
+                    client->second.inflight.erase(it);
+                }
+                break;
+            }
+            case PersistRecordType::SESSION_DELETE: {
+                records[index].live = false;
+                auto client = clients.find(record.clientId);
+                if(client == clients.end())
+                    break;
+                for(auto& [filter, subscription]: client->second.subscriptions)
+                    records[subscription].live = false;
+                for(auto& [packetId, inflight]: client->second.inflight)
+                    records[inflight].live = false;
+                clients.erase(client);
+                break;
+            }
+            default:
+                // unknown record from a newer version, keep it
+                break;
+            }
+        });
+    }
+
+    auto tmpPath = mConfig.directory + "/" + COMPACTION_FILE;
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if(!file) {
+        throwErrno("Failed to create " + tmpPath);
+    }
+    uint8_t fileHeader[FILE_HEADER_SIZE];
+    writeFileHeader(fileHeader);
+    size_t outputBytes = FILE_HEADER_SIZE;
+    bool ok = fwrite(fileHeader, 1, FILE_HEADER_SIZE, file) == FILE_HEADER_SIZE;
+    for(auto& record: records) {
+        if(record.live && ok) {
+            ok = fwrite(record.data, 1, record.length, file) == record.length;
+            outputBytes += record.length;
+        }
+    }
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    fclose(file);
+    if(!ok) {
+        std::filesystem::remove(tmpPath);
+        throwErrno("Failed to write " + tmpPath);
+    }
+
+    /* The compacted segment takes the place of the oldest one. Until the others are deleted, replay applies their
+     * records a second time on top of the compacted state, which ends up in the same state, as long as they are
+     * deleted oldest first.
+     */
+    auto target = sealed.front().first;
+    if(rename(tmpPath.c_str(), target->path.c_str()) < 0) {
+        throwErrno("Failed to replace " + target->path);
+    }
+    syncDirectory();
+
+    auto compacted = std::make_shared<Segment>();
+    compacted->sequence = target->sequence;
+    compacted->path = target->path;
+    compacted->fd = open(compacted->path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(compacted->fd < 0) {
+        throwErrno("Failed to open " + compacted->path);
+    }
+    compacted->data = static_cast<uint8_t*>(mmap(nullptr, outputBytes, PROT_READ, MAP_SHARED, compacted->fd, 0));
+    if(compacted->data == MAP_FAILED) {
+        compacted->data = nullptr;
+        throwErrno("Failed to map " + compacted->path);
+    }
+    compacted->mappedSize = outputBytes;
+    compacted->used = outputBytes;
+    compacted->synced = outputBytes;
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        mSegments.erase(mSegments.begin(), mSegments.begin() + sealed.size());
+        mSegments.insert(mSegments.begin(), compacted);
+    }
+    for(size_t i = 1; i < sealed.size(); ++i) {
+        std::filesystem::remove(sealed[i].first->path);
+    }
+    syncDirectory();
+    mCompactions += 1;
+    mCompactedAwayBytes += inputBytes - outputBytes;
+}
+
+PersistenceLog::Stats PersistenceLog::getStats() const {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        stats.segments = mSegments.size();
+        for(auto& segment: mSegments) {
+            stats.bytes += segment->used;
+        }
+        stats.appendedRecords = mAppended;
+    }
+    stats.syncs = mSyncs;
+    stats.compactions = mCompactions;
+    stats.compactedAwayBytes = mCompactedAwayBytes;
+    return stats;
+}
+
+}
\ No newline at end of file
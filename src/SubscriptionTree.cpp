@@ -3,4 +3,64 @@
 
 namespace nioev::lib {
 
+void SubscriptionTreeStats::merge(const SubscriptionTreeStats& other) {
+    nodes += other.nodes;
+    nodesWithSubscribers += other.nodesWithSubscribers;
+    subscriptions += other.subscriptions;
+    wildcardSubscriptions += other.wildcardSubscriptions;
+    singleLevelWildcardNodes += other.singleLevelWildcardNodes;
+    multiLevelWildcardNodes += other.multiLevelWildcardNodes;
+    maxDepth = std::max(maxDepth, other.maxDepth);
+    estimatedBytes += other.estimatedBytes;
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        depthHistogram[i] += other.depthHistogram[i];
+        fanOutHistogram[i] += other.fanOutHistogram[i];
+        subscribersHistogram[i] += other.subscribersHistogram[i];
+    }
+}
+
+void MatchCostSampler::record(std::string_view topic, uint64_t nodesVisited, uint64_t subscribersMatched) {
+    auto prefix = topic.substr(0, topic.find('/'));
+    std::lock_guard<std::mutex> lock{mMutex};
+    PrefixCost* costPtr = &mOther;
+    auto it = mCosts.find(std::string{prefix});
+    if(it != mCosts.end()) {
+        costPtr = &it->second;
+    } else if(mCosts.size() < mMaxPrefixes) {
+        it = mCosts.emplace(std::string{prefix}, PrefixCost{}).first;
+        it->second.prefix = it->first;
+        costPtr = &it->second;
+    }
+    auto& cost = *costPtr;
+    cost.sampledMatches += 1;
+    cost.nodesVisited += nodesVisited;
+    cost.maxNodesVisited = std::max(cost.maxNodesVisited, nodesVisited);
+    cost.subscribersMatched += subscribersMatched;
+}
+
+std::vector<MatchCostSampler::PrefixCost> MatchCostSampler::snapshot() const {
+    std::vector<PrefixCost> ret;
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        ret.reserve(mCosts.size() + 1);
+        for(auto& [prefix, cost]: mCosts) {
+            ret.emplace_back(cost);
+        }
+        if(mOther.sampledMatches > 0) {
+            ret.emplace_back(mOther);
+        }
+    }
+    std::sort(ret.begin(), ret.end(), [](const PrefixCost& a, const PrefixCost& b) {
+        return a.nodesVisited > b.nodesVisited;
+    });
+    return ret;
+}
+
+void MatchCostSampler::reset() {
+    std::lock_guard<std::mutex> lock{mMutex};
+    mCosts.clear();
+    mOther = PrefixCost{};
+    mOther.prefix = OTHER_PREFIX;
+}
+
 }
\ No newline at end of file
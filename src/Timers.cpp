@@ -24,7 +24,8 @@ void Timers::tasksThreadFunc() {
         }
         auto now = std::chrono::steady_clock::now();
         auto smallestDiff = std::chrono::steady_clock::duration::max();
-        for(auto it = mTasks.begin(); it != mTasks.end(); ++it) {
+        for(auto it = mTasks.begin(); it != mTasks.end();) {
+            bool erase = false;
             std::visit(
                 overloaded{ [&](PeriodicTask& p) {
                     auto diff = now - p.lastTimeRun;
@@ -32,11 +33,25 @@ void Timers::tasksThreadFunc() {
                         p.callback();
                         now = std::chrono::steady_clock::now();
                         p.lastTimeRun = now;
+                        smallestDiff = std::min(smallestDiff, p.every);
                     } else {
-                        smallestDiff = std::min(smallestDiff, diff);
+                        smallestDiff = std::min(smallestDiff, p.every - diff);
+                    }
+                }, [&](OneShotTask& o) {
+                    if(now >= o.when) {
+                        o.callback();
+                        now = std::chrono::steady_clock::now();
+                        erase = true;
+                    } else {
+                        smallestDiff = std::min(smallestDiff, o.when - now);
                     }
                 } },
                 *it);
+            if(erase) {
+                it = mTasks.erase(it);
+            } else {
+                ++it;
+            }
         }
         if(smallestDiff == std::chrono::steady_clock::duration::max()) {
             mTasksCV.wait(lock);
@@ -0,0 +1,336 @@
+#include "nioev/lib/WorkloadTrace.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace nioev::lib {
+
+TraceWriter::TraceWriter(const std::string& path)
+: mStart(std::chrono::steady_clock::now()) {
+    mFile = fopen(path.c_str(), "wb");
+    if(!mFile) {
+        throwErrno("Failed to open trace " + path);
+    }
+    mBuffer.insert(mBuffer.end(), MAGIC, MAGIC + sizeof(MAGIC));
+    mBuffer.push_back(VERSION);
+}
+
+TraceWriter::~TraceWriter() {
+    std::lock_guard<std::mutex> lock{mMutex};
+    try {
+        flushLocked();
+    } catch(...) {
+    }
+    fclose(mFile);
+}
+
+uint64_t TraceWriter::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mStart).count();
+}
+
+void TraceWriter::recordSubscribe(uint32_t clientId, const std::string& filter, QoS qos) {
+    TraceEvent event;
+    event.type = TraceEventType::SUBSCRIBE;
+    event.timestamp = now();
+    event.clientId = clientId;
+    event.topic = filter;
+    event.qos = qos;
+    record(event);
+}
+
+void TraceWriter::recordUnsubscribe(uint32_t clientId, const std::string& filter) {
+    TraceEvent event;
+    event.type = TraceEventType::UNSUBSCRIBE;
+    event.timestamp = now();
+    event.clientId = clientId;
+    event.topic = filter;
+    record(event);
+}
+
+void TraceWriter::recordPublish(uint32_t clientId, const MQTTPacket& packet) {
+    TraceEvent event;
+    event.type = TraceEventType::PUBLISH;
+    event.timestamp = now();
+    event.clientId = clientId;
+    event.topic = packet.topic;
+    event.qos = packet.qos;
+    event.retain = packet.retain;
+    event.payloadSize = packet.payload.size();
+    event.propertyCount = packet.properties.size();
+    record(event);
+}
+
+void TraceWriter::recordDisconnect(uint32_t clientId) {
+    TraceEvent event;
+    event.type = TraceEventType::DISCONNECT;
+    event.timestamp = now();
+    event.clientId = clientId;
+    record(event);
+}
+
+void TraceWriter::record(const TraceEvent& event) {
+    std::lock_guard<std::mutex> lock{mMutex};
+    mBuffer.push_back(static_cast<uint8_t>(event.type));
+    mBuffer.push_back(static_cast<uint8_t>(event.qos) | (event.retain == Retain::Yes ? 4 : 0));
+    // events recorded concurrently can arrive slightly out of order, clamp instead of going back in time
+    auto timestamp = std::max(event.timestamp, mLastTimestamp);
+    writeVarInt(timestamp - mLastTimestamp);
+    mLastTimestamp = timestamp;
+    writeVarInt(event.clientId);
+    auto [it, isNew] = mTopics.emplace(event.topic, mTopics.size());
+    writeVarInt((it->second << 1) | (isNew ? 1 : 0));
+    if(isNew) {
+        writeVarInt(event.topic.size());
+        mBuffer.insert(mBuffer.end(), event.topic.begin(), event.topic.end());
+    }
+    if(event.type == TraceEventType::PUBLISH) {
+        writeVarInt(event.payloadSize);
+        writeVarInt(event.propertyCount);
+    }
+    if(mBuffer.size() >= 64 * 1024) {
+        flushLocked();
+    }
+}
+
+void TraceWriter::flush() {
+    std::lock_guard<std::mutex> lock{mMutex};
+    flushLocked();
+}
+
+void TraceWriter::writeVarInt(uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if(value)
+            byte |= 0x80;
+        mBuffer.push_back(byte);
+    } while(value);
+}
+
+void TraceWriter::flushLocked() {
+    if(mBuffer.empty())
+        return;
+    if(fwrite(mBuffer.data(), 1, mBuffer.size(), mFile) != mBuffer.size()) {
+        throwErrno("Failed to write trace");
+    }
+    mBuffer.clear();
+}
+
+TraceReader::TraceReader(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file) {
+        throwErrno("Failed to open trace " + path);
+    }
+    DestructWrapper closeFile{[file] { fclose(file); }};
+    uint8_t chunk[64 * 1024];
+    size_t read;
+    while((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        mData.insert(mData.end(), chunk, chunk + read);
+    }
+    if(ferror(file)) {
+        throwErrno("Failed to read trace " + path);
+    }
+    if(mData.size() < sizeof(TraceWriter::MAGIC) + 1 || memcmp(mData.data(), TraceWriter::MAGIC, sizeof(TraceWriter::MAGIC)) != 0) {
+        throw std::runtime_error{"Not a trace file: " + path};
+    }
+    if(mData.at(sizeof(TraceWriter::MAGIC)) != TraceWriter::VERSION) {
+        throw std::runtime_error{"Unsupported trace version in " + path};
+    }
+    mOffset = sizeof(TraceWriter::MAGIC) + 1;
+}
+
+uint8_t TraceReader::readByte() {
+    if(mOffset >= mData.size()) {
+        throw std::runtime_error{"Truncated trace"};
+    }
+    return mData[mOffset++];
+}
+
+uint64_t TraceReader::readVarInt() {
+    uint64_t value = 0;
+    uint shift = 0;
+    uint8_t byte;
+    do {
+        if(shift > 63) {
+            throw std::runtime_error{"Invalid varint in trace"};
+        }
+        byte = readByte();
+        value |= uint64_t(byte & 0x7F) << shift;
+        shift += 7;
+    } while(byte & 0x80);
+    return value;
+}
+
+std::optional<TraceEvent> TraceReader::next() {
+    if(mOffset >= mData.size()) {
+        return {};
+    }
+    TraceEvent event;
+    event.type = static_cast<TraceEventType>(readByte());
+    if(event.type < TraceEventType::SUBSCRIBE || event.type > TraceEventType::DISCONNECT) {
+        throw std::runtime_error{"Invalid event type in trace"};
+    }
+    auto flags = readByte();
+    event.qos = static_cast<QoS>(flags & 3);
+    event.retain = (flags & 4) ? Retain::Yes : Retain::No;
+    mTimestamp += readVarInt();
+    event.timestamp = mTimestamp;
+    event.clientId = readVarInt();
+    auto topicRef = readVarInt();
+    auto topicIndex = topicRef >> 1;
+    if(topicRef & 1) {
+        auto length = readVarInt();
+        if(topicIndex != mTopics.size() || length > mData.size() - mOffset) {
+            throw std::runtime_error{"Invalid topic in trace"};
+        }
+        mTopics.emplace_back((const char*)mData.data() + mOffset, length);
+        mOffset += length;
+    }
+    if(topicIndex >= mTopics.size()) {
+        throw std::runtime_error{"Invalid topic reference in trace"};
+    }
+    event.topic = mTopics[topicIndex];
+    if(event.type == TraceEventType::PUBLISH) {
+        event.payloadSize = readVarInt();
+        event.propertyCount = readVarInt();
+    }
+    return event;
+}
+
+std::vector<TraceEvent> TraceReader::readAll() {
+    std::vector<TraceEvent> ret;
+    while(auto event = next()) {
+        ret.emplace_back(std::move(*event));
+    }
+    return ret;
+}
+
+WorkloadGenerator::WorkloadGenerator(Config config)
+: mConfig(config), mRandom(config.seed) {
+    // every event is issued by some client and names some topic
+    if(mConfig.clients == 0) {
+        throw std::runtime_error{"Workload needs at least one client"};
+    }
+    static constexpr const char* SENSORS[] = {"temperature", "humidity", "pressure", "battery", "status", "position", "co2", "voltage", "current", "rssi"};
+    for(uint32_t region = 0; region < mConfig.regions; ++region) {
+        for(uint32_t site = 0; site < mConfig.sitesPerRegion; ++site) {
+            for(uint32_t device = 0; device < mConfig.devicesPerSite; ++device) {
+                for(uint32_t sensor = 0; sensor < mConfig.sensorsPerDevice; ++sensor) {
+                    mTopics.emplace_back("region" + std::to_string(region) + "/site" + std::to_string(site) + "/device" + std::to_string(device) + "/" +
+                                         SENSORS[sensor % std::size(SENSORS)] + (sensor >= std::size(SENSORS) ? std::to_string(sensor) : ""));
+                }
+            }
+        }
+    }
+    if(mTopics.empty()) {
+        throw std::runtime_error{"Workload needs at least one topic"};
+    }
+    // popularity rank must not follow the hierarchy, hot devices are spread all over the place
+    std::shuffle(mTopics.begin(), mTopics.end(), mRandom);
+    mZipfCdf.reserve(mTopics.size());
+    double sum = 0;
+    for(size_t rank = 1; rank <= mTopics.size(); ++rank) {
+        sum += 1.0 / std::pow(static_cast<double>(rank), mConfig.zipfExponent);
+        mZipfCdf.push_back(sum);
+    }
+    for(auto& c: mZipfCdf) {
+        c /= sum;
+    }
+    mClientFilters.resize(mConfig.clients);
+}
+
+double WorkloadGenerator::uniform() {
+    return std::uniform_real_distribution<double>{0.0, 1.0}(mRandom);
+}
+
+size_t WorkloadGenerator::zipfTopicIndex() {
+    auto it = std::lower_bound(mZipfCdf.begin(), mZipfCdf.end(), uniform());
+    return std::min<size_t>(it - mZipfCdf.begin(), mTopics.size() - 1);
+}
+
+std::string WorkloadGenerator::filterFor() {
+    // clients watch devices regardless of how busy they are, only publishes follow the Zipf distribution
+    auto parts = splitTopics(mTopics[std::uniform_int_distribution<size_t>{0, mTopics.size() - 1}(mRandom)]);
+    if(uniform() >= mConfig.wildcardFraction) {
+        return parts[0] + "/" + parts[1] + "/" + parts[2] + "/" + parts[3];
+    }
+    switch(std::uniform_int_distribution<int>{0, 2}(mRandom)) {
+    case 0:
+        // every device of a site: region/site/+/sensor
+        return parts[0] + "/" + parts[1] + "/+/" + parts[3];
+    case 1:
+        // everything of a device
+        return parts[0] + "/" + parts[1] + "/" + parts[2] + "/#";
+    default:
+        // everything of a site
+        return parts[0] + "/" + parts[1] + "/#";
+    }
+}
+
+std::vector<TraceEvent> WorkloadGenerator::generate(size_t events) {
+    std::vector<TraceEvent> ret;
+    ret.reserve(events + mConfig.clients * mConfig.subscriptionsPerClient);
+    uint64_t timestamp = 0;
+    std::exponential_distribution<double> interArrival{mConfig.eventsPerSecond / 1e9};
+    std::exponential_distribution<double> payloadSize{1.0 / std::max<uint32_t>(mConfig.meanPayloadSize, 1)};
+    auto subscribe = [&](uint32_t clientId) {
+        TraceEvent event;
+        event.type = TraceEventType::SUBSCRIBE;
+        event.timestamp = timestamp;
+        event.clientId = clientId;
+        event.topic = filterFor();
+        event.qos = uniform() < 0.3 ? QoS::QoS1 : QoS::QoS0;
+        mClientFilters[clientId].push_back(event.topic);
+        ret.emplace_back(std::move(event));
+    };
+    for(uint32_t clientId = 0; clientId < mConfig.clients; ++clientId) {
+        for(uint32_t i = 0; i < mConfig.subscriptionsPerClient; ++i) {
+            subscribe(clientId);
+        }
+    }
+    std::uniform_int_distribution<uint32_t> anyClient{0, mConfig.clients - 1};
+    for(size_t i = 0; i < events; ++i) {
+        timestamp += static_cast<uint64_t>(interArrival(mRandom));
+        auto kind = uniform();
+        auto clientId = anyClient(mRandom);
+        if(kind < mConfig.disconnectFraction) {
+            TraceEvent event;
+            event.type = TraceEventType::DISCONNECT;
+            event.timestamp = timestamp;
+            event.clientId = clientId;
+            ret.emplace_back(std::move(event));
+            // the client comes back right away with a fresh set of subscriptions
+            mClientFilters[clientId].clear();
+            for(uint32_t s = 0; s < mConfig.subscriptionsPerClient; ++s) {
+                subscribe(clientId);
+            }
+        } else if(kind < mConfig.disconnectFraction + mConfig.churnFraction) {
+            auto& filters = mClientFilters[clientId];
+            if(!filters.empty() && uniform() < 0.5) {
+                auto index = std::uniform_int_distribution<size_t>{0, filters.size() - 1}(mRandom);
+                TraceEvent event;
+                event.type = TraceEventType::UNSUBSCRIBE;
+                event.timestamp = timestamp;
+                event.clientId = clientId;
+                event.topic = filters[index];
+                filters.erase(filters.begin() + index);
+                ret.emplace_back(std::move(event));
+            } else {
+                subscribe(clientId);
+            }
+        } else {
+            TraceEvent event;
+            event.type = TraceEventType::PUBLISH;
+            event.timestamp = timestamp;
+            event.clientId = clientId;
+            event.topic = mTopics[zipfTopicIndex()];
+            event.qos = uniform() < 0.2 ? QoS::QoS1 : QoS::QoS0;
+            event.retain = uniform() < 0.05 ? Retain::Yes : Retain::No;
+            event.payloadSize = static_cast<uint32_t>(payloadSize(mRandom)) + 1;
+            ret.emplace_back(std::move(event));
+        }
+    }
+    return ret;
+}
+
+}
\ No newline at end of file
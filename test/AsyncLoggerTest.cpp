@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include "nioev/lib/AsyncLogger.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace nioev::lib;
+
+namespace {
+
+// Publish callback that holds the consumer thread inside its first publish until released, so records pile up in
+// the rings while the logger is being destroyed.
+struct BlockingPublisher {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool entered{false};
+    bool released{false};
+    size_t lines{0};
+
+    void operator()(const char*, SharedBuffer&& batch) {
+        std::unique_lock<std::mutex> lock{mutex};
+        lines += std::count(batch.data(), batch.data() + batch.size(), '\n');
+        entered = true;
+        cv.notify_all();
+        cv.wait(lock, [this] { return released; });
+    }
+};
+
+AsyncLogger::Config config() {
+    AsyncLogger::Config config;
+    config.ringCapacity = 1024;
+    config.maxRecordsPerSecondPerFormat = 0;
+    config.maxBatchLines = 4;
+    config.maxBatchDelay = std::chrono::milliseconds{0};
+    return config;
+}
+
+}
+
+TEST(AsyncLoggerTest, ShutdownFlushesEveryRing) {
+    BlockingPublisher publisher;
+    auto logger = std::make_unique<AsyncLogger>(config(), [&](const char* topic, SharedBuffer&& batch) { publisher(topic, std::move(batch)); });
+    NIOEV_ASYNC_LOG(*logger, LogLevel::INFO, "first");
+    {
+        std::unique_lock<std::mutex> lock{publisher.mutex};
+        publisher.cv.wait(lock, [&] { return publisher.entered; });
+    }
+    std::vector<std::thread> producers;
+    for(int t = 0; t < 3; ++t) {
+        producers.emplace_back([&, t] {
+            for(int i = 0; i < 300; ++i) {
+                NIOEV_ASYNC_LOG(*logger, LogLevel::INFO, "producer {} record {}", t, i);
+            }
+        });
+    }
+    for(auto& producer: producers) {
+        producer.join();
+    }
+    for(int i = 0; i < 300; ++i) {
+        NIOEV_ASYNC_LOG(*logger, LogLevel::INFO, "main record {}", i);
+    }
+
+    std::thread destroyer{[&] { logger.reset(); }};
+    // let the destructor request the shutdown while the consumer is still stuck in the first publish
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    {
+        std::lock_guard<std::mutex> lock{publisher.mutex};
+        publisher.released = true;
+        publisher.cv.notify_all();
+    }
+    destroyer.join();
+    EXPECT_EQ(publisher.lines, 1u + 4 * 300);
+}
\ No newline at end of file
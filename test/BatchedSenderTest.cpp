@@ -0,0 +1,221 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "nioev/lib/BatchedSender.hpp"
+
+using namespace nioev::lib;
+
+namespace {
+
+// A non-blocking stream socket pair with small buffers, so that large writes stop halfway.
+struct SocketPair {
+    SocketPair() {
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+            throwErrno("socketpair");
+        }
+        sender = fds[0];
+        receiver = fds[1];
+        int size = 4096;
+        setsockopt(sender, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    ~SocketPair() {
+        closeSender();
+        closeReceiver();
+    }
+    void closeSender() {
+        if(sender >= 0)
+            close(sender);
+        sender = -1;
+    }
+    void closeReceiver() {
+        if(receiver >= 0)
+            close(receiver);
+        receiver = -1;
+    }
+    // reads whatever is available without blocking
+    void readAvailable(std::vector<uint8_t>& out) const {
+        uint8_t buffer[64 * 1024];
+        ssize_t result;
+        while((result = read(receiver, buffer, sizeof(buffer))) > 0) {
+            out.insert(out.end(), buffer, buffer + result);
+        }
+    }
+
+    int sender{-1};
+    int receiver{-1};
+};
+
+// Buffers of varying size with random content; appends their concatenation to `expected`.
+std::vector<SharedBuffer> makeBuffers(size_t count, std::vector<uint8_t>& expected, uint64_t seed) {
+    std::mt19937_64 random{seed};
+    std::vector<SharedBuffer> ret;
+    for(size_t i = 0; i < count; ++i) {
+        std::vector<uint8_t> bytes(1 + random() % 5000);
+        for(auto& b: bytes) {
+            b = random();
+        }
+        expected.insert(expected.end(), bytes.begin(), bytes.end());
+        SharedBuffer buffer;
+        buffer.append(bytes.data(), bytes.size());
+        ret.emplace_back(std::move(buffer));
+    }
+    return ret;
+}
+
+class BatchedSenderTest : public ::testing::TestWithParam<SendBackend> {
+protected:
+    BatchedSender::Config config() const {
+        BatchedSender::Config config;
+        config.backend = GetParam();
+        // few iovecs, so one flush takes several sends
+        config.maxIovecs = 8;
+        config.maxQueuedBytes = 0;
+        return config;
+    }
+};
+
+#define SKIP_IF_BACKEND_UNAVAILABLE(sender)                                                                                 \
+    if((sender).getBackend() != GetParam())                                                                                 \
+    GTEST_SKIP() << "io_uring isn't available here"
+
+}
+
+TEST_P(BatchedSenderTest, KeepsOrderAcrossPartialWrites) {
+    BatchedSender sender{config()};
+    SKIP_IF_BACKEND_UNAVAILABLE(sender);
+    SocketPair pair;
+    sender.addSocket(pair.sender);
+    std::vector<uint8_t> expected, received;
+    for(auto& buffer: makeBuffers(500, expected, 1)) {
+        ASSERT_TRUE(sender.enqueue(pair.sender, std::move(buffer)));
+    }
+    sender.flush();
+    for(int i = 0; i < 100000 && received.size() < expected.size(); ++i) {
+        pair.readAvailable(received);
+        sender.poll(std::chrono::milliseconds{5});
+    }
+    pair.readAvailable(received);
+    ASSERT_EQ(received.size(), expected.size());
+    EXPECT_TRUE(received == expected);
+    EXPECT_EQ(sender.pendingBytes(pair.sender), 0u);
+    EXPECT_EQ(sender.getStats().bytesSent, expected.size());
+    EXPECT_GT(sender.getStats().partialSends + sender.getStats().wouldBlock, 0u);
+}
+
+TEST_P(BatchedSenderTest, ManySocketsInOneFlush) {
+    BatchedSender sender{config()};
+    SKIP_IF_BACKEND_UNAVAILABLE(sender);
+    std::vector<std::unique_ptr<SocketPair>> pairs;
+    std::vector<std::vector<uint8_t>> expected(16), received(16);
+    for(size_t i = 0; i < 16; ++i) {
+        pairs.emplace_back(std::make_unique<SocketPair>());
+        sender.addSocket(pairs[i]->sender);
+        for(auto& buffer: makeBuffers(3, expected[i], 100 + i)) {
+            ASSERT_TRUE(sender.enqueue(pairs[i]->sender, std::move(buffer)));
+        }
+    }
+    sender.flush();
+    for(int round = 0; round < 10000; ++round) {
+        bool done = true;
+        for(size_t i = 0; i < 16; ++i) {
+            pairs[i]->readAvailable(received[i]);
+            done = done && received[i].size() == expected[i].size();
+        }
+        if(done)
+            break;
+        sender.poll(std::chrono::milliseconds{5});
+    }
+    for(size_t i = 0; i < 16; ++i) {
+        EXPECT_TRUE(received[i] == expected[i]) << "socket " << i;
+    }
+}
+
+TEST_P(BatchedSenderTest, ReportsEpipeOnceThePeerIsGone) {
+    std::vector<std::pair<int, int>> errors;
+    BatchedSender sender{config(), [&](int fd, int error) { errors.emplace_back(fd, error); }};
+    SKIP_IF_BACKEND_UNAVAILABLE(sender);
+    SocketPair pair;
+    sender.addSocket(pair.sender);
+    pair.closeReceiver();
+    std::vector<uint8_t> expected;
+    for(auto& buffer: makeBuffers(4, expected, 2)) {
+        sender.enqueue(pair.sender, std::move(buffer));
+    }
+    for(int i = 0; i < 100 && errors.empty(); ++i) {
+        sender.poll(std::chrono::milliseconds{5});
+    }
+    ASSERT_EQ(errors.size(), 1u);
+    EXPECT_EQ(errors[0].first, pair.sender);
+    EXPECT_EQ(errors[0].second, EPIPE);
+    EXPECT_EQ(sender.pendingBytes(pair.sender), 0u);
+    SharedBuffer more;
+    more.append("x", 1);
+    EXPECT_FALSE(sender.enqueue(pair.sender, std::move(more)));
+}
+
+TEST_P(BatchedSenderTest, RemoveWhileBlockedReleasesTheSocket) {
+    BatchedSender sender{config()};
+    SKIP_IF_BACKEND_UNAVAILABLE(sender);
+    SocketPair blocked, other;
+    sender.addSocket(blocked.sender);
+    sender.addSocket(other.sender);
+    std::vector<uint8_t> unused, expected, received;
+    for(auto& buffer: makeBuffers(200, unused, 3)) {
+        sender.enqueue(blocked.sender, std::move(buffer));
+    }
+    // nobody reads, so the socket fills up and waits for POLLOUT
+    for(int i = 0; i < 10; ++i) {
+        sender.poll(std::chrono::milliseconds{1});
+    }
+    ASSERT_GT(sender.pendingBytes(blocked.sender), 0u);
+
+    sender.removeSocket(blocked.sender);
+    EXPECT_EQ(sender.pendingBytes(blocked.sender), 0u);
+    SharedBuffer more;
+    more.append("x", 1);
+    EXPECT_FALSE(sender.enqueue(blocked.sender, std::move(more)));
+    // the cancelled operation completes and frees the socket, without waiting for the peer or the destructor
+    for(int i = 0; i < 50 && sender.retiredSockets() > 0; ++i) {
+        sender.poll(std::chrono::milliseconds{10});
+    }
+    EXPECT_EQ(sender.retiredSockets(), 0u);
+    blocked.closeSender();
+
+    // the other socket isn't affected
+    for(auto& buffer: makeBuffers(50, expected, 4)) {
+        ASSERT_TRUE(sender.enqueue(other.sender, std::move(buffer)));
+    }
+    for(int i = 0; i < 100000 && received.size() < expected.size(); ++i) {
+        other.readAvailable(received);
+        sender.poll(std::chrono::milliseconds{5});
+    }
+    other.readAvailable(received);
+    EXPECT_TRUE(received == expected);
+}
+
+TEST_P(BatchedSenderTest, DestroyWithOperationsInFlight) {
+    SocketPair pair;
+    {
+        BatchedSender sender{config()};
+        SKIP_IF_BACKEND_UNAVAILABLE(sender);
+        sender.addSocket(pair.sender);
+        std::vector<uint8_t> unused;
+        for(auto& buffer: makeBuffers(200, unused, 5)) {
+            sender.enqueue(pair.sender, std::move(buffer));
+        }
+        sender.flush();
+    }
+    // the sender never closes sockets
+    EXPECT_GE(fcntl(pair.sender, F_GETFD), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, BatchedSenderTest, ::testing::Values(SendBackend::EPOLL, SendBackend::IO_URING), [](const auto& info) {
+    return info.param == SendBackend::EPOLL ? std::string{"Epoll"} : std::string{"IoUring"};
+});
\ No newline at end of file
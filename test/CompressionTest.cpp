@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+
+#include "nioev/lib/Compression.hpp"
+
+#include <set>
+
+using namespace nioev::lib;
+
+namespace {
+
+SharedBuffer makePayload(size_t size) {
+    std::string content;
+    while(content.size() < size) {
+        content += "{\"temperature\":21.5,\"unit\":\"C\"}";
+    }
+    SharedBuffer ret;
+    ret.append(content.data(), size);
+    return ret;
+}
+
+std::set<std::string> prefixesOf(const PayloadCompressor& compressor) {
+    std::set<std::string> ret;
+    for(auto& stats: compressor.getStats()) {
+        ret.insert(stats.prefix);
+    }
+    return ret;
+}
+
+}
+
+TEST(PayloadCompressorTest, RandomPrefixesStayCapped) {
+    PayloadCompressor::Config config;
+    config.minSize = 64;
+    config.maxPrefixes = 4;
+    PayloadCompressor compressor{config};
+    auto payload = makePayload(512);
+    for(int i = 0; i < 1000; ++i) {
+        (void)compressor.compress("tenant" + std::to_string(i) + "/sensor", payload);
+    }
+    auto prefixes = prefixesOf(compressor);
+    EXPECT_EQ(prefixes, (std::set<std::string>{"tenant0", "tenant1", "tenant2", "tenant3", PayloadCompressor::OTHER_PREFIX}));
+
+    // prefixes that made it below the cap keep their own entry
+    (void)compressor.compress("tenant2/other", payload);
+    uint64_t tenant2Payloads = 0;
+    for(auto& stats: compressor.getStats()) {
+        if(stats.prefix == "tenant2")
+            tenant2Payloads += stats.compressedPayloads + stats.skippedPayloads;
+    }
+    EXPECT_EQ(tenant2Payloads, 2u);
+}
+
+TEST(PayloadCompressorTest, SmallPayloadsDontCreatePrefixes) {
+    PayloadCompressor::Config config;
+    config.minSize = 64;
+    PayloadCompressor compressor{config};
+    auto small = makePayload(16);
+    for(int i = 0; i < 100; ++i) {
+        EXPECT_FALSE(compressor.compress("tenant" + std::to_string(i) + "/sensor", small));
+    }
+    EXPECT_TRUE(compressor.getStats().empty());
+
+    (void)compressor.compress("known/sensor", makePayload(512));
+    EXPECT_FALSE(compressor.compress("known/sensor", small));
+    auto stats = compressor.getStats();
+    ASSERT_EQ(stats.size(), 1u);
+    EXPECT_EQ(stats[0].prefix, "known");
+    EXPECT_EQ(stats[0].compressedPayloads + stats[0].skippedPayloads, 2u);
+}
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include "nioev/lib/Coroutine.hpp"
+
+#include <functional>
+
+using namespace nioev::lib;
+
+namespace {
+
+struct DoubleRequest {
+    int value{0};
+    std::function<void(int)> done;
+};
+
+// written the pre-coroutine way: the task carries its continuation
+class DoublingServer final : public GenServer<DoubleRequest> {
+public:
+    DoublingServer()
+    : GenServer<DoubleRequest>("test-doubling") {
+        startThread();
+    }
+    ~DoublingServer() override {
+        stopThread();
+    }
+    std::atomic<bool> accepting{true};
+    std::atomic<std::thread::id> workerThread;
+
+protected:
+    void handleTask(DoubleRequest&& task) override {
+        workerThread = std::this_thread::get_id();
+        task.done(task.value * 2);
+    }
+    bool allowEnqueue(const DoubleRequest&) override {
+        return accepting;
+    }
+};
+
+struct FlushRequest {
+    std::function<void()> done;
+};
+
+class FlushServer final : public GenServer<FlushRequest> {
+public:
+    FlushServer()
+    : GenServer<FlushRequest>("test-flush") {
+        startThread();
+    }
+    ~FlushServer() override {
+        stopThread();
+    }
+    int flushes{0};
+
+protected:
+    void handleTask(FlushRequest&& task) override {
+        flushes += 1;
+        task.done();
+    }
+};
+
+}
+
+TEST(CoroutineTest, AwaitsAnExistingGenServer) {
+    DoublingServer server;
+    auto [result, resumedOn] = syncWait([](DoublingServer& server) -> Task<std::pair<int, std::thread::id>> {
+        int sum = 0;
+        for(int i = 1; i <= 3; ++i) {
+            sum += co_await call<int>(server, [&](auto done) { return DoubleRequest{i, std::move(done)}; });
+        }
+        co_return std::make_pair(sum, std::this_thread::get_id());
+    }(server));
+    EXPECT_EQ(result, 12);
+    // resumed directly by the server, no extra hop
+    EXPECT_EQ(resumedOn, server.workerThread.load());
+    EXPECT_NE(resumedOn, std::this_thread::get_id());
+}
+
+TEST(CoroutineTest, AwaitsAnExistingGenServerWithoutResult) {
+    FlushServer server;
+    syncWait([](FlushServer& server) -> Task<void> {
+        co_await call(server, [](auto done) { return FlushRequest{std::move(done)}; });
+        co_await call(server, [](auto done) { return FlushRequest{std::move(done)}; });
+    }(server));
+    EXPECT_EQ(server.flushes, 2);
+}
+
+TEST(CoroutineTest, RejectedCallThrowsOnTheAwaitingThread) {
+    DoublingServer server;
+    // make sure the worker is running before stopping it again, see GenServer::stopThread()
+    EXPECT_EQ(syncWait([](DoublingServer& server) -> Task<int> {
+        co_return co_await call<int>(server, [](auto done) { return DoubleRequest{1, std::move(done)}; });
+    }(server)), 2);
+    server.accepting = false;
+    EXPECT_THROW(syncWait([](DoublingServer& server) -> Task<int> {
+        co_return co_await call<int>(server, [](auto done) { return DoubleRequest{1, std::move(done)}; });
+    }(server)), std::runtime_error);
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+
+#include "nioev/lib/Delivery.hpp"
+
+using namespace nioev::lib;
+
+namespace {
+
+DeliveryMessage makeMessage(std::string_view topic, std::string_view payload) {
+    return DeliveryMessage{topic, reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), QoS::QoS0, Retained::No};
+}
+
+class RecordingSubscriber final : public BatchSubscriber {
+public:
+    void deliver(const DeliveryBatch& batch) override {
+        calls += 1;
+        for(auto& message: batch) {
+            payloads.emplace_back(reinterpret_cast<const char*>(message.payload.data()), message.payload.size());
+        }
+    }
+    int calls{0};
+    std::vector<std::string> payloads;
+};
+
+}
+
+TEST(BatchDispatcherTest, DeliversEachMessageOnceInRoutingOrder) {
+    RecordingSubscriber overlapping;
+    RecordingSubscriber exact;
+    SubscriptionTree<BatchSubscriber*> tree;
+    // three filters of the same subscriber match a/b
+    tree.addSubscription("a/b", &overlapping);
+    tree.addSubscription("a/+", &overlapping);
+    tree.addSubscription("#", &overlapping);
+    tree.addSubscription("a/b", &exact);
+
+    BatchDispatcher dispatcher;
+    EXPECT_EQ(dispatcher.route(tree, makeMessage("a/b", "1")), 4u);
+    EXPECT_EQ(dispatcher.route(tree, makeMessage("c", "2")), 1u);
+    EXPECT_EQ(dispatcher.route(tree, makeMessage("a/b", "3")), 4u);
+    EXPECT_EQ(dispatcher.pendingMessages(), 3u);
+    dispatcher.flush();
+
+    EXPECT_EQ(overlapping.calls, 1);
+    EXPECT_EQ(overlapping.payloads, (std::vector<std::string>{"1", "2", "3"}));
+    EXPECT_EQ(exact.calls, 1);
+    EXPECT_EQ(exact.payloads, (std::vector<std::string>{"1", "3"}));
+    EXPECT_EQ(dispatcher.pendingMessages(), 0u);
+    auto stats = dispatcher.getStats();
+    EXPECT_EQ(stats.messages, 3u);
+    EXPECT_EQ(stats.deliveries, 5u);
+    EXPECT_EQ(stats.deliverCalls, 2u);
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include "nioev/lib/Memory.hpp"
+#include "nioev/lib/Util.hpp"
+
+using namespace nioev::lib;
+
+namespace {
+
+// longer than the small string buffer, so every string value has to allocate
+constexpr std::string_view CONTENT_TYPE = "application/vnd.example.telemetry+json; charset=utf-8";
+constexpr std::string_view USER_KEY = "a user property key that doesn't fit inline";
+constexpr std::string_view USER_VALUE = "a user property value that doesn't fit inline";
+
+// routes everything that doesn't name its memory resource to a counter for the lifetime of the fixture
+class MemoryTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mPreviousDefault = std::pmr::set_default_resource(&mDefaultResource);
+    }
+    void TearDown() override {
+        std::pmr::set_default_resource(mPreviousDefault);
+    }
+
+    pmr::MQTTPacket makePacket(const std::pmr::polymorphic_allocator<char>& alloc) {
+        pmr::MQTTPacket packet{alloc};
+        packet.topic.assign("region0/site1/device2/temperature, long enough to allocate");
+        packet.payload.assign(100, 'x');
+        packet.qos = QoS::QoS1;
+        packet.retain = Retain::No;
+        packet.properties.emplace(MQTTProperty::CONTENT_TYPE, pmr::MQTTPropertyValue{std::in_place_type<BasicString<std::pmr::polymorphic_allocator>>, CONTENT_TYPE, alloc});
+        packet.properties.emplace(MQTTProperty::USER_PROPERTY,
+            pmr::MQTTPropertyValue{std::in_place_type<std::pair<BasicString<std::pmr::polymorphic_allocator>, BasicString<std::pmr::polymorphic_allocator>>>,
+                BasicString<std::pmr::polymorphic_allocator>{USER_KEY, alloc}, BasicString<std::pmr::polymorphic_allocator>{USER_VALUE, alloc}});
+        packet.properties.emplace(MQTTProperty::CORRELATION_DATA, pmr::MQTTPropertyValue{std::in_place_type<BasicBytes<std::pmr::polymorphic_allocator>>, 64, uint8_t(7), alloc});
+        packet.properties.emplace(MQTTProperty::MESSAGE_EXPIRY_INTERVAL, pmr::MQTTPropertyValue{uint32_t(60)});
+        return packet;
+    }
+
+    // every allocation of the packet must come from `resource`
+    static void expectAllocatedFrom(const pmr::MQTTPacket& packet, std::pmr::memory_resource* resource) {
+        EXPECT_EQ(packet.topic.get_allocator().resource(), resource);
+        EXPECT_EQ(packet.payload.get_allocator().resource(), resource);
+        EXPECT_EQ(packet.properties.get_allocator().resource(), resource);
+        auto& contentType = std::get<BasicString<std::pmr::polymorphic_allocator>>(packet.properties.find(MQTTProperty::CONTENT_TYPE)->second);
+        EXPECT_EQ(contentType, CONTENT_TYPE);
+        EXPECT_EQ(contentType.get_allocator().resource(), resource);
+        auto& userProperty = std::get<std::pair<BasicString<std::pmr::polymorphic_allocator>, BasicString<std::pmr::polymorphic_allocator>>>(
+            packet.properties.find(MQTTProperty::USER_PROPERTY)->second);
+        EXPECT_EQ(userProperty.first, USER_KEY);
+        EXPECT_EQ(userProperty.second, USER_VALUE);
+        EXPECT_EQ(userProperty.first.get_allocator().resource(), resource);
+        EXPECT_EQ(userProperty.second.get_allocator().resource(), resource);
+        auto& correlationData = std::get<BasicBytes<std::pmr::polymorphic_allocator>>(packet.properties.find(MQTTProperty::CORRELATION_DATA)->second);
+        EXPECT_EQ(correlationData.size(), 64u);
+        EXPECT_EQ(correlationData.get_allocator().resource(), resource);
+        EXPECT_EQ(std::get<uint32_t>(packet.properties.find(MQTTProperty::MESSAGE_EXPIRY_INTERVAL)->second), 60u);
+    }
+
+    CountingResource mDefaultResource;
+    std::pmr::memory_resource* mPreviousDefault{nullptr};
+};
+
+}
+
+TEST_F(MemoryTest, ArenaToArenaCopyStaysInTheTargetArena) {
+    CountingResource sourceUpstream;
+    CountingResource targetUpstream;
+    // small enough that the copy has to take chunks from the upstream of the target
+    PacketArena<256> source{&sourceUpstream};
+    PacketArena<256> target{&targetUpstream};
+    auto packet = makePacket(source.allocator());
+    auto defaultBefore = mDefaultResource.getStats().allocations;
+    auto sourceBefore = source.getStats().allocations;
+
+    pmr::MQTTPacket copy{packet, target.allocator()};
+    expectAllocatedFrom(copy, &target);
+    EXPECT_EQ(mDefaultResource.getStats().allocations, defaultBefore);
+    EXPECT_EQ(source.getStats().allocations, sourceBefore);
+    EXPECT_GT(targetUpstream.getStats().allocations, 0u);
+
+    // moving into another resource has to copy as well
+    pmr::MQTTPacket moved{std::move(copy), source.allocator()};
+    expectAllocatedFrom(moved, &source);
+    EXPECT_EQ(mDefaultResource.getStats().allocations, defaultBefore);
+}
+
+TEST_F(MemoryTest, PropertyListCopyUsesTheTargetAllocator) {
+    PacketArena<> source;
+    PacketArena<> target;
+    auto packet = makePacket(source.allocator());
+    auto defaultBefore = mDefaultResource.getStats().allocations;
+
+    pmr::PropertyList properties{packet.properties, target.allocator()};
+    pmr::MQTTPacket copy{target.allocator()};
+    copy.properties = std::move(properties);
+    copy.topic.assign(packet.topic);
+    copy.payload.assign(packet.payload.begin(), packet.payload.end());
+    expectAllocatedFrom(copy, &target);
+    EXPECT_EQ(mDefaultResource.getStats().allocations, defaultBefore);
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include "nioev/lib/OutboundQueue.hpp"
+
+using namespace nioev::lib;
+
+namespace {
+
+DeliveryMessage makeMessage(std::string_view topic, std::string_view payload, QoS qos = QoS::QoS0) {
+    return DeliveryMessage{topic, reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), qos, Retained::No};
+}
+
+std::string payloadOf(const DeliveryMessage& message) {
+    return std::string{reinterpret_cast<const char*>(message.payload.data()), message.payload.size()};
+}
+
+std::vector<std::string> drainPayloads(OutboundQueue& queue) {
+    std::vector<std::string> ret;
+    while(!queue.empty()) {
+        ret.push_back(payloadOf(queue.pop()));
+    }
+    return ret;
+}
+
+OutboundQueue::Config config(size_t maxMessages, size_t maxBytes, OutboundDropPolicy policy) {
+    OutboundQueue::Config config;
+    config.maxMessages = maxMessages;
+    config.maxBytes = maxBytes;
+    config.dropPolicy = policy;
+    return config;
+}
+
+}
+
+TEST(OutboundQueueTest, ConflatesQoS0PerTopicInPublishOrder) {
+    OutboundQueue queue{config(10, 1000, OutboundDropPolicy::DROP_OLDEST_QOS0)};
+    EXPECT_EQ(queue.push(makeMessage("a", "1")), OutboundPushResult::QUEUED);
+    EXPECT_EQ(queue.push(makeMessage("b", "2")), OutboundPushResult::QUEUED);
+    EXPECT_EQ(queue.push(makeMessage("a", "3", QoS::QoS1)), OutboundPushResult::QUEUED);
+    EXPECT_EQ(queue.push(makeMessage("a", "4")), OutboundPushResult::CONFLATED);
+    EXPECT_EQ(queue.getStats().conflated, 1u);
+    EXPECT_EQ(queue.bytes(), 6u);
+    EXPECT_EQ(drainPayloads(queue), (std::vector<std::string>{"2", "3", "4"}));
+}
+
+TEST(OutboundQueueTest, ConflationMakesRoomForTheReplacement) {
+    // exactly full: replacing a message must not need any extra room
+    OutboundQueue queue{config(2, 1000, OutboundDropPolicy::DROP_NEW)};
+    queue.push(makeMessage("a", "1", QoS::QoS1));
+    queue.push(makeMessage("b", "2"));
+    EXPECT_EQ(queue.push(makeMessage("b", "3")), OutboundPushResult::CONFLATED);
+    EXPECT_EQ(queue.getStats().droppedNew, 0u);
+    EXPECT_EQ(drainPayloads(queue), (std::vector<std::string>{"1", "3"}));
+}
+
+TEST(OutboundQueueTest, RejectedMessageKeepsThePreviousValue) {
+    // too large on its own
+    {
+        OutboundQueue queue{config(10, 10, OutboundDropPolicy::DROP_OLDEST_QOS0)};
+        queue.push(makeMessage("t", "old"));
+        EXPECT_EQ(queue.push(makeMessage("t", std::string(20, 'x'))), OutboundPushResult::DROPPED);
+        EXPECT_EQ(queue.getStats().conflated, 0u);
+        EXPECT_EQ(drainPayloads(queue), std::vector<std::string>{"old"});
+    }
+    // DROP_NEW with the replacement larger than what conflation frees
+    {
+        OutboundQueue queue{config(10, 10, OutboundDropPolicy::DROP_NEW)};
+        queue.push(makeMessage("t", "old"));
+        queue.push(makeMessage("u", "12345", QoS::QoS1));
+        EXPECT_EQ(queue.push(makeMessage("t", "longer")), OutboundPushResult::DROPPED);
+        EXPECT_EQ(queue.getStats().conflated, 0u);
+        EXPECT_EQ(drainPayloads(queue), (std::vector<std::string>{"old", "12345"}));
+    }
+    // DROP_OLDEST_QOS0 with nothing but the previous value to evict
+    {
+        OutboundQueue queue{config(10, 10, OutboundDropPolicy::DROP_OLDEST_QOS0)};
+        queue.push(makeMessage("t", "old"));
+        queue.push(makeMessage("u", "12345", QoS::QoS1));
+        EXPECT_EQ(queue.push(makeMessage("t", "longer")), OutboundPushResult::DROPPED);
+        EXPECT_EQ(queue.getStats().droppedOld, 0u);
+        EXPECT_EQ(drainPayloads(queue), (std::vector<std::string>{"old", "12345"}));
+
+        // and with no QoS 0 message queued at all
+        EXPECT_EQ(queue.push(makeMessage("u", "12345678", QoS::QoS1)), OutboundPushResult::QUEUED);
+        EXPECT_EQ(queue.push(makeMessage("v", "12", QoS::QoS1)), OutboundPushResult::DROPPED);
+    }
+}
+
+TEST(OutboundQueueTest, EvictsOthersBeforeTheConflatedEntry) {
+    OutboundQueue queue{config(10, 10, OutboundDropPolicy::DROP_OLDEST_QOS0)};
+    queue.push(makeMessage("t", "1"));
+    queue.push(makeMessage("a", "22"));
+    queue.push(makeMessage("b", "33"));
+    // 8 bytes queued; replacing t frees 2 of them but the new one needs 8, so a and b have to go as well
+    EXPECT_EQ(queue.push(makeMessage("t", "xxxxxxx")), OutboundPushResult::CONFLATED);
+    EXPECT_EQ(queue.getStats().droppedOld, 2u);
+    EXPECT_EQ(drainPayloads(queue), std::vector<std::string>{"xxxxxxx"});
+
+    OutboundQueue oldest{config(3, 1000, OutboundDropPolicy::DROP_OLDEST)};
+    oldest.push(makeMessage("t", "1"));
+    oldest.push(makeMessage("a", "2", QoS::QoS1));
+    oldest.push(makeMessage("b", "3", QoS::QoS1));
+    EXPECT_EQ(oldest.push(makeMessage("t", "4")), OutboundPushResult::CONFLATED);
+    EXPECT_EQ(oldest.getStats().droppedOld, 0u);
+    EXPECT_EQ(drainPayloads(oldest), (std::vector<std::string>{"2", "3", "4"}));
+}
+
+TEST(OutboundQueueTest, RejectsMessagesWithoutTopic) {
+    OutboundQueue queue{config(10, 1000, OutboundDropPolicy::DROP_OLDEST_QOS0)};
+    DeliveryMessage message;
+    message.payload.append("x", 1);
+    EXPECT_EQ(queue.push(message), OutboundPushResult::DROPPED);
+    message.qos = QoS::QoS1;
+    EXPECT_EQ(queue.push(message), OutboundPushResult::DROPPED);
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(queue.getStats().droppedNew, 2u);
+}
\ No newline at end of file
@@ -0,0 +1,308 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <map>
+#include <thread>
+
+#include "nioev/lib/PersistenceLog.hpp"
+
+using namespace nioev::lib;
+namespace fs = std::filesystem;
+
+namespace {
+
+// What a broker rebuilds from the log, applied with the same rules as compaction.
+struct RecoveredState {
+    std::map<std::pair<std::string, std::string>, QoS> subscriptions;
+    std::map<std::string, std::string> retained;
+    std::map<std::pair<std::string, uint16_t>, std::string> inflight;
+
+    bool operator==(const RecoveredState& other) const {
+        return subscriptions == other.subscriptions && retained == other.retained && inflight == other.inflight;
+    }
+};
+
+RecoveredState recover(const PersistenceLog& log) {
+    RecoveredState state;
+    (void)log.replay([&](const PersistRecord& record) {
+        std::string clientId{record.clientId};
+        switch(record.type) {
+        case PersistRecordType::SUBSCRIBE:
+            state.subscriptions[{clientId, std::string{record.topic}}] = record.qos;
+            break;
+        case PersistRecordType::UNSUBSCRIBE:
+            state.subscriptions.erase({clientId, std::string{record.topic}});
+            break;
+        case PersistRecordType::SESSION_DELETE:
+            for(auto it = state.subscriptions.begin(); it != state.subscriptions.end();) {
+                it = it->first.first == clientId ? state.subscriptions.erase(it) : std::next(it);
+            }
+            for(auto it = state.inflight.begin(); it != state.inflight.end();) {
+                it = it->first.first == clientId ? state.inflight.erase(it) : std::next(it);
+            }
+            break;
+        case PersistRecordType::RETAIN:
+            if(record.payload.empty()) {
+                state.retained.erase(std::string{record.topic});
+            } else {
+                state.retained[std::string{record.topic}] = std::string{record.payload};
+            }
+            break;
+        case PersistRecordType::INFLIGHT:
+            state.inflight[{clientId, record.packetId}] = std::string{record.payload};
+            break;
+        case PersistRecordType::INFLIGHT_DONE:
+            state.inflight.erase({clientId, record.packetId});
+            break;
+        }
+    });
+    return state;
+}
+
+uint64_t appendRetain(PersistenceLog& log, const std::string& topic, const std::string& payload) {
+    return log.appendRetain(topic, QoS::QoS1, reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+}
+
+uint64_t appendInflight(PersistenceLog& log, const std::string& clientId, uint16_t packetId, const std::string& payload) {
+    return log.appendInflight(clientId, packetId, InflightState::AWAITING_PUBACK, QoS::QoS1, "inflight/topic", reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+}
+
+// Overwrites, deletes and session deletes spread over many small segments.
+uint64_t appendChurn(PersistenceLog& log, int rounds) {
+    uint64_t last = 0;
+    for(int i = 0; i < rounds; ++i) {
+        auto clientId = "client" + std::to_string(i % 7);
+        log.appendSubscribe(clientId, "sensors/" + std::to_string(i % 13), QoS(i % 3));
+        if(i % 5 == 0)
+            log.appendUnsubscribe(clientId, "sensors/" + std::to_string((i + 3) % 13));
+        appendRetain(log, "retained/" + std::to_string(i % 11), i % 9 == 0 ? "" : "value" + std::to_string(i));
+        appendInflight(log, clientId, i % 17, "message" + std::to_string(i));
+        if(i % 4 == 0)
+            log.appendInflightDone(clientId, (i + 1) % 17);
+        if(i % 50 == 49)
+            log.appendSessionDelete("client" + std::to_string(i % 3));
+        last = appendRetain(log, "last", "round" + std::to_string(i));
+    }
+    return last;
+}
+
+std::vector<fs::path> segmentFiles(const std::string& directory) {
+    std::vector<fs::path> ret;
+    for(auto& entry: fs::directory_iterator(directory)) {
+        if(entry.path().extension() == ".log")
+            ret.push_back(entry.path());
+    }
+    std::sort(ret.begin(), ret.end(), [](const fs::path& a, const fs::path& b) {
+        return std::stoull(a.stem().string().substr(8)) < std::stoull(b.stem().string().substr(8));
+    });
+    return ret;
+}
+
+class PersistenceLogTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::string pattern = (fs::temp_directory_path() / "nioev-test-XXXXXX").string();
+        ASSERT_NE(mkdtemp(pattern.data()), nullptr);
+        mDirectory = pattern;
+    }
+    void TearDown() override {
+        fs::remove_all(mDirectory);
+    }
+    PersistenceLog::Config config(size_t compactAfterSealedSegments = 0) const {
+        return PersistenceLog::Config{mDirectory, 4096, std::chrono::microseconds{100}, compactAfterSealedSegments};
+    }
+
+    std::string mDirectory;
+};
+
+}
+
+TEST_F(PersistenceLogTest, RecoversAllRecordTypesAfterReopen) {
+    {
+        PersistenceLog log{config()};
+        log.appendSubscribe("alice", "a/b", QoS::QoS1);
+        log.appendSubscribe("alice", "c/+", QoS::QoS2);
+        log.appendUnsubscribe("alice", "a/b");
+        log.appendSubscribe("bob", "#", QoS::QoS0);
+        appendRetain(log, "r/1", "one");
+        appendRetain(log, "r/2", "two");
+        appendRetain(log, "r/2", "");
+        appendInflight(log, "alice", 1, "first");
+        appendInflight(log, "alice", 2, "second");
+        log.appendInflightDone("alice", 1);
+        appendInflight(log, "bob", 7, "gone");
+        log.waitDurable(log.appendSessionDelete("bob"));
+    }
+    PersistenceLog log{config()};
+    RecoveredState expected;
+    expected.subscriptions[{"alice", "c/+"}] = QoS::QoS2;
+    expected.retained["r/1"] = "one";
+    expected.inflight[{"alice", 2}] = "second";
+    EXPECT_EQ(recover(log), expected);
+
+    SubscriptionTree<std::string> tree;
+    log.recoverSubscriptions(tree, [](const PersistRecord& record) { return std::string{record.clientId}; });
+    std::vector<std::string> matches;
+    tree.forEveryMatch("c/d", [&](std::string& clientId) { matches.push_back(clientId); });
+    EXPECT_EQ(matches, std::vector<std::string>{"alice"});
+    tree.forEveryMatch("a/b", [&](std::string& clientId) { matches.push_back(clientId); });
+    EXPECT_EQ(matches.size(), 1u);
+}
+
+TEST_F(PersistenceLogTest, CompactionKeepsTheRecoveredState) {
+    PersistenceLog log{config()};
+    appendChurn(log, 300);
+    auto before = recover(log);
+    auto statsBefore = log.getStats();
+    ASSERT_GT(statsBefore.segments, 3u);
+
+    log.compact();
+    auto stats = log.getStats();
+    EXPECT_EQ(stats.compactions, 1u);
+    EXPECT_EQ(stats.segments, 2u);
+    EXPECT_GT(stats.compactedAwayBytes, 0u);
+    EXPECT_LT(stats.bytes, statsBefore.bytes);
+    EXPECT_EQ(recover(log), before);
+
+    // and once more on top of an already compacted segment
+    log.waitDurable(appendChurn(log, 100));
+    auto afterMore = recover(log);
+    log.compact();
+    EXPECT_EQ(recover(log), afterMore);
+}
+
+TEST_F(PersistenceLogTest, CompactedLogRecoversAfterReopen) {
+    RecoveredState expected;
+    {
+        PersistenceLog log{config()};
+        log.waitDurable(appendChurn(log, 300));
+        log.compact();
+        expected = recover(log);
+    }
+    PersistenceLog log{config()};
+    EXPECT_EQ(recover(log), expected);
+}
+
+TEST_F(PersistenceLogTest, PinnedViewsSurviveCompaction) {
+    PersistenceLog log{config()};
+    for(int i = 0; i < 200; ++i) {
+        appendRetain(log, "retained/" + std::to_string(i), std::string(40, char('a' + i % 26)));
+    }
+    std::vector<std::string_view> payloads;
+    auto pin = log.replay([&](const PersistRecord& record) { payloads.push_back(record.payload); });
+    ASSERT_GT(pin.segmentCount(), 2u);
+
+    // overwrite everything, so compaction deletes all segments the views point into
+    for(int i = 0; i < 200; ++i) {
+        appendRetain(log, "retained/" + std::to_string(i), "new");
+    }
+    log.compact();
+    ASSERT_EQ(log.getStats().compactions, 1u);
+
+    ASSERT_EQ(payloads.size(), 200u);
+    for(size_t i = 0; i < payloads.size(); ++i) {
+        EXPECT_EQ(payloads[i], std::string(40, char('a' + i % 26)));
+    }
+}
+
+TEST_F(PersistenceLogTest, PinnedReplayRacingStartupCompaction) {
+    {
+        PersistenceLog log{config()};
+        log.waitDurable(appendChurn(log, 300));
+    }
+    // enough sealed segments, so the compaction thread starts right away
+    PersistenceLog log{config(2)};
+    std::vector<std::string_view> lastRounds;
+    auto pin = log.replay([&](const PersistRecord& record) {
+        if(record.type == PersistRecordType::RETAIN && record.topic == "last")
+            lastRounds.push_back(record.payload);
+    });
+    for(int i = 0; i < 500 && log.getStats().compactions == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    ASSERT_EQ(log.getStats().compactions, 1u);
+    ASSERT_FALSE(lastRounds.empty());
+    EXPECT_EQ(lastRounds.back(), "round299");
+}
+
+TEST_F(PersistenceLogTest, TornWriteIsCutOffAndNeverResurfaces) {
+    {
+        PersistenceLog log{config()};
+        appendRetain(log, "kept", "1");
+        appendRetain(log, "kept", "2");
+        log.waitDurable(appendRetain(log, "torn", std::string(100, 'x')));
+    }
+    // crash in the middle of writing the last record
+    auto segments = segmentFiles(mDirectory);
+    ASSERT_EQ(segments.size(), 1u);
+    fs::resize_file(segments.back(), fs::file_size(segments.back()) - 60);
+    {
+        PersistenceLog log{config()};
+        RecoveredState expected;
+        expected.retained["kept"] = "2";
+        EXPECT_EQ(recover(log), expected);
+        log.waitDurable(appendRetain(log, "after", "3"));
+    }
+    PersistenceLog log{config()};
+    RecoveredState expected;
+    expected.retained["kept"] = "2";
+    expected.retained["after"] = "3";
+    EXPECT_EQ(recover(log), expected);
+}
+
+TEST_F(PersistenceLogTest, CorruptRecordEndsReplayOfItsSegment) {
+    {
+        PersistenceLog log{config()};
+        appendRetain(log, "first", "1");
+        appendRetain(log, "second", "2");
+        log.waitDurable(appendRetain(log, "third", "3"));
+    }
+    auto segments = segmentFiles(mDirectory);
+    ASSERT_EQ(segments.size(), 1u);
+    // flip a payload byte of the second record, its CRC no longer matches
+    {
+        FILE* file = fopen(segments.back().c_str(), "r+b");
+        ASSERT_NE(file, nullptr);
+        // file header (16) + first record (24 + 5 + 1, padded to 32) + second header (24) + "second"
+        fseek(file, 16 + 32 + 24 + 6, SEEK_SET);
+        fputc('X', file);
+        fclose(file);
+    }
+    PersistenceLog log{config()};
+    RecoveredState expected;
+    expected.retained["first"] = "1";
+    EXPECT_EQ(recover(log), expected);
+}
+
+TEST_F(PersistenceLogTest, CrashDuringCompactionLosesNothing) {
+    RecoveredState expected;
+    fs::path backup = mDirectory + "-backup";
+    {
+        PersistenceLog log{config()};
+        log.waitDurable(appendChurn(log, 300));
+        expected = recover(log);
+        fs::remove_all(backup);
+        fs::copy(mDirectory, backup);
+        log.compact();
+    }
+    // crash after the compacted segment replaced the oldest one, before the other sealed ones were deleted
+    for(auto& original: segmentFiles(backup.string())) {
+        auto path = fs::path{mDirectory} / original.filename();
+        if(!fs::exists(path))
+            fs::copy_file(original, path);
+    }
+    // and a half written compaction output from a later attempt
+    {
+        FILE* file = fopen((mDirectory + "/compaction.tmp").c_str(), "wb");
+        ASSERT_NE(file, nullptr);
+        fputs("garbage", file);
+        fclose(file);
+    }
+    fs::remove_all(backup);
+
+    PersistenceLog log{config()};
+    EXPECT_FALSE(fs::exists(mDirectory + "/compaction.tmp"));
+    EXPECT_EQ(recover(log), expected);
+    log.compact();
+    EXPECT_EQ(recover(log), expected);
+}
\ No newline at end of file
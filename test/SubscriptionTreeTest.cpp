@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include "nioev/lib/SubscriptionTree.hpp"
+
+using namespace nioev::lib;
+
+namespace {
+
+uint64_t totalSampledMatches(const std::vector<MatchCostSampler::PrefixCost>& costs) {
+    uint64_t ret = 0;
+    for(auto& cost: costs) {
+        ret += cost.sampledMatches;
+    }
+    return ret;
+}
+
+}
+
+TEST(MatchCostSamplerTest, AttributesMatchesToTheFirstLevel) {
+    SubscriptionTree<int> tree;
+    tree.addSubscription("a/b/c", 1);
+    tree.addSubscription("a/+/c", 2);
+    tree.addSubscription("b", 3);
+    MatchCostSampler sampler{1};
+    tree.setMatchCostSampler(&sampler);
+    tree.forEveryMatch("a/b/c", [](int&) {});
+    tree.forEveryMatch("a/x/c", [](int&) {});
+    tree.forEveryMatch("b", [](int&) {});
+
+    auto costs = sampler.snapshot();
+    ASSERT_EQ(costs.size(), 2u);
+    EXPECT_EQ(costs[0].prefix, "a");
+    EXPECT_EQ(costs[0].sampledMatches, 2u);
+    EXPECT_EQ(costs[0].subscribersMatched, 3u);
+    EXPECT_EQ(costs[1].prefix, "b");
+    EXPECT_EQ(costs[1].subscribersMatched, 1u);
+
+    sampler.reset();
+    EXPECT_TRUE(sampler.snapshot().empty());
+}
+
+TEST(MatchCostSamplerTest, FoldsPrefixesBeyondTheLimitIntoOther) {
+    MatchCostSampler sampler{1, 4};
+    for(int i = 0; i < 1000; ++i) {
+        sampler.record("random" + std::to_string(i) + "/x", 2, 0);
+    }
+    // known prefixes keep their own entry after the limit is reached
+    sampler.record("random0/y", 3, 1);
+
+    auto costs = sampler.snapshot();
+    ASSERT_EQ(costs.size(), 5u);
+    EXPECT_EQ(costs[0].prefix, MatchCostSampler::OTHER_PREFIX);
+    EXPECT_EQ(costs[0].sampledMatches, 996u);
+    EXPECT_EQ(totalSampledMatches(costs), 1001u);
+    auto random0 = std::find_if(costs.begin(), costs.end(), [](auto& cost) { return cost.prefix == "random0"; });
+    ASSERT_NE(random0, costs.end());
+    EXPECT_EQ(random0->sampledMatches, 2u);
+    EXPECT_EQ(random0->maxNodesVisited, 3u);
+
+    sampler.reset();
+    EXPECT_TRUE(sampler.snapshot().empty());
+    sampler.record("new/x", 1, 0);
+    ASSERT_EQ(sampler.snapshot().size(), 1u);
+    EXPECT_EQ(sampler.snapshot()[0].prefix, "new");
+}
\ No newline at end of file